@@ -0,0 +1,123 @@
+#define LOG_CAT LOG_CAT_BOOT
+#include "arch/x86_64/acpi/acpi.h"
+#include "arch/x86_64/mm/vmm.h"
+#include "core/log.h"
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+    char signature[8];                  // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;                   // 0: ACPI 1.0, 2+: has the fields below
+    uint32_t rsdt;
+    uint32_t length;
+    uint64_t xsdt;
+    uint8_t ext_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+#define MADT_LAPIC          0
+#define MADT_IOAPIC         1
+#define MADT_LAPIC_OVERRIDE 5
+#define MADT_X2APIC         9
+#define MADT_ENABLED        (1u << 0)
+
+static const acpi_sdt_header_t *root;   // RSDT or XSDT
+static int root_is_xsdt;
+
+static int checksum_ok(const void *p, size_t len) {
+    uint8_t sum = 0;
+    for (size_t i = 0; i < len; i++) sum += ((const uint8_t *)p)[i];
+    return sum == 0;
+}
+
+/* Tables live in reserved or ACPI memory, which the boot identity map only
+ * covers below 1 GiB; anything above is mapped into the HHDM on demand. */
+static const void *acpi_map(uint64_t phys, size_t len) {
+    if (phys + len <= VMM_IDENTITY_SIZE) return (const void *)phys;
+    for (uint64_t pa = phys & ~(uint64_t)(PAGE_SIZE - 1); pa < phys + len; pa += PAGE_SIZE) {
+        if (vmm_translate(vmm_kernel_space(), VMM_HHDM_BASE + pa) != VMM_NO_MAPPING) continue;
+        if (vmm_map(vmm_kernel_space(), VMM_HHDM_BASE + pa, pa, PAGE_SIZE, VMM_GLOBAL)) return NULL;
+    }
+    return (const void *)(VMM_HHDM_BASE + phys);
+}
+
+static const acpi_sdt_header_t *map_table(uint64_t phys) {
+    const acpi_sdt_header_t *h = acpi_map(phys, sizeof(*h));
+    if (!h || !(h = acpi_map(phys, h->length))) return NULL;
+    return checksum_ok(h, h->length) ? h : NULL;
+}
+
+static const acpi_rsdp_t *scan_rsdp(uint64_t start, uint64_t end) {
+    for (uint64_t p = start; p + sizeof(acpi_rsdp_t) <= end; p += 16) {
+        const acpi_rsdp_t *r = (const acpi_rsdp_t *)p;
+        if (__builtin_memcmp(r->signature, "RSD PTR ", 8) == 0 && checksum_ok(r, 20)) return r;
+    }
+    return NULL;
+}
+
+int arch_x86_acpi_init(const void *rsdp) {
+    const acpi_rsdp_t *r = rsdp;
+    if (!r) {
+        uint64_t ebda = (uint64_t)*(const uint16_t *)0x40E << 4;
+        if (ebda) r = scan_rsdp(ebda, ebda + 1024);
+        if (!r) r = scan_rsdp(0xE0000, 0x100000);
+    }
+    if (!r || !checksum_ok(r, 20)) return -1;
+    if (r->revision >= 2 && r->xsdt && checksum_ok(r, r->length)) {
+        root = map_table(r->xsdt);
+        root_is_xsdt = root != NULL;
+    }
+    if (!root) root = map_table(r->rsdt);
+    if (!root) return -1;
+    LOG_INFO("acpi: revision %u, %s at 0x%lx", r->revision, root_is_xsdt ? "XSDT" : "RSDT",
+             (unsigned long)(root_is_xsdt ? r->xsdt : r->rsdt));
+    return 0;
+}
+
+const acpi_sdt_header_t *arch_x86_acpi_find(const char sig[4]) {
+    if (!root) return NULL;
+    size_t entry = root_is_xsdt ? 8 : 4;
+    size_t n = (root->length - sizeof(*root)) / entry;
+    const uint8_t *p = (const uint8_t *)(root + 1);
+    for (size_t i = 0; i < n; i++) {
+        uint64_t phys = 0;
+        __builtin_memcpy(&phys, p + i * entry, entry);
+        const acpi_sdt_header_t *h = map_table(phys);
+        if (h && __builtin_memcmp(h->signature, sig, 4) == 0) return h;
+    }
+    return NULL;
+}
+
+int arch_x86_acpi_parse_madt(acpi_madt_info_t *out) {
+    const acpi_sdt_header_t *madt = arch_x86_acpi_find("APIC");
+    if (!madt) return -1;
+    *out = (acpi_madt_info_t){0};
+    const uint8_t *p = (const uint8_t *)(madt + 1);
+    out->lapic_phys = *(const uint32_t *)p;
+    const uint8_t *end = (const uint8_t *)madt + madt->length;
+    for (p += 8; p + 2 <= end && p[1] >= 2; p += p[1]) {
+        switch (p[0]) {
+            case MADT_LAPIC: {
+                uint32_t flags = *(const uint32_t *)(p + 4);
+                /* Online Capable without Enabled is a hot-plug slot with no CPU in it yet. */
+                if ((flags & MADT_ENABLED) && out->ncpus < ACPI_MAX_CPUS)
+                    out->apic_ids[out->ncpus++] = p[3];
+            } break;
+            case MADT_IOAPIC:
+                if (out->nioapics++ == 0) {
+                    out->ioapic_phys = *(const uint32_t *)(p + 4);
+                    out->ioapic_gsi_base = *(const uint32_t *)(p + 8);
+                }
+                break;
+            case MADT_LAPIC_OVERRIDE:
+                out->lapic_phys = *(const uint64_t *)(p + 4);
+                break;
+            case MADT_X2APIC:
+                /* x2APIC ids above 255 cannot be reached in xAPIC mode. */
+                break;
+        }
+    }
+    return 0;
+}
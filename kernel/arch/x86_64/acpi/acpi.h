@@ -0,0 +1,41 @@
+#ifndef ORION_ARCH_X86_64_ACPI_ACPI_H
+#define ORION_ARCH_X86_64_ACPI_ACPI_H
+
+#include <stdint.h>
+
+/* Minimal ACPI table access: enough to find the MADT. */
+
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+/* Locate the RSDP (`rsdp` from the boot loader, or NULL to scan the EBDA
+ * and the BIOS area) and remember the RSDT/XSDT. Returns 0 on success. */
+int arch_x86_acpi_init(const void *rsdp);
+/* First table with this signature whose checksum is valid, or NULL. The
+ * table is mapped for as long as the kernel runs. */
+const acpi_sdt_header_t *arch_x86_acpi_find(const char sig[4]);
+
+/* What the MADT says about interrupt controllers and CPUs. */
+#define ACPI_MAX_CPUS 64
+typedef struct {
+    uint64_t lapic_phys;
+    unsigned ncpus;                     // enabled local APICs
+    uint8_t apic_ids[ACPI_MAX_CPUS];
+    unsigned nioapics;
+    uint64_t ioapic_phys;               // first I/O APIC
+    uint32_t ioapic_gsi_base;
+} acpi_madt_info_t;
+
+/* Returns 0, or -1 when there is no MADT. */
+int arch_x86_acpi_parse_madt(acpi_madt_info_t *out);
+
+#endif /* ORION_ARCH_X86_64_ACPI_ACPI_H */
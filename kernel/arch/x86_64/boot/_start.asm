@@ -47,6 +47,7 @@ section .text
 global _start
 _start:
     mov esp, stack + 4096 * 16
+    mov [multiboot_info_ptr], ebx    ; GRUB hands over the multiboot2 info in ebx
     call setup_page_tables
     call enable_paging
     lgdt [gdt64.pointer]
@@ -0,0 +1,134 @@
+#ifndef ORION_ARCH_X86_64_CPU_H
+#define ORION_ARCH_X86_64_CPU_H
+
+#include <stdint.h>
+
+/* Time-stamp counter. Not serializing; good enough for bracketing code paths
+ * of a few hundred cycles and up. */
+static inline uint64_t arch_x86_rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void arch_x86_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    __asm__ volatile ("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(subleaf));
+}
+
+static inline uint64_t arch_x86_rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void arch_x86_wrmsr(uint32_t msr, uint64_t v) {
+    __asm__ volatile ("wrmsr" :: "c"(msr), "a"((uint32_t)v), "d"((uint32_t)(v >> 32)));
+}
+
+static inline uint64_t arch_x86_read_cr0(void) {
+    uint64_t v;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(v));
+    return v;
+}
+
+static inline void arch_x86_write_cr0(uint64_t v) { __asm__ volatile ("mov %0, %%cr0" :: "r"(v) : "memory"); }
+
+/* Faulting address of the last #PF. */
+static inline uint64_t arch_x86_read_cr2(void) {
+    uint64_t v;
+    __asm__ volatile ("mov %%cr2, %0" : "=r"(v));
+    return v;
+}
+
+static inline uint64_t arch_x86_read_cr3(void) {
+    uint64_t v;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(v));
+    return v;
+}
+
+static inline void arch_x86_write_cr3(uint64_t v) { __asm__ volatile ("mov %0, %%cr3" :: "r"(v) : "memory"); }
+
+static inline uint64_t arch_x86_read_cr4(void) {
+    uint64_t v;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(v));
+    return v;
+}
+
+static inline void arch_x86_write_cr4(uint64_t v) { __asm__ volatile ("mov %0, %%cr4" :: "r"(v) : "memory"); }
+
+/* Drop the TLB entry (of any page size) covering va. */
+static inline void arch_x86_invlpg(uint64_t va) { __asm__ volatile ("invlpg (%0)" :: "r"(va) : "memory"); }
+
+/* Disable interrupts, returning the previous RFLAGS for arch_x86_irq_restore(). */
+static inline uint64_t arch_x86_irq_save(void) {
+    uint64_t flags;
+    __asm__ volatile ("pushfq; popq %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void arch_x86_irq_restore(uint64_t flags) {
+    if (flags & (1ULL << 9)) __asm__ volatile ("sti" ::: "memory");
+}
+
+static inline void arch_x86_irq_enable(void) { __asm__ volatile ("sti" ::: "memory"); }
+
+/* Enable interrupts and halt until the next one. The sti shadow keeps an
+ * interrupt from slipping in between the two, so no wakeup is lost. */
+static inline void arch_x86_idle_halt(void) { __asm__ volatile ("sti; hlt" ::: "memory"); }
+
+static inline void arch_x86_pause(void) { __asm__ volatile ("pause"); }
+
+/* INVPCID types: one address in one PCID, one whole PCID, everything
+ * including global entries, everything but global entries. */
+#define X86_INVPCID_ADDR       0
+#define X86_INVPCID_CONTEXT    1
+#define X86_INVPCID_ALL_GLOBAL 2
+#define X86_INVPCID_ALL        3
+
+static inline void arch_x86_invpcid(unsigned type, uint16_t pcid, uint64_t va) {
+    struct { uint64_t pcid, va; } desc = { pcid, va };
+    __asm__ volatile ("invpcid %0, %1" :: "m"(desc), "r"((uint64_t)type) : "memory");
+}
+
+#define X86_MSR_EFER    0xC0000080
+#define X86_EFER_NXE    (1ULL << 11)
+#define X86_CR0_MP      (1ULL << 1)
+#define X86_CR0_EM      (1ULL << 2)
+#define X86_CR0_TS      (1ULL << 3)
+#define X86_CR0_WP      (1ULL << 16)  // honour read-only pages in ring 0 too
+#define X86_CR4_PGE     (1ULL << 7)
+#define X86_CR4_OSFXSR  (1ULL << 9)
+#define X86_CR4_OSXMMEXCPT (1ULL << 10)
+#define X86_CR4_PCIDE   (1ULL << 17)
+#define X86_CR4_OSXSAVE (1ULL << 18)
+#define X86_CR3_NOFLUSH (1ULL << 63)   // with CR4.PCIDE: keep the new PCID's TLB entries
+
+/* Page-fault error code */
+#define X86_PF_PRESENT (1u << 0)   // protection violation, not a missing page
+#define X86_PF_WRITE   (1u << 1)
+#define X86_PF_USER    (1u << 2)
+#define X86_PF_RSVD    (1u << 3)
+#define X86_PF_FETCH   (1u << 4)
+
+/* CR0.TS: the next x87/SSE/AVX instruction raises #NM. */
+static inline void arch_x86_clts(void) { __asm__ volatile ("clts" ::: "memory"); }
+static inline void arch_x86_stts(void) { arch_x86_write_cr0(arch_x86_read_cr0() | X86_CR0_TS); }
+
+static inline void arch_x86_xsetbv(uint32_t reg, uint64_t v) {
+    __asm__ volatile ("xsetbv" :: "c"(reg), "a"((uint32_t)v), "d"((uint32_t)(v >> 32)));
+}
+
+/* Clear a 4 KiB page with non-temporal stores (movnti) so background
+ * zeroing does not evict the working set from the cache. The stores are
+ * weakly ordered: issue arch_x86_sfence() before handing the page out. */
+static inline void arch_x86_clear_page_nt(void *page) {
+    uint64_t *p = (uint64_t *)page;
+    for (int i = 0; i < 4096 / 8; i += 4)
+        __asm__ volatile ("movnti %1, (%0)\n\tmovnti %1, 8(%0)\n\tmovnti %1, 16(%0)\n\tmovnti %1, 24(%0)"
+                          :: "r"(p + i), "r"(0ULL) : "memory");
+}
+
+static inline void arch_x86_sfence(void) { __asm__ volatile ("sfence" ::: "memory"); }
+static inline void arch_x86_mfence(void) { __asm__ volatile ("mfence" ::: "memory"); }
+
+#endif /* ORION_ARCH_X86_64_CPU_H */
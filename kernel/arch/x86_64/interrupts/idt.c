@@ -0,0 +1,66 @@
+#include "arch/x86_64/interrupts/idt.h"
+#include "core/log.h"
+#include "core/percpu.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define KERNEL_CS 0x08          // gdt64.code in _start.asm
+#define GATE_INTERRUPT 0x8E     // present, DPL 0, 64-bit interrupt gate
+
+typedef struct {
+    uint16_t offset_lo;
+    uint16_t selector;
+    uint8_t ist;
+    uint8_t attr;
+    uint16_t offset_mid;
+    uint32_t offset_hi;
+    uint32_t reserved;
+} __attribute__((packed)) idt_gate_t;
+
+static idt_gate_t idt[256] __attribute__((aligned(16)));
+static arch_x86_handler_t handlers[256];
+
+/* Entry stubs from isr.asm, one per vector. */
+extern const uint64_t arch_x86_isr_table[256];
+
+static const char *const exception_names[32] = {
+    "#DE divide error", "#DB debug", "NMI", "#BP breakpoint", "#OF overflow", "#BR bound range",
+    "#UD invalid opcode", "#NM device not available", "#DF double fault", "coprocessor overrun",
+    "#TS invalid TSS", "#NP segment not present", "#SS stack fault", "#GP general protection",
+    "#PF page fault", "reserved", "#MF x87 error", "#AC alignment check", "#MC machine check",
+    "#XM SIMD error", "#VE virtualization", "#CP control protection",
+};
+
+/* Called from isr_common with interrupts disabled. */
+void arch_x86_interrupt_dispatch(arch_x86_regs_t *regs) {
+    arch_x86_handler_t fn = handlers[regs->vector & 0xFF];
+    percpu_add(irqs, 1);
+    if (fn) {
+        fn(regs);
+        return;
+    }
+    const char *name = regs->vector < 32 && exception_names[regs->vector] ? exception_names[regs->vector] : "interrupt";
+    PANIC("unhandled %s (vector %lu) err=0x%lx rip=0x%lx rsp=0x%lx", name, (unsigned long)regs->vector,
+          (unsigned long)regs->error, (unsigned long)regs->rip, (unsigned long)regs->rsp);
+}
+
+void arch_x86_set_handler(uint8_t vector, arch_x86_handler_t fn) { handlers[vector] = fn; }
+
+void arch_x86_idt_init(void) {
+    for (int i = 0; i < 256; i++) {
+        uint64_t off = arch_x86_isr_table[i];
+        idt[i] = (idt_gate_t){
+            .offset_lo = off & 0xFFFF,
+            .selector = KERNEL_CS,
+            .attr = GATE_INTERRUPT,
+            .offset_mid = (off >> 16) & 0xFFFF,
+            .offset_hi = off >> 32,
+        };
+    }
+    arch_x86_idt_load();
+}
+
+void arch_x86_idt_load(void) {
+    struct { uint16_t limit; uint64_t base; } __attribute__((packed)) idtr = { sizeof(idt) - 1, (uint64_t)idt };
+    __asm__ volatile ("lidt %0" :: "m"(idtr));
+}
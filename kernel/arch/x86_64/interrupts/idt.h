@@ -0,0 +1,27 @@
+#ifndef ORION_ARCH_X86_64_INTERRUPTS_IDT_H
+#define ORION_ARCH_X86_64_INTERRUPTS_IDT_H
+
+#include <stdint.h>
+
+/* Interrupt frame built by the stubs in isr.asm, lowest address first. */
+typedef struct arch_x86_regs {
+    uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+    uint64_t rbp, rdi, rsi, rdx, rcx, rbx, rax;
+    uint64_t vector, error;                 // error is 0 for vectors without one
+    uint64_t rip, cs, rflags, rsp, ss;      // pushed by the CPU
+} arch_x86_regs_t;
+
+typedef void (*arch_x86_handler_t)(arch_x86_regs_t *regs);
+
+#define X86_VEC_NM 7
+#define X86_VEC_PF 14
+
+/* Load an IDT with interrupt gates for all 256 vectors. A vector without a
+ * handler panics with the frame. */
+void arch_x86_idt_init(void);
+/* Load the (shared) IDT on the calling CPU; for APs. */
+void arch_x86_idt_load(void);
+/* Install (or with NULL, remove) the handler for a vector. */
+void arch_x86_set_handler(uint8_t vector, arch_x86_handler_t fn);
+
+#endif /* ORION_ARCH_X86_64_INTERRUPTS_IDT_H */
@@ -0,0 +1,68 @@
+; Interrupt entry stubs. Every vector gets a stub that pushes a zero error
+; code when the CPU does not push one, then the vector number, so that
+; isr_common always sees the same frame (arch_x86_regs_t in idt.h).
+bits 64
+
+extern arch_x86_interrupt_dispatch
+global arch_x86_isr_table
+
+section .text
+
+%assign i 0
+%rep 256
+isr_%+i:
+%if i != 8 && (i < 10 || i > 14) && i != 17 && i != 21 && i != 29 && i != 30
+    push 0
+%endif
+    push i
+    jmp isr_common
+%assign i i+1
+%endrep
+
+; The CPU aligns rsp to 16 bytes before pushing its 5-word frame; with the
+; 2 words above and the 15 registers below the stack stays aligned for C.
+isr_common:
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push rbp
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+    cld
+    mov rdi, rsp
+    call arch_x86_interrupt_dispatch
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rbp
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+    add rsp, 16             ; vector and error code
+    iretq
+
+section .rodata
+align 8
+arch_x86_isr_table:
+%assign i 0
+%rep 256
+    dq isr_%+i
+%assign i i+1
+%endrep
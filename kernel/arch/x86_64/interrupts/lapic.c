@@ -0,0 +1,160 @@
+#define LOG_CAT LOG_CAT_SMP
+#include "arch/x86_64/interrupts/lapic.h"
+#include "arch/x86_64/interrupts/idt.h"
+#include "arch/x86_64/mm/vmm.h"
+#include "arch/x86_64/cpu.h"
+#include "core/io.h"
+#include "core/log.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define MSR_APIC_BASE   0x1B
+#define MSR_TSC_DEADLINE 0x6E0
+#define APIC_BASE_EN    (1ULL << 11)
+#define APIC_BASE_ADDR  0xFFFFFF000ULL
+
+#define REG_ID          0x020
+#define REG_TPR         0x080
+#define REG_EOI         0x0B0
+#define REG_SVR         0x0F0
+#define REG_ICR_LO      0x300
+#define REG_ICR_HI      0x310
+#define REG_LVT_TIMER   0x320
+#define REG_TIMER_INIT  0x380
+#define REG_TIMER_CUR   0x390
+#define REG_TIMER_DIV   0x3E0
+
+#define SVR_ENABLE      (1u << 8)
+#define ICR_PENDING     (1u << 12)
+#define ICR_ASSERT      (1u << 14)
+#define ICR_INIT        (5u << 8)
+#define ICR_STARTUP     (6u << 8)
+#define LVT_MASKED      (1u << 16)
+#define LVT_TSC_DEADLINE (2u << 17)
+#define TIMER_DIV_16    0x3
+
+/* PIT channel 2, gated through port 0x61, is the calibration reference. */
+#define PIT_HZ          1193182
+#define PIT_CH2         0x42
+#define PIT_CMD         0x43
+#define PIT_GATE        0x61
+#define CAL_MS          10
+
+static volatile uint32_t *regs;
+static uint32_t timer_ticks_per_ms;     // at divide-by-16
+static int tsc_deadline;                // CPUID.1:ECX[24]
+uint64_t arch_x86_tsc_khz;
+
+static inline uint32_t rd(uint32_t reg) { return regs[reg / 4]; }
+static inline void wr(uint32_t reg, uint32_t v) { regs[reg / 4] = v; }
+
+static void spurious(arch_x86_regs_t *r) { (void)r; }    // no EOI for spurious interrupts
+
+static void enable_local(void) {
+    arch_x86_wrmsr(MSR_APIC_BASE, arch_x86_rdmsr(MSR_APIC_BASE) | APIC_BASE_EN);
+    wr(REG_TPR, 0);
+    wr(REG_SVR, SVR_ENABLE | X86_VEC_SPURIOUS);
+}
+
+/* Count TSC cycles, and APIC timer ticks once the APIC is mapped, over
+ * CAL_MS of PIT channel 2. */
+static void calibrate(void) {
+    uint16_t count = PIT_HZ / (1000 / CAL_MS);
+    uint8_t gate = inb(PIT_GATE) & ~0x02;       // speaker off
+    outb(PIT_GATE, gate & ~0x01);
+    outb(PIT_CMD, 0xB0);                        // channel 2, lo/hi, mode 0
+    outb(PIT_CH2, count & 0xFF);
+    outb(PIT_CH2, count >> 8);
+
+    if (regs) {
+        wr(REG_TIMER_DIV, TIMER_DIV_16);
+        wr(REG_LVT_TIMER, LVT_MASKED);
+    }
+    outb(PIT_GATE, gate | 0x01);                // start counting
+    if (regs) wr(REG_TIMER_INIT, 0xFFFFFFFF);
+    uint64_t t0 = arch_x86_rdtsc();
+    while (!(inb(PIT_GATE) & 0x20)) arch_x86_pause();
+    uint32_t elapsed = regs ? 0xFFFFFFFF - rd(REG_TIMER_CUR) : 0;
+    uint64_t cycles = arch_x86_rdtsc() - t0;
+    if (regs) wr(REG_TIMER_INIT, 0);
+    outb(PIT_GATE, gate & ~0x01);
+
+    timer_ticks_per_ms = elapsed / CAL_MS;
+    arch_x86_tsc_khz = cycles / CAL_MS;
+}
+
+int arch_x86_lapic_init(uint64_t phys) {
+    uint32_t a, b, c, d;
+    if (regs) return 0;
+    arch_x86_cpuid(1, 0, &a, &b, &c, &d);
+    if (!(d & (1u << 9))) return -1;
+    tsc_deadline = (c >> 24) & 1;
+    if (!phys) phys = arch_x86_rdmsr(MSR_APIC_BASE) & APIC_BASE_ADDR;
+    uint64_t va = VMM_HHDM_BASE + phys;
+    if (vmm_translate(vmm_kernel_space(), va) == VMM_NO_MAPPING &&
+        vmm_map(vmm_kernel_space(), va, phys, PAGE_SIZE, VMM_WRITE | VMM_NOCACHE | VMM_GLOBAL))
+        return -1;
+    regs = (volatile uint32_t *)va;
+    arch_x86_set_handler(X86_VEC_SPURIOUS, spurious);
+    enable_local();
+    calibrate();
+    LOG_INFO("lapic: id %u at 0x%lx, timer %u ticks/ms, tsc %lu kHz%s", arch_x86_lapic_id(), (unsigned long)phys,
+             timer_ticks_per_ms, (unsigned long)arch_x86_tsc_khz, tsc_deadline ? ", tsc-deadline" : "");
+    return 0;
+}
+
+void arch_x86_lapic_init_ap(void) { enable_local(); }
+
+uint32_t arch_x86_lapic_id(void) { return rd(REG_ID) >> 24; }
+
+void arch_x86_lapic_eoi(void) { wr(REG_EOI, 0); }
+
+static void send_icr(uint32_t apic_id, uint32_t lo) {
+    wr(REG_ICR_HI, apic_id << 24);
+    wr(REG_ICR_LO, lo);
+    while (rd(REG_ICR_LO) & ICR_PENDING) arch_x86_pause();
+}
+
+void arch_x86_lapic_send_ipi(uint32_t apic_id, uint8_t vector) { send_icr(apic_id, ICR_ASSERT | vector); }
+
+void arch_x86_lapic_send_init(uint32_t apic_id) { send_icr(apic_id, ICR_ASSERT | ICR_INIT); }
+
+void arch_x86_lapic_send_sipi(uint32_t apic_id, uint8_t page) { send_icr(apic_id, ICR_ASSERT | ICR_STARTUP | page); }
+
+void arch_x86_lapic_timer_init(uint8_t vector) {
+    wr(REG_TIMER_INIT, 0);
+    wr(REG_TIMER_DIV, TIMER_DIV_16);
+    wr(REG_LVT_TIMER, (tsc_deadline ? LVT_TSC_DEADLINE : 0) | vector);
+}
+
+int arch_x86_lapic_tsc_deadline(void) { return tsc_deadline; }
+
+/* The LVT write that selects TSC-deadline mode is an MMIO store, which
+ * WRMSR does not order against; the fence keeps the first deadline from
+ * landing in one-shot mode and getting lost. In one-shot mode the count is
+ * rounded up, so the interrupt never comes before the deadline. */
+void arch_x86_lapic_timer_arm(uint64_t tsc) {
+    if (tsc_deadline) {
+        arch_x86_mfence();
+        arch_x86_wrmsr(MSR_TSC_DEADLINE, tsc ? tsc : 1);
+        return;
+    }
+    uint64_t now = arch_x86_rdtsc(), delta = tsc > now ? tsc - now : 0;
+    if (delta > (1ULL << 40)) delta = 1ULL << 40;
+    uint64_t count = (delta * timer_ticks_per_ms + arch_x86_tsc_khz - 1) / arch_x86_tsc_khz;
+    wr(REG_TIMER_INIT, count == 0 ? 1 : count > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)count);
+}
+
+void arch_x86_lapic_timer_disarm(void) {
+    if (tsc_deadline) arch_x86_wrmsr(MSR_TSC_DEADLINE, 0);
+    else wr(REG_TIMER_INIT, 0);
+}
+
+void arch_x86_tsc_calibrate(void) {
+    if (!arch_x86_tsc_khz) calibrate();
+}
+
+void arch_x86_udelay(uint64_t us) {
+    uint64_t end = arch_x86_rdtsc() + us * arch_x86_tsc_khz / 1000;
+    while (arch_x86_rdtsc() < end) arch_x86_pause();
+}
@@ -0,0 +1,45 @@
+#ifndef ORION_ARCH_X86_64_INTERRUPTS_LAPIC_H
+#define ORION_ARCH_X86_64_INTERRUPTS_LAPIC_H
+
+#include <stdint.h>
+
+/* Local APIC in xAPIC (MMIO) mode. */
+#define X86_VEC_LAPIC_TIMER 0xEF
+#define X86_VEC_RESCHED     0xF0
+#define X86_VEC_SPURIOUS    0xFF
+
+/* Map the register page at `phys` (0: from IA32_APIC_BASE), enable the
+ * BSP's APIC and calibrate its timer and the TSC against PIT channel 2.
+ * Returns 0 (also when already done), or -1 when the CPU has no APIC. */
+int arch_x86_lapic_init(uint64_t phys);
+/* Enable the calling AP's APIC; arch_x86_lapic_init() must have run. */
+void arch_x86_lapic_init_ap(void);
+
+uint32_t arch_x86_lapic_id(void);
+void arch_x86_lapic_eoi(void);
+
+/* Fixed interrupt `vector` to the CPU with `apic_id`. */
+void arch_x86_lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+/* INIT and STARTUP IPIs for bringing up an AP; the AP starts in real mode
+ * at page `page` (physical address page << 12). */
+void arch_x86_lapic_send_init(uint32_t apic_id);
+void arch_x86_lapic_send_sipi(uint32_t apic_id, uint8_t page);
+
+/* One-shot timer of the calling CPU. arch_x86_lapic_timer_init() selects
+ * TSC-deadline mode when the CPU has it, else one-shot count-down, and
+ * leaves the timer stopped. arch_x86_lapic_timer_arm() asks for a single
+ * interrupt once the TSC reaches `tsc` (at once if it already has), and
+ * replaces any earlier request. */
+void arch_x86_lapic_timer_init(uint8_t vector);
+void arch_x86_lapic_timer_arm(uint64_t tsc);
+void arch_x86_lapic_timer_disarm(void);
+int arch_x86_lapic_tsc_deadline(void);
+
+/* TSC frequency found by the calibration, and a busy wait built on it.
+ * arch_x86_tsc_calibrate() measures the TSC alone, for machines without
+ * an APIC; it does nothing once the frequency is known. */
+extern uint64_t arch_x86_tsc_khz;
+void arch_x86_tsc_calibrate(void);
+void arch_x86_udelay(uint64_t us);
+
+#endif /* ORION_ARCH_X86_64_INTERRUPTS_LAPIC_H */
@@ -0,0 +1,42 @@
+#include "arch/x86_64/interrupts/pic.h"
+#include "core/io.h"
+#include <stdint.h>
+
+#define PIC1_CMD  0x20
+#define PIC1_DATA 0x21
+#define PIC2_CMD  0xA0
+#define PIC2_DATA 0xA1
+#define PIC_EOI   0x20
+#define ICW1_INIT 0x11      // edge triggered, cascade, ICW4 follows
+#define ICW4_8086 0x01
+
+/* Writes to an unused port to give the PIC time between init words. */
+static inline void io_wait(void) { outb(0x80, 0); }
+
+void arch_x86_pic_init(void) {
+    outb(PIC1_CMD, ICW1_INIT); io_wait();
+    outb(PIC2_CMD, ICW1_INIT); io_wait();
+    outb(PIC1_DATA, X86_VEC_IRQ0); io_wait();
+    outb(PIC2_DATA, X86_VEC_IRQ0 + 8); io_wait();
+    outb(PIC1_DATA, 1 << 2); io_wait();    // slave on IRQ2
+    outb(PIC2_DATA, 2); io_wait();
+    outb(PIC1_DATA, ICW4_8086); io_wait();
+    outb(PIC2_DATA, ICW4_8086); io_wait();
+    outb(PIC1_DATA, 0xFF & ~(1 << 2));      // everything masked but the cascade
+    outb(PIC2_DATA, 0xFF);
+}
+
+void arch_x86_pic_unmask(unsigned irq) {
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) & ~(1 << (irq & 7)));
+}
+
+void arch_x86_pic_mask(unsigned irq) {
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) | (1 << (irq & 7)));
+}
+
+void arch_x86_pic_eoi(unsigned irq) {
+    if (irq >= 8) outb(PIC2_CMD, PIC_EOI);
+    outb(PIC1_CMD, PIC_EOI);
+}
@@ -0,0 +1,16 @@
+#ifndef ORION_ARCH_X86_64_INTERRUPTS_PIC_H
+#define ORION_ARCH_X86_64_INTERRUPTS_PIC_H
+
+#include <stdint.h>
+
+/* Legacy 8259 pair. IRQ n arrives on vector X86_VEC_IRQ0 + n. */
+#define X86_VEC_IRQ0 32
+
+/* Remap both PICs above the exception vectors and mask every line. */
+void arch_x86_pic_init(void);
+void arch_x86_pic_unmask(unsigned irq);
+void arch_x86_pic_mask(unsigned irq);
+/* Acknowledge irq; call before the handler can switch away. */
+void arch_x86_pic_eoi(unsigned irq);
+
+#endif /* ORION_ARCH_X86_64_INTERRUPTS_PIC_H */
@@ -0,0 +1,70 @@
+#include "arch/x86_64/interrupts/timer.h"
+#include "arch/x86_64/interrupts/idt.h"
+#include "arch/x86_64/interrupts/pic.h"
+#include "arch/x86_64/interrupts/lapic.h"
+#include "core/io.h"
+#include <stdint.h>
+
+#define PIT_HZ       1193182
+#define PIT_CH0      0x40
+#define PIT_CMD      0x43
+#define PIT_MODE_RATE 0x34     // channel 0, lo/hi byte, mode 2 (rate generator)
+
+static void (*handler_fn)(void);
+static int pit_mode;
+
+static void pit_irq(arch_x86_regs_t *regs) {
+    (void)regs;
+    arch_x86_pic_eoi(0);
+    if (handler_fn) handler_fn();
+}
+
+static void lapic_timer_irq(arch_x86_regs_t *regs) {
+    (void)regs;
+    arch_x86_lapic_eoi();
+    if (handler_fn) handler_fn();
+}
+
+/* Fallback only: a periodic PIT tick on the BSP. */
+static void pit_start(void) {
+    uint32_t div = PIT_HZ / ARCH_X86_PIT_HZ;
+    arch_x86_tsc_calibrate();
+    arch_x86_pic_init();
+    arch_x86_set_handler(X86_VEC_IRQ0, pit_irq);
+    outb(PIT_CMD, PIT_MODE_RATE);
+    outb(PIT_CH0, div & 0xFF);
+    outb(PIT_CH0, div >> 8);
+    arch_x86_pic_unmask(0);
+}
+
+int arch_x86_timer_init(void (*handler)(void)) {
+    handler_fn = handler;
+    if (arch_x86_lapic_init(0) != 0) {
+        pit_mode = 1;
+        pit_start();
+        return 0;
+    }
+    /* Remapped off the exception vectors with every line masked; device
+     * drivers unmask their own. */
+    arch_x86_pic_init();
+    arch_x86_set_handler(X86_VEC_LAPIC_TIMER, lapic_timer_irq);
+    arch_x86_lapic_timer_init(X86_VEC_LAPIC_TIMER);
+    return 0;
+}
+
+void arch_x86_timer_init_ap(void) {
+    if (!pit_mode) arch_x86_lapic_timer_init(X86_VEC_LAPIC_TIMER);
+}
+
+void arch_x86_timer_arm(uint64_t tsc) {
+    if (!pit_mode) arch_x86_lapic_timer_arm(tsc);
+}
+
+void arch_x86_timer_disarm(void) {
+    if (!pit_mode) arch_x86_lapic_timer_disarm();
+}
+
+const char *arch_x86_timer_mode(void) {
+    if (pit_mode) return "pit periodic";
+    return arch_x86_lapic_tsc_deadline() ? "tsc-deadline" : "lapic one-shot";
+}
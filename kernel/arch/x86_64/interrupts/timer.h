@@ -0,0 +1,30 @@
+#ifndef ORION_ARCH_X86_64_INTERRUPTS_TIMER_H
+#define ORION_ARCH_X86_64_INTERRUPTS_TIMER_H
+
+#include <stdint.h>
+
+/* Per-CPU timer interrupt on TSC deadlines, from the local APIC timer
+ * (TSC-deadline mode when present, else one-shot). `handler` runs in
+ * interrupt context with interrupts disabled, after the EOI, so it may
+ * switch tasks.
+ *
+ * Without a local APIC, PIT channel 0 interrupts the BSP every
+ * 1/ARCH_X86_PIT_HZ s instead, arm and disarm do nothing, and the handler
+ * has to look for expired deadlines on every interrupt. */
+#define ARCH_X86_PIT_HZ 1000
+
+/* BSP: bring up the local APIC if smp has not yet, calibrate the TSC and
+ * install `handler`. Returns 0. */
+int arch_x86_timer_init(void (*handler)(void));
+/* The same timer on an AP. */
+void arch_x86_timer_init_ap(void);
+
+/* One interrupt on the calling CPU once the TSC reaches `tsc`; replaces
+ * the previous request. */
+void arch_x86_timer_arm(uint64_t tsc);
+void arch_x86_timer_disarm(void);
+
+/* "tsc-deadline", "lapic one-shot" or "pit periodic". */
+const char *arch_x86_timer_mode(void);
+
+#endif /* ORION_ARCH_X86_64_INTERRUPTS_TIMER_H */
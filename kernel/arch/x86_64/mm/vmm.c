@@ -0,0 +1,677 @@
+#define LOG_CAT LOG_CAT_VMM
+#include "arch/x86_64/mm/vmm.h"
+#include "arch/x86_64/cpu.h"
+#include "arch/x86_64/interrupts/idt.h"
+#include "core/log.h"
+#include "core/percpu.h"
+#include "core/slab.h"
+#include "lib/include/libc.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define PTE_P    (1ULL << 0)
+#define PTE_RW   (1ULL << 1)
+#define PTE_US   (1ULL << 2)
+#define PTE_PWT  (1ULL << 3)
+#define PTE_PCD  (1ULL << 4)
+#define PTE_A    (1ULL << 5)
+#define PTE_D    (1ULL << 6)
+#define PTE_PS   (1ULL << 7)
+#define PTE_G    (1ULL << 8)
+#define PTE_COW  (1ULL << 9)     // software bit: frame shared, copy it before any write
+#define PTE_COWW (1ULL << 10)    // software bit: a PTE_COW page that is writable once private
+#define PTE_NX   (1ULL << 63)
+#define PTE_ADDR 0x000FFFFFFFFFF000ULL
+
+/* Table levels: 3 = PML4, 2 = PDPT (1 GiB leaves), 1 = PD (2 MiB leaves),
+ * 0 = PT (4 KiB leaves). */
+static inline uint64_t level_size(int level) { return 1ULL << (12 + 9 * level); }
+static inline unsigned level_index(uint64_t va, int level) { return (va >> (12 + 9 * level)) & 511; }
+static inline int is_leaf(uint64_t e, int level) { return level == 0 || (e & PTE_PS); }
+
+enum { OP_UNMAP, OP_PROTECT };
+
+static vmm_space_t kernel_space;
+static int has_1g = 0;
+static int has_nx = 0;
+static int has_pcid = 0;
+static int has_invpcid = 0;
+static int hhdm_live = 0;           // tables are reached through the HHDM, not the boot identity map
+static size_t kernel_pages[3];      // leaves per level currently mapped in kernel_space
+
+/* PCIDs are handed out in order and never freed one by one. Once all of
+ * them are used the generation is bumped, and every space gets a fresh
+ * PCID (and a flush) at its next activation. PCID 0 is left to the boot
+ * page tables. */
+#define PCID_COUNT 4096
+static uint64_t pcid_gen = 1;
+static uint16_t pcid_next = 1;
+
+uint64_t vmm_demand_faults = 0;
+uint64_t vmm_cow_copies = 0;
+uint64_t vmm_cow_reuses = 0;
+
+static kmem_cache_t *region_cache;   // created on first use, after slab_init()
+
+static struct {
+    uint64_t cr3_loads, cr3_noflush;
+    uint64_t invlpg, full_flushes, deferred;
+    uint64_t pcid_rollovers;
+} tlb_stats;
+
+static inline uint64_t *table_at(uint64_t phys) { return (uint64_t *)phys_to_virt(phys); }
+
+/* Space loaded in this CPU's CR3. */
+static inline vmm_space_t *loaded_space(void) { return percpu_read(space); }
+static inline uint32_t this_cpu_bit(void) { return 1u << this_cpu(); }
+
+/* Zeroed frame for a page table. Until the HHDM is live, tables have to
+ * sit inside the boot identity map. */
+static uint64_t pt_alloc(void) {
+    void *p;
+    if (hhdm_live) return (uint64_t)pmm_alloc_zeroed();
+    if (!(p = pmm_alloc_contig(1, VMM_IDENTITY_SIZE, PAGE_SIZE))) return 0;
+    memset(phys_to_virt((uint64_t)p), 0, PAGE_SIZE);
+    return (uint64_t)p;
+}
+
+static int table_empty(const uint64_t *t) {
+    for (int i = 0; i < 512; i++) if (t[i]) return 0;
+    return 1;
+}
+
+static inline void count_leaves(vmm_space_t *as, int level, long delta) {
+    if (as == &kernel_space) kernel_pages[level] += delta;
+}
+
+/* Kernel mappings are global and shared by every address space; invlpg
+ * drops a global entry under every PCID. Other spaces are invalidated
+ * directly while loaded, by PCID otherwise. A space whose PCID belongs to
+ * an old generation is flushed when it is next loaded anyway. Other CPUs
+ * that may have used the space flush it at their next activation; one
+ * that has it loaded right now is not reached (no shootdown IPIs yet). */
+static void tlb_flush_page(vmm_space_t *as, uint64_t va) {
+    if (as != &kernel_space) as->tlb_stale |= ~this_cpu_bit();
+    if (as == &kernel_space || as == loaded_space()) {
+        arch_x86_invlpg(va);
+    } else if (!has_pcid || as->pcid_gen != pcid_gen) {
+        return;
+    } else if (has_invpcid) {
+        arch_x86_invpcid(X86_INVPCID_ADDR, as->pcid, va);
+    } else {
+        as->tlb_stale |= this_cpu_bit();
+        tlb_stats.deferred++;
+        return;
+    }
+    tlb_stats.invlpg++;
+}
+
+static void tlb_flush_space(vmm_space_t *as) {
+    if (as != &kernel_space) as->tlb_stale |= ~this_cpu_bit();
+    if (as == &kernel_space) {
+        if (has_invpcid) {
+            arch_x86_invpcid(X86_INVPCID_ALL_GLOBAL, 0, 0);
+        } else {
+            /* Toggling CR4.PGE drops every entry, global ones included, under all PCIDs. */
+            uint64_t cr4 = arch_x86_read_cr4();
+            arch_x86_write_cr4(cr4 & ~X86_CR4_PGE);
+            arch_x86_write_cr4(cr4);
+        }
+    } else if (as == loaded_space()) {
+        arch_x86_write_cr3(as->pml4 | (has_pcid ? as->pcid : 0));
+    } else if (!has_pcid || as->pcid_gen != pcid_gen) {
+        return;
+    } else if (has_invpcid) {
+        arch_x86_invpcid(X86_INVPCID_CONTEXT, as->pcid, 0);
+    } else {
+        as->tlb_stale |= this_cpu_bit();
+        tlb_stats.deferred++;
+        return;
+    }
+    tlb_stats.full_flushes++;
+}
+
+void vmm_tlb_batch_init(vmm_tlb_batch_t *b, vmm_space_t *as) {
+    b->as = as;
+    b->ops = b->nranges = b->nrelease = 0;
+}
+
+/* One leaf of 2^shift bytes at va. Once the ranges are exhausted the batch
+ * only remembers that the whole space has to go. */
+static void batch_leaf(vmm_tlb_batch_t *b, uint64_t va, unsigned shift) {
+    if (b->ops > VMM_TLB_FLUSH_THRESHOLD) return;
+    b->ops++;
+    if (b->nranges && b->range[b->nranges - 1].end == va && b->range[b->nranges - 1].shift == shift) {
+        b->range[b->nranges - 1].end += 1ULL << shift;
+    } else if (b->nranges < VMM_TLB_BATCH_RANGES) {
+        b->range[b->nranges].va = va;
+        b->range[b->nranges].end = va + (1ULL << shift);
+        b->range[b->nranges++].shift = shift;
+    } else {
+        b->ops = VMM_TLB_FLUSH_THRESHOLD + 1;
+    }
+}
+
+void vmm_tlb_batch_add(vmm_tlb_batch_t *b, uint64_t va, size_t len) {
+    for (uint64_t end = va + len; va < end && b->ops <= VMM_TLB_FLUSH_THRESHOLD; va += VMM_PAGE_4K)
+        batch_leaf(b, va, 12);
+}
+
+void vmm_tlb_batch_flush(vmm_tlb_batch_t *b) {
+    if (b->ops > VMM_TLB_FLUSH_THRESHOLD) {
+        tlb_flush_space(b->as);
+    } else {
+        for (size_t i = 0; i < b->nranges; i++)
+            for (uint64_t va = b->range[i].va; va < b->range[i].end; va += 1ULL << b->range[i].shift)
+                tlb_flush_page(b->as, va);
+    }
+    for (size_t i = 0; i < b->nrelease; i++) pmm_frame_unref((void *)b->release[i]);
+    b->ops = b->nranges = b->nrelease = 0;
+}
+
+/* Drop a reference to an unlinked frame (user page or page table) once no
+ * TLB entry can reach it any more. Page tables have a single owner, so
+ * they are freed. */
+static void batch_release(vmm_tlb_batch_t *b, uint64_t frame) {
+    if (b->nrelease == VMM_TLB_BATCH_RELEASE) vmm_tlb_batch_flush(b);
+    b->release[b->nrelease++] = frame;
+}
+
+static inline int is_user(vmm_space_t *as, uint64_t va) {
+    return as != &kernel_space && va >= VMM_USER_BASE && va < VMM_USER_END;
+}
+
+static uint64_t leaf_bits(uint32_t flags, int level) {
+    uint64_t e = PTE_P;
+    if (flags & VMM_WRITE) e |= PTE_RW;
+    if (flags & VMM_USER) e |= PTE_US;
+    if (flags & VMM_NOCACHE) e |= PTE_PCD | PTE_PWT;
+    if (flags & VMM_GLOBAL) e |= PTE_G;
+    if (!(flags & VMM_EXEC) && has_nx) e |= PTE_NX;
+    if (level > 0) e |= PTE_PS;
+    return e;
+}
+
+/* Entry for va at `level`, creating intermediate tables on the way.
+ * Returns NULL when a table cannot be allocated or a larger page already
+ * covers va. */
+static uint64_t *pt_walk_create(vmm_space_t *as, uint64_t va, int level, int user) {
+    uint64_t *table = table_at(as->pml4);
+    for (int l = 3; l > level; l--) {
+        uint64_t *e = &table[level_index(va, l)];
+        if (!(*e & PTE_P)) {
+            uint64_t t = pt_alloc();
+            if (!t) return NULL;
+            *e = t | PTE_P | PTE_RW | (user ? PTE_US : 0);
+        } else if (*e & PTE_PS) {
+            return NULL;
+        } else if (user) {
+            *e |= PTE_US;
+        }
+        table = table_at(*e & PTE_ADDR);
+    }
+    return &table[level_index(va, level)];
+}
+
+/* Replace the large page in *e (level 1 or 2) by a table of 512 pages of
+ * the next size down with the same attributes. The translations do not
+ * change, so the old TLB entry goes with the first page the caller
+ * invalidates. */
+static int pt_split(vmm_space_t *as, uint64_t *e, int level) {
+    uint64_t t = pt_alloc();
+    if (!t) return -1;
+    uint64_t old = *e;
+    uint64_t base = old & PTE_ADDR & ~(level_size(level) - 1);
+    uint64_t attrs = (old & ~PTE_ADDR & ~PTE_PS) | (level > 1 ? PTE_PS : 0);
+    uint64_t *child = table_at(t);
+    for (int i = 0; i < 512; i++) child[i] = (base + i * level_size(level - 1)) | attrs;
+    *e = t | PTE_P | PTE_RW | (old & PTE_US);
+    count_leaves(as, level, -1);
+    count_leaves(as, level - 1, 512);
+    return 0;
+}
+
+/* Unmap or re-protect [va, end) below `table`, recording the changed
+ * leaves in b. Large pages only partly inside the range are split first;
+ * tables emptied by an unmap are freed after the flush. */
+static int range_op(vmm_tlb_batch_t *b, uint64_t *table, int level, uint64_t va, uint64_t end, int op, uint32_t flags) {
+    vmm_space_t *as = b->as;
+    while (va < end) {
+        uint64_t size = level_size(level);
+        uint64_t next = (va | (size - 1)) + 1;
+        if (next > end || next == 0) next = end;
+        uint64_t *e = &table[level_index(va, level)];
+        if (*e & PTE_P) {
+            if (is_leaf(*e, level) && next - va < size && pt_split(as, e, level)) return -1;
+            if (is_leaf(*e, level)) {
+                uint64_t frame = *e & PTE_ADDR;
+                if (op == OP_UNMAP) {
+                    *e = 0;
+                    count_leaves(as, level, -1);
+                } else if ((*e & PTE_COW) || (is_user(as, va) && pmm_frame_owners((void *)frame) > 1)) {
+                    /* A shared page stays read-only until the write fault makes it private;
+                     * the flags only decide whether that fault may. */
+                    uint64_t cow = PTE_COW | (flags & VMM_WRITE ? PTE_COWW : 0);
+                    *e = frame | (*e & (PTE_A | PTE_D)) | leaf_bits(flags & ~VMM_WRITE, level) | cow;
+                } else {
+                    *e = frame | (*e & (PTE_A | PTE_D)) | leaf_bits(flags, level);
+                }
+                batch_leaf(b, va & ~(size - 1), 12 + 9 * level);
+                if (op == OP_UNMAP && is_user(as, va)) batch_release(b, frame);
+            } else {
+                uint64_t *child = table_at(*e & PTE_ADDR);
+                if (op == OP_PROTECT && (flags & VMM_USER)) *e |= PTE_US;
+                if (range_op(b, child, level - 1, va, next, op, flags)) return -1;
+                /* The kernel's PDPTs stay: every space shares them through its PML4. */
+                if (op == OP_UNMAP && table_empty(child) && !(as == &kernel_space && level == 3)) {
+                    uint64_t t = *e & PTE_ADDR;
+                    *e = 0;
+                    batch_leaf(b, va, 12);      // its invlpg also drops the paging-structure caches
+                    batch_release(b, t);
+                }
+            }
+        }
+        va = next;
+    }
+    return 0;
+}
+
+static int range_ok(uint64_t va, size_t len) {
+    return !((va | len) & (VMM_PAGE_4K - 1)) && va + len > va;
+}
+
+int vmm_map(vmm_space_t *as, uint64_t va, uint64_t pa, size_t len, uint32_t flags) {
+    if (len == 0) return 0;
+    if (!range_ok(va, len) || (pa & (VMM_PAGE_4K - 1))) return -1;
+    uint64_t start = va;
+    while (len) {
+        int level = 0;
+        if (is_user(as, va)) level = 0;
+        else if (has_1g && !((va | pa) & (VMM_PAGE_1G - 1)) && len >= VMM_PAGE_1G) level = 2;
+        else if (!((va | pa) & (VMM_PAGE_2M - 1)) && len >= VMM_PAGE_2M) level = 1;
+        uint64_t *e = pt_walk_create(as, va, level, flags & VMM_USER);
+        /* A table already hangs where the large page would go: use smaller pages. */
+        while (level > 0 && e && (*e & PTE_P) && !(*e & PTE_PS)) e = pt_walk_create(as, va, --level, flags & VMM_USER);
+        if (!e || (*e & PTE_P)) {
+            if (va > start) {
+                /* The caller keeps its references when the map fails. */
+                if (is_user(as, start))
+                    for (uint64_t v = start; v < va; v += VMM_PAGE_4K) pmm_frame_ref((void *)(pa - (va - v)));
+                vmm_unmap(as, start, va - start);
+            }
+            return -1;
+        }
+        *e = pa | leaf_bits(flags, level);
+        count_leaves(as, level, 1);
+        va += level_size(level);
+        pa += level_size(level);
+        len -= level_size(level);
+    }
+    return 0;
+}
+
+int vmm_unmap_batch(vmm_tlb_batch_t *b, uint64_t va, size_t len) {
+    if (len == 0) return 0;
+    if (!range_ok(va, len)) return -1;
+    return range_op(b, table_at(b->as->pml4), 3, va, va + len, OP_UNMAP, 0);
+}
+
+int vmm_unmap(vmm_space_t *as, uint64_t va, size_t len) {
+    vmm_tlb_batch_t b;
+    vmm_tlb_batch_init(&b, as);
+    int r = vmm_unmap_batch(&b, va, len);
+    vmm_tlb_batch_flush(&b);
+    return r;
+}
+
+int vmm_protect(vmm_space_t *as, uint64_t va, size_t len, uint32_t flags) {
+    if (len == 0) return 0;
+    if (!range_ok(va, len)) return -1;
+    vmm_tlb_batch_t b;
+    vmm_tlb_batch_init(&b, as);
+    int r = range_op(&b, table_at(as->pml4), 3, va, va + len, OP_PROTECT, flags);
+    vmm_tlb_batch_flush(&b);
+    return r;
+}
+
+uint64_t vmm_translate(vmm_space_t *as, uint64_t va) {
+    uint64_t *table = table_at(as->pml4);
+    for (int l = 3; l >= 0; l--) {
+        uint64_t e = table[level_index(va, l)];
+        if (!(e & PTE_P)) return VMM_NO_MAPPING;
+        if (is_leaf(e, l)) return (e & PTE_ADDR & ~(level_size(l) - 1)) + (va & (level_size(l) - 1));
+        table = table_at(e & PTE_ADDR);
+    }
+    return VMM_NO_MAPPING;
+}
+
+vmm_space_t *vmm_kernel_space(void) { return &kernel_space; }
+
+int vmm_space_create(vmm_space_t *as) {
+    uint64_t t = pt_alloc();
+    if (!t) return -1;
+    uint64_t *k = table_at(kernel_space.pml4), *n = table_at(t);
+    n[0] = k[0];
+    for (int i = 256; i < 512; i++) n[i] = k[i];
+    *as = (vmm_space_t){ .pml4 = t };
+    return 0;
+}
+
+/* Share the user entries of parent table `pt` with child table `ct`. Every
+ * leaf turns COW on both sides, so a later vmm_protect() cannot make the
+ * shared frame writable; writable ones also lose RW, recorded in b. */
+static int clone_level(vmm_tlb_batch_t *b, uint64_t *pt, uint64_t *ct, int level, uint64_t va) {
+    int first = level == 3 ? (int)level_index(VMM_USER_BASE, 3) : 0;
+    int last = level == 3 ? (int)level_index(VMM_USER_END - 1, 3) : 511;
+    for (int i = first; i <= last; i++) {
+        uint64_t e = pt[i];
+        uint64_t eva = va + (uint64_t)i * level_size(level);
+        if (!(e & PTE_P)) continue;
+        if (level == 0) {
+            if (e & PTE_RW) {
+                e = (e & ~PTE_RW) | PTE_COWW;
+                batch_leaf(b, eva, 12);
+            }
+            e |= PTE_COW;
+            pt[i] = e;
+            pmm_frame_ref((void *)(e & PTE_ADDR));
+            ct[i] = e;
+        } else {
+            if (e & PTE_PS) return -1;      // user mappings are 4 KiB only
+            uint64_t t = pt_alloc();
+            if (!t) return -1;
+            ct[i] = t | (e & ~PTE_ADDR);
+            if (clone_level(b, table_at(e & PTE_ADDR), table_at(t), level - 1, eva)) return -1;
+        }
+    }
+    return 0;
+}
+
+static vmm_region_t *region_new(uint64_t start, uint64_t end, uint32_t flags, vmm_region_t *next) {
+    if (!region_cache && !(region_cache = kmem_cache_create("vmm_region", sizeof(vmm_region_t), 8, NULL))) return NULL;
+    vmm_region_t *r = kmem_cache_alloc(region_cache);
+    if (r) *r = (vmm_region_t){ .start = start, .end = end, .flags = flags, .next = next };
+    return r;
+}
+
+int vmm_space_clone(vmm_space_t *child, vmm_space_t *parent) {
+    if (vmm_space_create(child)) return -1;
+    vmm_region_t **tail = &child->regions;
+    for (vmm_region_t *r = parent->regions; r; r = r->next, tail = &(*tail)->next) {
+        if (!(*tail = region_new(r->start, r->end, r->flags, NULL))) {
+            vmm_space_destroy(child);
+            return -1;
+        }
+    }
+    vmm_tlb_batch_t b;
+    vmm_tlb_batch_init(&b, parent);
+    int r = clone_level(&b, table_at(parent->pml4), table_at(child->pml4), 3, 0);
+    /* Even on failure some parent pages may have turned read-only already. */
+    vmm_tlb_batch_flush(&b);
+    if (r) vmm_space_destroy(child);
+    return r;
+}
+
+void vmm_space_destroy(vmm_space_t *as) {
+    if (as == &kernel_space || as == loaded_space()) PANIC("vmm_space_destroy: space 0x%lx is in use", (unsigned long)as->pml4);
+    vmm_unmap(as, VMM_USER_BASE, VMM_USER_END - VMM_USER_BASE);
+    pmm_free((void *)as->pml4);
+    as->pml4 = 0;
+    while (as->regions) {
+        vmm_region_t *r = as->regions;
+        as->regions = r->next;
+        kmem_cache_free(region_cache, r);
+    }
+}
+
+vmm_region_t *vmm_region_find(vmm_space_t *as, uint64_t va) {
+    for (vmm_region_t *r = as->regions; r && r->start <= va; r = r->next)
+        if (va < r->end) return r;
+    return NULL;
+}
+
+uint64_t vmm_region_anon(vmm_space_t *as, uint64_t va, size_t len, uint32_t flags) {
+    if (as == &kernel_space || len == 0 || (va | len) & (VMM_PAGE_4K - 1)) return 0;
+    vmm_region_t **link = &as->regions;
+    if (va == 0) {
+        /* First fit between the sorted regions. */
+        uint64_t gap = VMM_USER_BASE;
+        for (; *link && (*link)->start - gap < len; link = &(*link)->next) gap = (*link)->end;
+        va = gap;
+    } else {
+        while (*link && (*link)->end <= va) link = &(*link)->next;
+        if (*link && (*link)->start < va + len) return 0;
+    }
+    if (va < VMM_USER_BASE || va + len > VMM_USER_END || va + len < va) return 0;
+    vmm_region_t *r = region_new(va, va + len, flags | VMM_USER, *link);
+    if (!r) return 0;
+    *link = r;
+    return va;
+}
+
+int vmm_region_free(vmm_space_t *as, uint64_t va, size_t len) {
+    if (!range_ok(va, len)) return -1;
+    uint64_t end = va + len;
+    for (vmm_region_t **link = &as->regions; *link && (*link)->start < end;) {
+        vmm_region_t *r = *link;
+        if (r->end <= va) {
+            link = &r->next;
+        } else if (r->start >= va && r->end <= end) {
+            *link = r->next;
+            kmem_cache_free(region_cache, r);
+        } else if (r->start < va && r->end > end) {
+            vmm_region_t *tail = region_new(end, r->end, r->flags, r->next);
+            if (!tail) return -1;
+            r->end = va;
+            r->next = tail;
+            break;
+        } else {
+            if (r->start < va) r->end = va;
+            else r->start = end;
+            link = &r->next;
+        }
+    }
+    return vmm_unmap(as, va, len);
+}
+
+/* First touch of a page inside an anonymous region. */
+static int demand_fault(vmm_space_t *as, uint64_t va, uint32_t err) {
+    vmm_region_t *r = vmm_region_find(as, va);
+    if (!r || ((err & X86_PF_WRITE) && !(r->flags & VMM_WRITE)) || ((err & X86_PF_FETCH) && !(r->flags & VMM_EXEC))) return -1;
+    void *frame = pmm_alloc_zeroed();
+    if (!frame) return -1;
+    va &= ~(VMM_PAGE_4K - 1);
+    if (vmm_map(as, va, (uint64_t)frame, PAGE_SIZE, r->flags)) {
+        pmm_free(frame);
+        /* Someone else backed it first: just retry. */
+        return vmm_translate(as, va) == VMM_NO_MAPPING ? -1 : 0;
+    }
+    vmm_demand_faults++;
+    return 0;
+}
+
+int vmm_handle_fault(vmm_space_t *as, uint64_t va, uint32_t err) {
+    if (!is_user(as, va)) return -1;
+    if (!(err & X86_PF_PRESENT)) return demand_fault(as, va, err);
+    if (!(err & X86_PF_WRITE)) return -1;
+    uint64_t *table = table_at(as->pml4);
+    for (int l = 3; l > 0; l--) {
+        uint64_t e = table[level_index(va, l)];
+        if (!(e & PTE_P) || (e & PTE_PS)) return -1;
+        table = table_at(e & PTE_ADDR);
+    }
+    uint64_t *e = &table[level_index(va, 0)];
+    if ((*e & (PTE_COW | PTE_COWW)) != (PTE_COW | PTE_COWW)) return -1;
+    uint64_t frame = *e & PTE_ADDR;
+    if (pmm_frame_owners((void *)frame) == 1) {
+        /* Everyone else has written or gone away: no copy needed. */
+        *e = (*e & ~(PTE_COW | PTE_COWW)) | PTE_RW;
+        vmm_cow_reuses++;
+    } else {
+        void *copy = pmm_alloc();
+        if (!copy) return -1;
+        memcpy(phys_to_virt((uint64_t)copy), phys_to_virt(frame), PAGE_SIZE);
+        *e = (uint64_t)copy | (*e & ~(PTE_ADDR | PTE_COW | PTE_COWW)) | PTE_RW;
+        pmm_frame_unref((void *)frame);
+        vmm_cow_copies++;
+    }
+    tlb_flush_page(as, va & ~(VMM_PAGE_4K - 1));
+    return 0;
+}
+
+static void page_fault(arch_x86_regs_t *regs) {
+    uint64_t va = arch_x86_read_cr2();
+    if (loaded_space() && vmm_handle_fault(loaded_space(), va, (uint32_t)regs->error) == 0) return;
+    PANIC("page fault at 0x%lx err=0x%lx rip=0x%lx", (unsigned long)va, (unsigned long)regs->error, (unsigned long)regs->rip);
+}
+
+void vmm_activate(vmm_space_t *as) {
+    uint64_t cr3 = as->pml4;
+    if (has_pcid) {
+        if (as->pcid_gen != pcid_gen) {
+            if (pcid_next == PCID_COUNT) {
+                pcid_gen++;
+                pcid_next = 1;
+                tlb_stats.pcid_rollovers++;
+            }
+            /* A recycled PCID may still tag the previous owner's entries. */
+            as->pcid = pcid_next++;
+            as->pcid_gen = pcid_gen;
+            as->tlb_stale = ~0u;
+        }
+        cr3 |= as->pcid;
+        if (!(as->tlb_stale & this_cpu_bit())) {
+            cr3 |= X86_CR3_NOFLUSH;
+            tlb_stats.cr3_noflush++;
+        }
+        as->tlb_stale &= ~this_cpu_bit();
+    }
+    percpu_write(space, as);
+    tlb_stats.cr3_loads++;
+    arch_x86_write_cr3(cr3);
+}
+
+int vmm_init(const phys_mem_region_t *map, size_t entries) {
+    static const phys_mem_region_t fallback = { .addr = 0x100000, .len = VMM_IDENTITY_SIZE - 0x100000, .type = 1 };
+    uint32_t a, b, c, d;
+    arch_x86_cpuid(0x80000000, 0, &a, &b, &c, &d);
+    if (a >= 0x80000001) {
+        arch_x86_cpuid(0x80000001, 0, &a, &b, &c, &d);
+        has_1g = (d >> 26) & 1;
+        has_nx = (d >> 20) & 1;
+    }
+    arch_x86_cpuid(1, 0, &a, &b, &c, &d);
+    has_pcid = (c >> 17) & 1;
+    arch_x86_cpuid(0, 0, &a, &b, &c, &d);
+    if (a >= 7) {
+        arch_x86_cpuid(7, 0, &a, &b, &c, &d);
+        has_invpcid = has_pcid && ((b >> 10) & 1);
+    }
+    if (has_nx) arch_x86_wrmsr(X86_MSR_EFER, arch_x86_rdmsr(X86_MSR_EFER) | X86_EFER_NXE);
+    if (!map || entries == 0) { map = &fallback; entries = 1; }
+
+    hhdm_live = 0;
+    memset(kernel_pages, 0, sizeof(kernel_pages));
+    if (!(kernel_space.pml4 = pt_alloc())) return -1;
+    /* Every kernel mapping is global, so kernel flushes reach all PCIDs. */
+    arch_x86_write_cr0(arch_x86_read_cr0() | X86_CR0_WP);
+    if (vmm_map(&kernel_space, 0, 0, VMM_IDENTITY_SIZE, VMM_WRITE | VMM_EXEC | VMM_GLOBAL)) return -1;
+
+    /* HHDM: the low 1 MiB plus every usable region. The map is sorted, so
+     * a page shared by the rounded edges of two regions is mapped once. */
+    uint64_t mapped_end = 0x100000;
+    if (vmm_map(&kernel_space, VMM_HHDM_BASE, 0, mapped_end, VMM_WRITE | VMM_GLOBAL)) return -1;
+    for (size_t i = 0; i < entries; i++) {
+        if (map[i].type != 1) continue;
+        uint64_t s = map[i].addr & ~(uint64_t)(PAGE_SIZE - 1);
+        uint64_t e = (map[i].addr + map[i].len + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+        if (s < mapped_end) s = mapped_end;
+        if (s >= e) continue;
+        if (vmm_map(&kernel_space, VMM_HHDM_BASE + s, s, e - s, VMM_WRITE | VMM_GLOBAL)) return -1;
+        mapped_end = e;
+    }
+    /* Fill in the rest of the kernel half so later kernel mappings show up
+     * in every space that copied these PML4 entries. */
+    uint64_t *pml4 = table_at(kernel_space.pml4);
+    for (int i = 256; i < 512; i++) {
+        if (pml4[i] & PTE_P) continue;
+        uint64_t t = pt_alloc();
+        if (!t) return -1;
+        pml4[i] = t | PTE_P | PTE_RW;
+    }
+    arch_x86_set_handler(X86_VEC_PF, page_fault);
+
+    /* CR4.PCIDE may only be set while CR3 holds PCID 0, i.e. before the switch. */
+    arch_x86_write_cr4(arch_x86_read_cr4() | X86_CR4_PGE | (has_pcid ? X86_CR4_PCIDE : 0));
+    vmm_activate(&kernel_space);
+    hhdm_live = 1;
+    pmm_set_hhdm_offset(VMM_HHDM_BASE);
+    return 0;
+}
+
+void vmm_self_test(void) {
+    const uint64_t va = VMM_USER_BASE;
+    vmm_space_t parent, child;
+    vmm_space_t *prev = loaded_space();
+    if (vmm_space_create(&parent)) PANIC("vmm_self_test: out of memory");
+    if (vmm_region_anon(&parent, va, PAGE_SIZE, VMM_WRITE) != va) PANIC("vmm_self_test: vmm_region_anon failed");
+    vmm_activate(&parent);
+    volatile uint64_t *p = (volatile uint64_t *)va;
+    p[0] = 0x1111;
+    void *frame = (void *)vmm_translate(&parent, va);
+    if (vmm_space_clone(&child, &parent)) PANIC("vmm_self_test: clone failed");
+    if (pmm_frame_owners(frame) != 2) PANIC("vmm_self_test: frame not shared after clone");
+    uint64_t copies = vmm_cow_copies, reuses = vmm_cow_reuses;
+    p[0] = 0x2222;                                      // parent gets a private copy
+    if (vmm_cow_copies != copies + 1 || vmm_translate(&parent, va) == (uint64_t)frame)
+        PANIC("vmm_self_test: write to shared page not copied");
+    vmm_activate(&child);
+    if (p[0] != 0x1111) PANIC("vmm_self_test: child sees 0x%lx", (unsigned long)p[0]);
+    p[0] = 0x3333;                                      // child is the last owner now
+    if (vmm_cow_reuses != reuses + 1 || vmm_translate(&child, va) != (uint64_t)frame)
+        PANIC("vmm_self_test: last owner did not reuse the page");
+    vmm_activate(&parent);
+    if (p[0] != 0x2222) PANIC("vmm_self_test: parent sees 0x%lx", (unsigned long)p[0]);
+
+    /* Read-only and back to writable must not let a write reach a shared frame. */
+    vmm_space_destroy(&child);
+    if (vmm_space_clone(&child, &parent)) PANIC("vmm_self_test: clone failed");
+    frame = (void *)vmm_translate(&parent, va);
+    if (vmm_protect(&parent, va, PAGE_SIZE, VMM_USER) || vmm_protect(&parent, va, PAGE_SIZE, VMM_USER | VMM_WRITE))
+        PANIC("vmm_self_test: vmm_protect failed");
+    copies = vmm_cow_copies;
+    p[0] = 0x6666;
+    if (vmm_cow_copies != copies + 1 || vmm_translate(&parent, va) == (uint64_t)frame)
+        PANIC("vmm_self_test: write to re-protected shared page not copied");
+    vmm_activate(&child);
+    if (p[0] != 0x2222) PANIC("vmm_self_test: child sees 0x%lx", (unsigned long)p[0]);
+    vmm_activate(&parent);
+
+    /* 1 GiB of anonymous memory costs nothing until touched. */
+    uint64_t faults = vmm_demand_faults;
+    size_t free_before = pmm_get_free_memory();
+    volatile uint64_t *anon = (volatile uint64_t *)vmm_region_anon(&parent, 0, VMM_PAGE_1G, VMM_WRITE);
+    if (!anon) PANIC("vmm_self_test: vmm_region_anon failed");
+    if (anon[0] != 0) PANIC("vmm_self_test: anonymous page not zeroed");
+    anon[VMM_PAGE_2M / 8] = 0x4444;
+    anon[(VMM_PAGE_1G - 8) / 8] = 0x5555;
+    if (vmm_demand_faults != faults + 3) PANIC("vmm_self_test: expected 3 demand faults, got %lu", (unsigned long)(vmm_demand_faults - faults));
+    if (free_before - pmm_get_free_memory() > 16 * PAGE_SIZE) PANIC("vmm_self_test: sparse region pre-faulted");
+    vmm_activate(prev ? prev : &kernel_space);
+    if (vmm_region_free(&parent, (uint64_t)anon, VMM_PAGE_1G) || vmm_translate(&parent, (uint64_t)anon + VMM_PAGE_2M) != VMM_NO_MAPPING)
+        PANIC("vmm_self_test: vmm_region_free failed");
+    vmm_space_destroy(&child);
+    vmm_space_destroy(&parent);
+    LOG_INFO("vmm: self-test passed (cow fork, copy and reuse, demand paging)");
+}
+
+void vmm_print_stats(void) {
+    LOG_INFO("vmm: kernel pml4=0x%lx, pages 1G=%lu 2M=%lu 4K=%lu (pdpe1gb=%d nx=%d)", (unsigned long)kernel_space.pml4,
+             (unsigned long)kernel_pages[2], (unsigned long)kernel_pages[1], (unsigned long)kernel_pages[0], has_1g, has_nx);
+    LOG_INFO("vmm: tlb pcid=%d invpcid=%d, cr3 loads=%lu (noflush %lu), invlpg=%lu, full flushes=%lu, deferred=%lu, pcid rollovers=%lu",
+             has_pcid, has_invpcid, (unsigned long)tlb_stats.cr3_loads, (unsigned long)tlb_stats.cr3_noflush,
+             (unsigned long)tlb_stats.invlpg, (unsigned long)tlb_stats.full_flushes, (unsigned long)tlb_stats.deferred,
+             (unsigned long)tlb_stats.pcid_rollovers);
+    LOG_INFO("vmm: demand faults=%lu, cow copies=%lu reuses=%lu", (unsigned long)vmm_demand_faults,
+             (unsigned long)vmm_cow_copies, (unsigned long)vmm_cow_reuses);
+}
@@ -0,0 +1,161 @@
+#ifndef ORION_ARCH_X86_64_MM_VMM_H
+#define ORION_ARCH_X86_64_MM_VMM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "core/pmm.h"
+
+/* Virtual memory manager: 4-level page tables allocated from the PMM.
+ *
+ * vmm_map() picks the largest page size that the alignment of va, pa and
+ * the remaining length allow (1 GiB when the CPU has pdpe1gb, else 2 MiB,
+ * else 4 KiB). vmm_unmap() and vmm_protect() split a large page when the
+ * range covers only part of it. Page tables left empty by vmm_unmap() are
+ * returned to the PMM.
+ *
+ * TLB: when the CPU has PCIDs every address space is tagged with one, so
+ * vmm_activate() can switch CR3 without flushing. Invalidations are
+ * collected in a vmm_tlb_batch_t and issued as one run of invlpg, or as a
+ * single full flush once the run would exceed VMM_TLB_FLUSH_THRESHOLD.
+ * Changes to a space that is not loaded are invalidated by PCID with
+ * INVPCID, or deferred to its next activation when INVPCID is missing.
+ * Other CPUs flush a changed space when they next load it. There are no
+ * TLB shootdown IPIs yet: a space must not be changed while another CPU
+ * has it loaded, and kernel mappings are expected to be set up before
+ * the APs start.
+ *
+ * Layout of every address space:
+ *   0 .. VMM_IDENTITY_SIZE          identity map (kernel image, boot structures)
+ *   VMM_USER_BASE .. VMM_USER_END   user half, private to the space
+ *   VMM_HHDM_BASE + pa              higher-half direct map of all usable RAM
+ * The kernel parts (PML4 slot 0 and 256..511) are shared with the kernel
+ * space by copying its PML4 entries, which vmm_init() all creates up front.
+ *
+ * Frames mapped into the user half belong to the space: vmm_map() hands
+ * the caller's reference over, and unmapping drops it (pmm_frame_unref()).
+ * User mappings always use 4 KiB pages so they can be shared one by one.
+ */
+#define VMM_HHDM_BASE     0xFFFF800000000000ULL
+#define VMM_IDENTITY_SIZE 0x40000000ULL   // what _start.asm maps: 1 GiB
+#define VMM_USER_BASE     0x0000008000000000ULL   // PML4 slot 1
+#define VMM_USER_END      0x0000800000000000ULL
+
+#define VMM_PAGE_4K (1ULL << 12)
+#define VMM_PAGE_2M (1ULL << 21)
+#define VMM_PAGE_1G (1ULL << 30)
+
+/* Mapping flags. Pages are always readable; without VMM_EXEC they are
+ * mapped no-execute when the CPU supports NX. */
+#define VMM_WRITE   (1u << 0)
+#define VMM_USER    (1u << 1)
+#define VMM_EXEC    (1u << 2)
+#define VMM_NOCACHE (1u << 3)
+#define VMM_GLOBAL  (1u << 4)
+
+/* Anonymous memory region of a space's user half. */
+typedef struct vmm_region {
+    uint64_t start, end;        // page aligned, end exclusive
+    uint32_t flags;             // VMM_* used for the pages faulted in
+    struct vmm_region *next;
+} vmm_region_t;
+
+typedef struct vmm_space {
+    uint64_t pml4;      // physical address of the top-level table
+    vmm_region_t *regions;  // sorted by address, non-overlapping
+    uint64_t pcid_gen;  // pcid is only valid while this matches the allocator's generation
+    uint16_t pcid;
+    uint32_t tlb_stale; // CPUs (bit per CPU) that must flush it at their next activation
+} vmm_space_t;
+
+/* Build the kernel address space (identity map + HHDM of every usable
+ * region in `map`), switch CR3 to it and rebase the PMM onto the HHDM.
+ * Falls back to the first 1 GiB when the map is empty. Returns 0 on success. */
+int vmm_init(const phys_mem_region_t *map, size_t entries);
+
+vmm_space_t *vmm_kernel_space(void);
+/* Load `as` into CR3. With PCIDs the TLB entries of the space survive
+ * unless it was just given a (recycled) PCID or changed while away. */
+void vmm_activate(vmm_space_t *as);
+
+/* All three take page-aligned addresses and lengths and return 0, or -1 on
+ * bad arguments or when a page table cannot be allocated. vmm_map() also
+ * fails if any page in the range is already mapped; a failed map leaves
+ * nothing of the range mapped. Holes in the range are skipped by
+ * vmm_unmap() and vmm_protect(). */
+int vmm_map(vmm_space_t *as, uint64_t va, uint64_t pa, size_t len, uint32_t flags);
+int vmm_unmap(vmm_space_t *as, uint64_t va, size_t len);
+int vmm_protect(vmm_space_t *as, uint64_t va, size_t len, uint32_t flags);
+
+/* Batched TLB invalidation. Every leaf removed or changed is recorded as a
+ * range; adjacent leaves of the same size merge. vmm_tlb_batch_flush()
+ * issues one invlpg per recorded leaf, or flushes the whole space when
+ * that would take more than VMM_TLB_FLUSH_THRESHOLD invlpgs or the ranges
+ * did not fit. Page tables emptied by an unmap and user frames it drops
+ * are released only after the flush; kernel-space frames that were mapped
+ * in the range must not be reused before the flush either. */
+#define VMM_TLB_FLUSH_THRESHOLD 32
+#define VMM_TLB_BATCH_RANGES    8
+#define VMM_TLB_BATCH_RELEASE   16
+
+typedef struct vmm_tlb_batch {
+    vmm_space_t *as;
+    size_t ops;         // invlpgs the recorded ranges need
+    size_t nranges;
+    size_t nrelease;
+    struct { uint64_t va, end; unsigned shift; } range[VMM_TLB_BATCH_RANGES];
+    uint64_t release[VMM_TLB_BATCH_RELEASE];    // frames to unref after the flush
+} vmm_tlb_batch_t;
+
+void vmm_tlb_batch_init(vmm_tlb_batch_t *b, vmm_space_t *as);
+/* Record [va, va + len) as 4 KiB pages to invalidate. */
+void vmm_tlb_batch_add(vmm_tlb_batch_t *b, uint64_t va, size_t len);
+void vmm_tlb_batch_flush(vmm_tlb_batch_t *b);
+/* vmm_unmap() that leaves the invalidation in `b`, so several unmaps can
+ * share one flush. */
+int vmm_unmap_batch(vmm_tlb_batch_t *b, uint64_t va, size_t len);
+
+/* Address spaces for processes. vmm_space_create() makes an empty user
+ * half. vmm_space_clone() shares every user page of `parent` with a new
+ * space copy-on-write: writable pages become read-only in both, and each
+ * frame gains an owner. The cost is the size of the parent's user page
+ * tables, not of its resident memory. vmm_space_destroy() drops the
+ * space's frames and tables; it must not be loaded. Both constructors
+ * return 0, or -1 when out of memory (leaving nothing allocated). */
+int vmm_space_create(vmm_space_t *as);
+int vmm_space_clone(vmm_space_t *child, vmm_space_t *parent);
+void vmm_space_destroy(vmm_space_t *as);
+
+/* Demand-paged anonymous memory. vmm_region_anon() reserves [va, va + len)
+ * of the user half (va 0: the lowest gap that fits) without mapping
+ * anything; each page gets a zeroed frame on its first touch. Returns the
+ * start, or 0 if the range is taken, outside the user half or out of
+ * memory. vmm_region_free() unmaps and forgets any part of the regions,
+ * splitting them as needed. Regions are inherited by vmm_space_clone(). */
+uint64_t vmm_region_anon(vmm_space_t *as, uint64_t va, size_t len, uint32_t flags);
+int vmm_region_free(vmm_space_t *as, uint64_t va, size_t len);
+vmm_region_t *vmm_region_find(vmm_space_t *as, uint64_t va);
+
+/* Resolve a page fault at va in `as` (err is the #PF error code):
+ *  - a missing page inside an anonymous region that allows the access is
+ *    backed by a zeroed frame;
+ *  - a write to a copy-on-write page gives the faulting space its own copy,
+ *    or the page itself when it is the last owner.
+ * Returns 0 when the access can be retried, -1 for a genuine fault.
+ * vmm_init() routes #PF here for the loaded space. */
+int vmm_handle_fault(vmm_space_t *as, uint64_t va, uint32_t err);
+extern uint64_t vmm_demand_faults;  // anonymous pages backed on first touch
+extern uint64_t vmm_cow_copies;     // private copies made
+extern uint64_t vmm_cow_reuses;     // last owner took the page back
+
+/* Fork a space, write through both sides and check they diverged, then
+ * touch a sparse anonymous region; panics on error. */
+void vmm_self_test(void);
+
+/* Physical address va maps to, or VMM_NO_MAPPING. */
+#define VMM_NO_MAPPING ((uint64_t)-1)
+uint64_t vmm_translate(vmm_space_t *as, uint64_t va);
+
+/* Log the page counts per size installed by vmm_init() and TLB counters. */
+void vmm_print_stats(void);
+
+#endif /* ORION_ARCH_X86_64_MM_VMM_H */
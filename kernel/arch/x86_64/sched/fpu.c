@@ -0,0 +1,95 @@
+#include "arch/x86_64/sched/fpu.h"
+#include "arch/x86_64/cpu.h"
+#include "arch/x86_64/interrupts/idt.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define CPUID_1_ECX_XSAVE   (1u << 26)
+#define CPUID_1_ECX_AVX     (1u << 28)
+#define CPUID_D1_EAX_XSAVEOPT (1u << 0)
+
+#define XCR0_X87 (1ULL << 0)
+#define XCR0_SSE (1ULL << 1)
+#define XCR0_AVX (1ULL << 2)
+
+#define FXSAVE_SIZE 512
+#define FCW_DEFAULT   0x037F    // all x87 exceptions masked, 64-bit precision
+#define MXCSR_DEFAULT 0x1F80    // all SSE exceptions masked, round to nearest
+
+enum { MODE_FXSAVE, MODE_XSAVE, MODE_XSAVEOPT };
+static int mode;
+static uint64_t xcr0;
+static void (*trap_fn)(void);
+
+static void nm_handler(arch_x86_regs_t *regs) {
+    (void)regs;
+    arch_x86_clts();
+    trap_fn();
+}
+
+size_t arch_x86_fpu_init(void (*on_trap)(void)) {
+    uint32_t a, b, c, d;
+    size_t size = FXSAVE_SIZE;
+
+    arch_x86_write_cr0((arch_x86_read_cr0() & ~X86_CR0_EM) | X86_CR0_MP);
+    uint64_t cr4 = arch_x86_read_cr4() | X86_CR4_OSFXSR | X86_CR4_OSXMMEXCPT;
+
+    arch_x86_cpuid(1, 0, &a, &b, &c, &d);
+    if (c & CPUID_1_ECX_XSAVE) {
+        uint32_t ecx1 = c;
+        arch_x86_write_cr4(cr4 | X86_CR4_OSXSAVE);
+        arch_x86_cpuid(0xD, 0, &a, &b, &c, &d);
+        xcr0 = XCR0_X87 | XCR0_SSE;
+        if ((ecx1 & CPUID_1_ECX_AVX) && (a & XCR0_AVX)) xcr0 |= XCR0_AVX;
+        arch_x86_xsetbv(0, xcr0);
+        /* EBX now reports the area size for the components enabled in XCR0. */
+        arch_x86_cpuid(0xD, 0, &a, &b, &c, &d);
+        size = b;
+        arch_x86_cpuid(0xD, 1, &a, &b, &c, &d);
+        mode = (a & CPUID_D1_EAX_XSAVEOPT) ? MODE_XSAVEOPT : MODE_XSAVE;
+    } else {
+        arch_x86_write_cr4(cr4);
+        mode = MODE_FXSAVE;
+    }
+
+    __asm__ volatile ("fninit");
+    trap_fn = on_trap;
+    arch_x86_set_handler(X86_VEC_NM, nm_handler);
+    arch_x86_stts();
+    return size;
+}
+
+void arch_x86_fpu_init_ap(void) {
+    if (mode != MODE_FXSAVE) arch_x86_xsetbv(0, xcr0);
+    arch_x86_clts();
+    __asm__ volatile ("fninit");
+    arch_x86_stts();
+}
+
+void arch_x86_fpu_init_area(void *area) {
+    uint8_t *p = area;
+    for (size_t i = 0; i < FXSAVE_SIZE + 64; i++) p[i] = 0;    // legacy area + XSAVE header
+    *(uint16_t *)(p + 0) = FCW_DEFAULT;
+    *(uint32_t *)(p + 24) = MXCSR_DEFAULT;
+}
+
+void arch_x86_fpu_save(void *area) {
+    uint32_t lo = (uint32_t)xcr0, hi = (uint32_t)(xcr0 >> 32);
+    switch (mode) {
+        case MODE_XSAVEOPT: __asm__ volatile ("xsaveopt64 (%0)" :: "r"(area), "a"(lo), "d"(hi) : "memory"); break;
+        case MODE_XSAVE:    __asm__ volatile ("xsave64 (%0)" :: "r"(area), "a"(lo), "d"(hi) : "memory"); break;
+        default:            __asm__ volatile ("fxsave64 (%0)" :: "r"(area) : "memory"); break;
+    }
+}
+
+void arch_x86_fpu_restore(const void *area) {
+    uint32_t lo = (uint32_t)xcr0, hi = (uint32_t)(xcr0 >> 32);
+    if (mode == MODE_FXSAVE) __asm__ volatile ("fxrstor64 (%0)" :: "r"(area) : "memory");
+    else __asm__ volatile ("xrstor64 (%0)" :: "r"(area), "a"(lo), "d"(hi) : "memory");
+}
+
+int arch_x86_fpu_avx(void) { return (xcr0 & XCR0_AVX) != 0; }
+
+const char *arch_x86_fpu_mode(void) {
+    return mode == MODE_XSAVEOPT ? "xsaveopt" : mode == MODE_XSAVE ? "xsave" : "fxsave";
+}
@@ -0,0 +1,33 @@
+#ifndef ORION_ARCH_X86_64_SCHED_FPU_H
+#define ORION_ARCH_X86_64_SCHED_FPU_H
+
+#include <stddef.h>
+
+/* x87/SSE/AVX register state, switched lazily.
+ *
+ * arch_x86_fpu_init() enables the FPU and SSE (and AVX through XCR0 when
+ * the CPU has XSAVE) and leaves CR0.TS set, so the first FPU instruction
+ * raises #NM, which clears TS and calls `on_trap`. The scheduler sets TS on
+ * a switch to any task other than the one whose state is in the registers,
+ * and saves/restores in `on_trap`; tasks that never touch the FPU never pay
+ * for it.
+ *
+ * Save areas are arch_x86_fpu_init()'s return value in bytes and must be
+ * ARCH_X86_FPU_ALIGN aligned. XSAVEOPT is used when present, so a save
+ * skips components still in their initial state or unchanged since the
+ * area was last restored; then XSAVE, then FXSAVE on CPUs without XSAVE. */
+#define ARCH_X86_FPU_ALIGN 64
+
+size_t arch_x86_fpu_init(void (*on_trap)(void));
+/* Same setup on an AP, which already has the BSP's CR0 and CR4. */
+void arch_x86_fpu_init_ap(void);
+/* Fill an area with the initial state (FPU control word and MXCSR reset). */
+void arch_x86_fpu_init_area(void *area);
+void arch_x86_fpu_save(void *area);
+void arch_x86_fpu_restore(const void *area);
+/* AVX state is enabled in XCR0, so AVX instructions may be used. */
+int arch_x86_fpu_avx(void);
+/* "xsaveopt", "xsave" or "fxsave". */
+const char *arch_x86_fpu_mode(void);
+
+#endif /* ORION_ARCH_X86_64_SCHED_FPU_H */
@@ -0,0 +1,27 @@
+; Kernel thread switch. Only the callee-saved registers need to survive: the
+; caller of arch_x86_switch() has already spilled everything else, and a
+; preempted thread's full state sits in its interrupt frame further up the
+; same stack.
+bits 64
+
+global arch_x86_switch
+
+section .text
+
+; void arch_x86_switch(uint64_t *save_rsp, uint64_t next_rsp)
+arch_x86_switch:
+    push rbp
+    push rbx
+    push r12
+    push r13
+    push r14
+    push r15
+    mov [rdi], rsp
+    mov rsp, rsi
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    pop rbp
+    ret
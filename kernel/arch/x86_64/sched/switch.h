@@ -0,0 +1,11 @@
+#ifndef ORION_ARCH_X86_64_SCHED_SWITCH_H
+#define ORION_ARCH_X86_64_SCHED_SWITCH_H
+
+#include <stdint.h>
+
+/* Save the callee-saved registers on the current stack, store its rsp in
+ * *save_rsp, then resume the thread whose stack pointer is next_rsp
+ * (switch.asm). Returns when something switches back to *save_rsp. */
+void arch_x86_switch(uint64_t *save_rsp, uint64_t next_rsp);
+
+#endif /* ORION_ARCH_X86_64_SCHED_SWITCH_H */
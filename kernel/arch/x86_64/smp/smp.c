@@ -0,0 +1,141 @@
+#define LOG_CAT LOG_CAT_SMP
+#include "arch/x86_64/smp/smp.h"
+#include "arch/x86_64/acpi/acpi.h"
+#include "arch/x86_64/interrupts/idt.h"
+#include "arch/x86_64/interrupts/lapic.h"
+#include "arch/x86_64/sched/fpu.h"
+#include "arch/x86_64/mm/vmm.h"
+#include "arch/x86_64/cpu.h"
+#include "core/pmm.h"
+#include "core/log.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define MSR_GS_BASE     0xC0000101
+#define MSR_KERNEL_GS   0xC0000102
+#define TRAMPOLINE_BASE 0x8000          // must match trampoline.asm
+#define AP_STACK_ORDER  2               // 16 KiB boot stack per AP
+#define AP_START_TIMEOUT_US 100000
+
+_Static_assert(PMM_MAX_CPUS >= PERCPU_MAX_CPUS, "PMM caches must cover every CPU");
+
+/* Filled in before each STARTUP IPI; see tr_data in trampoline.asm. */
+typedef struct {
+    uint64_t cr3, cr4, cr0, efer;
+    uint64_t stack;
+    uint64_t entry;
+    uint64_t arg;
+} trampoline_data_t;
+
+extern const char arch_x86_trampoline_start[], arch_x86_trampoline_end[], arch_x86_trampoline_data[];
+extern char _kernel_start[], _kernel_end[];
+
+percpu_t arch_x86_percpu[PERCPU_MAX_CPUS];
+static unsigned ncpus = 1;
+static void (*ap_main_fn)(void);
+
+static void percpu_load(percpu_t *p) {
+    arch_x86_wrmsr(MSR_GS_BASE, (uint64_t)p);
+    arch_x86_wrmsr(MSR_KERNEL_GS, 0);
+}
+
+void arch_x86_percpu_init_bsp(void) {
+    percpu_t *p = &arch_x86_percpu[0];
+    p->self = p;
+    p->cpu = 0;
+    p->online = 1;
+    percpu_load(p);
+}
+
+/* First C code on an AP, on its boot stack, interrupts off. */
+static void ap_entry(percpu_t *p) {
+    percpu_load(p);
+    arch_x86_idt_load();
+    arch_x86_lapic_init_ap();
+    arch_x86_fpu_init_ap();
+    p->apic_id = arch_x86_lapic_id();
+    __atomic_store_n(&p->online, 1, __ATOMIC_RELEASE);
+    ap_main_fn();
+    PANIC("smp: ap_main returned on cpu%u", p->cpu);
+}
+
+static int start_ap(unsigned cpu, uint32_t apic_id) {
+    void *stack = pmm_alloc_order(AP_STACK_ORDER);
+    if (!stack) return -1;
+    percpu_t *p = &arch_x86_percpu[cpu];
+    *p = (percpu_t){ .self = p, .cpu = cpu, .apic_id = apic_id };
+
+    trampoline_data_t *d = (trampoline_data_t *)(TRAMPOLINE_BASE + (arch_x86_trampoline_data - arch_x86_trampoline_start));
+    *d = (trampoline_data_t){
+        .cr3 = vmm_kernel_space()->pml4,
+        .cr4 = arch_x86_read_cr4(),
+        .cr0 = arch_x86_read_cr0(),
+        .efer = arch_x86_rdmsr(X86_MSR_EFER),
+        .stack = (uint64_t)phys_to_virt((uint64_t)stack) + (PAGE_SIZE << AP_STACK_ORDER),
+        .entry = (uint64_t)ap_entry,
+        .arg = (uint64_t)p,
+    };
+
+    /* INIT, then up to two STARTUP IPIs as the MP spec asks. */
+    arch_x86_lapic_send_init(apic_id);
+    arch_x86_udelay(10000);
+    for (int i = 0; i < 2 && !__atomic_load_n(&p->online, __ATOMIC_ACQUIRE); i++) {
+        arch_x86_lapic_send_sipi(apic_id, TRAMPOLINE_BASE >> 12);
+        arch_x86_udelay(200);
+    }
+    for (uint64_t waited = 0; !__atomic_load_n(&p->online, __ATOMIC_ACQUIRE); waited += 100) {
+        if (waited >= AP_START_TIMEOUT_US) {
+            /* A slow AP could still wake up and run on this slot and the
+             * trampoline data, which the next AP reuses. INIT parks it in
+             * wait-for-SIPI first. Its 16 KiB stack is leaked, not freed. */
+            arch_x86_lapic_send_init(apic_id);
+            arch_x86_udelay(10000);
+            return -1;
+        }
+        arch_x86_udelay(100);
+    }
+    return 0;
+}
+
+unsigned arch_x86_smp_init(const void *rsdp, void (*ap_main)(void)) {
+    acpi_madt_info_t madt;
+    if (arch_x86_acpi_init(rsdp) != 0 || arch_x86_acpi_parse_madt(&madt) != 0) {
+        LOG_WARN("smp: no ACPI MADT, running on the BSP only");
+        return ncpus;
+    }
+    if (arch_x86_lapic_init(madt.lapic_phys) != 0) {
+        LOG_WARN("smp: no local APIC, running on the BSP only");
+        return ncpus;
+    }
+    uint32_t bsp = arch_x86_lapic_id();
+    arch_x86_percpu[0].apic_id = bsp;
+    if (vmm_kernel_space()->pml4 >= (1ULL << 32)) PANIC("smp: kernel PML4 above 4 GiB, APs cannot load it");
+
+    size_t len = arch_x86_trampoline_end - arch_x86_trampoline_start;
+    if (len > 4096) PANIC("smp: trampoline is %lu bytes, more than a page", (unsigned long)len);
+    if (TRAMPOLINE_BASE < (uintptr_t)_kernel_end && TRAMPOLINE_BASE + 4096 > (uintptr_t)_kernel_start)
+        PANIC("smp: trampoline page %#x overlaps the kernel image", TRAMPOLINE_BASE);
+    __builtin_memcpy((void *)TRAMPOLINE_BASE, arch_x86_trampoline_start, len);
+    ap_main_fn = ap_main;
+
+    for (unsigned i = 0; i < madt.ncpus; i++) {
+        if (madt.apic_ids[i] == bsp) continue;
+        if (ncpus == PERCPU_MAX_CPUS) {
+            LOG_WARN("smp: only %u of %u CPUs supported", PERCPU_MAX_CPUS, madt.ncpus);
+            break;
+        }
+        if (start_ap(ncpus, madt.apic_ids[i]) != 0) {
+            LOG_WARN("smp: APIC id %u did not start", madt.apic_ids[i]);
+            continue;
+        }
+        ncpus++;
+    }
+    LOG_INFO("smp: %u of %u CPUs online (BSP APIC id %u)", ncpus, madt.ncpus, bsp);
+    return ncpus;
+}
+
+unsigned arch_x86_smp_cpus(void) { return ncpus; }
+
+void arch_x86_smp_send_ipi(unsigned cpu, uint8_t vector) {
+    arch_x86_lapic_send_ipi(arch_x86_percpu[cpu].apic_id, vector);
+}
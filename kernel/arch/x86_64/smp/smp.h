@@ -0,0 +1,26 @@
+#ifndef ORION_ARCH_X86_64_SMP_SMP_H
+#define ORION_ARCH_X86_64_SMP_SMP_H
+
+#include <stdint.h>
+#include "core/percpu.h"
+
+/* Per-CPU blocks, indexed by CPU number; see core/percpu.h. */
+extern percpu_t arch_x86_percpu[PERCPU_MAX_CPUS];
+
+/* Point GS at CPU 0's block. Must run before anything touches per-CPU
+ * data (the PMM caches, the preemption counter), i.e. first in kmain(). */
+void arch_x86_percpu_init_bsp(void);
+
+/* Find the CPUs in the ACPI MADT and start every AP with INIT-SIPI-SIPI.
+ * Each AP comes up on the kernel's page tables with the BSP's control
+ * registers, its own GS block, the shared IDT, its local APIC and FPU
+ * enabled, and runs ap_main() with interrupts disabled; ap_main() must not
+ * return. APs are started one at a time. Returns the CPUs online,
+ * including the BSP (1 when there is no MADT or no APIC). */
+unsigned arch_x86_smp_init(const void *rsdp, void (*ap_main)(void));
+unsigned arch_x86_smp_cpus(void);
+
+/* Send a fixed IPI to CPU `cpu`. */
+void arch_x86_smp_send_ipi(unsigned cpu, uint8_t vector);
+
+#endif /* ORION_ARCH_X86_64_SMP_SMP_H */
@@ -0,0 +1,94 @@
+; AP startup trampoline. smp.c copies everything between
+; arch_x86_trampoline_start and arch_x86_trampoline_end to TRAMPOLINE_BASE
+; and fills in tr_data before each STARTUP IPI. The AP arrives in real mode
+; at TRAMPOLINE_BASE, switches to protected mode, enables paging on the
+; kernel's own tables (which identity-map this page) to enter long mode,
+; then takes the BSP's CR4/CR0 and calls tr_data.entry(tr_data.arg) on
+; tr_data.stack.
+TRAMPOLINE_BASE equ 0x8000
+%define TR(x) ((x) - arch_x86_trampoline_start + TRAMPOLINE_BASE)
+
+CODE64 equ 0x08                 ; same selector as gdt64.code in _start.asm
+DATA   equ 0x10
+CODE32 equ 0x18
+
+global arch_x86_trampoline_start
+global arch_x86_trampoline_end
+global arch_x86_trampoline_data
+
+section .rodata
+
+bits 16
+arch_x86_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    lgdt [TR(tr_gdt_ptr)]
+    mov eax, cr0
+    or eax, 1                   ; PE
+    mov cr0, eax
+    jmp CODE32:TR(tr_pm32)
+
+bits 32
+tr_pm32:
+    mov ax, DATA
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    mov eax, cr4
+    or eax, 1 << 5              ; PAE
+    mov cr4, eax
+    mov eax, [TR(tr_cr3)]       ; smp.c checks the kernel PML4 is below 4 GiB
+    mov cr3, eax
+    mov ecx, 0xC0000080         ; EFER: the BSP's LME/NXE
+    mov eax, [TR(tr_efer)]
+    mov edx, [TR(tr_efer) + 4]
+    wrmsr
+    mov eax, cr0
+    or eax, 1 << 31             ; PG
+    mov cr0, eax
+    jmp CODE64:TR(tr_lm64)
+
+bits 64
+tr_lm64:
+    mov ax, DATA
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    xor ax, ax
+    mov fs, ax
+    mov gs, ax
+    mov rax, [TR(tr_cr4)]       ; PGE, PCIDE, OSFXSR, ... as on the BSP
+    mov cr4, rax
+    mov rax, [TR(tr_cr0)]
+    mov cr0, rax
+    mov rsp, [TR(tr_stack)]
+    mov rdi, [TR(tr_arg)]
+    mov rax, [TR(tr_entry)]
+    call rax
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+align 8
+tr_gdt:
+    dq 0
+    dq (1<<43) | (1<<44) | (1<<47) | (1<<53)    ; 64-bit code
+    dq 0x00CF92000000FFFF                       ; flat data
+    dq 0x00CF9A000000FFFF                       ; flat 32-bit code
+tr_gdt_ptr:
+    dw tr_gdt_ptr - tr_gdt - 1
+    dd TR(tr_gdt)
+
+align 8
+arch_x86_trampoline_data:       ; layout of trampoline_data_t in smp.c
+tr_cr3:   dq 0
+tr_cr4:   dq 0
+tr_cr0:   dq 0
+tr_efer:  dq 0
+tr_stack: dq 0
+tr_entry: dq 0
+tr_arg:   dq 0
+arch_x86_trampoline_end:
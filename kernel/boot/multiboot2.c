@@ -1,9 +1,17 @@
+#define LOG_CAT LOG_CAT_BOOT
 #include "boot/multiboot2.h"
 #include "core/log.h"
 #include "lib/include/libc.h"
 /* Small standalone sort used instead of libc qsort (freestanding kernel) */
 #include <string.h>
 
+static uint8_t acpi_rsdp[36];
+static int acpi_rsdp_valid;
+static char cmdline[256];
+
+const void *multiboot2_acpi_rsdp(void) { return acpi_rsdp_valid ? acpi_rsdp : NULL; }
+const char *multiboot2_cmdline(void) { return cmdline; }
+
 static inline uint32_t read_u32(const void *p) {
     uint32_t v;
     memcpy(&v, p, sizeof(v));
@@ -62,10 +70,13 @@ struct mb_tag_framebuffer {
 };
 
 #define MB_TAG_TYPE_END 0
+#define MB_TAG_TYPE_CMDLINE 1
 #define MB_TAG_TYPE_MMAP 6
 #define MB_TAG_TYPE_MODULE 3
 #define MB_TAG_TYPE_ELF_SECTIONS 9
 #define MB_TAG_TYPE_FRAMEBUFFER 8
+#define MB_TAG_TYPE_ACPI_OLD 14
+#define MB_TAG_TYPE_ACPI_NEW 15
 
 /* small dynamic region arrays (stack-local fixed buffers) */
 #define MAX_RAW_REGIONS 32
@@ -156,6 +167,24 @@ size_t parse_multiboot2(void *mbi, phys_mem_region_t *out, size_t max_out) {
                 struct mb_tag_framebuffer *f = (struct mb_tag_framebuffer*)t;
                 add_region(raw, &raw_count, f->addr, f->addr + (uint64_t)f->pitch * f->height, 98 /* FRAMEBUFFER */);
             } break;
+            case MB_TAG_TYPE_CMDLINE: {
+                /* NUL-terminated; copied since the info structure is not kept */
+                size_t len = strnlen((const char *)tagp + sizeof(struct mb_tag), tag_size - sizeof(struct mb_tag));
+                if (len >= sizeof(cmdline)) len = sizeof(cmdline) - 1;
+                memcpy(cmdline, tagp + sizeof(struct mb_tag), len);
+                cmdline[len] = '\0';
+            } break;
+            case MB_TAG_TYPE_ACPI_OLD:
+            case MB_TAG_TYPE_ACPI_NEW: {
+                /* Copy of the RSDP; the info structure itself is not kept
+                 * out of the PMM. Prefer the ACPI 2.0+ one. */
+                size_t len = tag_size - sizeof(struct mb_tag);
+                if (len > sizeof(acpi_rsdp)) len = sizeof(acpi_rsdp);
+                if (tag_type == MB_TAG_TYPE_ACPI_NEW || !acpi_rsdp_valid) {
+                    memcpy(acpi_rsdp, tagp + sizeof(struct mb_tag), len);
+                    acpi_rsdp_valid = 1;
+                }
+            } break;
             default:
                 break;
         }
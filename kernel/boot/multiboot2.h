@@ -10,3 +10,9 @@
  * also accepts Multiboot1 legacy mem_lower/mem_upper if the Multiboot2
  * tag stream is not present. */
 size_t parse_multiboot2(void *mbi, phys_mem_region_t *out, size_t max_out);
+
+/* Copy of the ACPI RSDP from the last parse_multiboot2(), or NULL when the
+ * boot loader passed none. */
+const void *multiboot2_acpi_rsdp(void);
+/* Kernel command line from the last parse_multiboot2(); empty if none. */
+const char *multiboot2_cmdline(void);
@@ -0,0 +1,43 @@
+#ifndef ORION_CORE_HIST_H
+#define ORION_CORE_HIST_H
+
+#include <stdint.h>
+
+/* Log2 histogram of costs (TSC cycles): hist[b] counts samples that took
+ * [2^b, 2^(b+1)), with 0 in bucket 0. Each instance has one writer, e.g.
+ * one per CPU; readers sum them with hist_merge(). */
+#define HIST_BUCKETS 64
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t hist[HIST_BUCKETS];
+} hist_t;
+
+static inline void hist_record(hist_t *h, uint64_t v) {
+    h->count++;
+    h->sum += v;
+    if (v > h->max) h->max = v;
+    h->hist[63 - __builtin_clzll(v | 1)]++;
+}
+
+static inline void hist_merge(hist_t *dst, const hist_t *src) {
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max) dst->max = src->max;
+    for (unsigned b = 0; b < HIST_BUCKETS; b++) dst->hist[b] += src->hist[b];
+}
+
+/* Upper bound of the bucket holding the pct-th percentile; 0 when there
+ * are no samples. */
+static inline uint64_t hist_percentile(const hist_t *h, unsigned pct) {
+    if (!h->count) return 0;
+    uint64_t want = (h->count * pct + 99) / 100, seen = 0;
+    for (unsigned b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->hist[b];
+        if (seen && seen >= want) return b == HIST_BUCKETS - 1 ? UINT64_MAX : (2ULL << b) - 1;
+    }
+    return h->max;
+}
+
+#endif /* ORION_CORE_HIST_H */
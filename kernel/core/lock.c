@@ -0,0 +1,34 @@
+#define LOG_CAT LOG_CAT_LOCK
+#include "core/lock.h"
+#include "core/log.h"
+#include <stdint.h>
+#include <stddef.h>
+
+static lock_stats_t *stats_list;
+
+/* Lock-free push, so registering never takes a lock of its own. */
+void lock_stats_register(lock_stats_t *s) {
+    int expect = 0;
+    if (!__atomic_compare_exchange_n(&s->registered, &expect, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) return;
+    s->next = __atomic_load_n(&stats_list, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(&stats_list, &s->next, s, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {}
+}
+
+void lock_print_stats(void) {
+#if LOCK_STATS
+    for (lock_stats_t *s = __atomic_load_n(&stats_list, __ATOMIC_ACQUIRE); s; s = s->next) {
+        uint64_t total = s->acquisitions + s->shared;
+        LOG_INFO("lock: %s at %p acquired=%lu (shared %lu) contended=%lu avg_wait=%lu max_wait=%lu cycles",
+                 s->name ? s->name : "?", (void *)s, (unsigned long)total, (unsigned long)s->shared,
+                 (unsigned long)s->contended, (unsigned long)(s->contended ? s->spin_cycles / s->contended : 0),
+                 (unsigned long)s->max_spin);
+    }
+#else
+    LOG_INFO("lock: statistics compiled out (LOCK_STATS=0)");
+#endif
+}
+
+void lock_reset_stats(void) {
+    for (lock_stats_t *s = __atomic_load_n(&stats_list, __ATOMIC_ACQUIRE); s; s = s->next)
+        s->acquisitions = s->shared = s->contended = s->spin_cycles = s->max_spin = 0;
+}
@@ -0,0 +1,253 @@
+#ifndef ORION_CORE_LOCK_H
+#define ORION_CORE_LOCK_H
+
+#include <stdint.h>
+#include "core/preempt.h"
+#include "arch/x86_64/cpu.h"
+
+/* Spinning locks for SMP.
+ *
+ * - ticket_lock_t: FIFO spinlock. Everyone spins on the same line, so it is
+ *   the cheapest choice while a lock sees little contention.
+ * - mcs_lock_t: queue lock. Each waiter spins on its own node (usually on
+ *   its stack), so a contended handover touches one remote cache line
+ *   instead of all of them.
+ * - rwlock_t: many readers or one writer. A waiting writer holds off new
+ *   readers, so writers are not starved.
+ *
+ * Every lock raises preempt_count while held. None of them disables
+ * interrupts; use the _irqsave variants for locks also taken from
+ * interrupt handlers. Nothing may sleep while holding one.
+ *
+ * With LOCK_STATS (the default) each lock counts its acquisitions and the
+ * TSC cycles spent waiting for it. A lock registers itself with
+ * lock_print_stats() on its first acquisition, so a lock with statistics
+ * must never be freed once used. Build with -DLOCK_STATS=0 to drop them. */
+#ifndef LOCK_STATS
+#define LOCK_STATS 1
+#endif
+
+typedef struct lock_stats {
+    const char *name;
+    uint64_t acquisitions;      // exclusive; write side for rwlocks
+    uint64_t shared;            // read side of rwlocks
+    uint64_t contended;         // acquisitions that had to wait
+    uint64_t spin_cycles;       // TSC cycles spent waiting
+    uint64_t max_spin;
+    struct lock_stats *next;    // registry, see lock_print_stats()
+    int registered;
+} lock_stats_t;
+
+void lock_stats_register(lock_stats_t *s);
+
+#if LOCK_STATS
+#define LOCK_STATS_MEMBER lock_stats_t stats;
+#define LOCK_STATS_INIT(n) .stats = { .name = (n) },
+#define lock_spin_start() arch_x86_rdtsc()
+#define lock_spin_end(t0) (arch_x86_rdtsc() - (t0) + 1)
+#else
+#define LOCK_STATS_MEMBER
+#define LOCK_STATS_INIT(n)
+#define lock_spin_start() 0
+#define lock_spin_end(t0) ((void)(t0), 1)
+#endif
+
+/* spin is 0 for an uncontended acquisition. Exclusive holders update the
+ * counters under their lock; readers share it and need atomics. */
+static inline void lock_account(lock_stats_t *s, uint64_t spin) {
+    if (!s->registered) lock_stats_register(s);
+    s->acquisitions++;
+    if (spin) {
+        s->contended++;
+        s->spin_cycles += spin;
+        if (spin > s->max_spin) s->max_spin = spin;
+    }
+}
+
+static inline void lock_account_shared(lock_stats_t *s, uint64_t spin) {
+    if (!s->registered) lock_stats_register(s);
+    __atomic_fetch_add(&s->shared, 1, __ATOMIC_RELAXED);
+    if (spin) {
+        __atomic_fetch_add(&s->contended, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&s->spin_cycles, spin, __ATOMIC_RELAXED);
+        if (spin > s->max_spin) s->max_spin = spin;    // racy, good enough for a maximum
+    }
+}
+
+#if LOCK_STATS
+#define LOCK_ACCOUNT(l, spin) lock_account(&(l)->stats, spin)
+#define LOCK_ACCOUNT_SHARED(l, spin) lock_account_shared(&(l)->stats, spin)
+#else
+#define LOCK_ACCOUNT(l, spin) ((void)(spin))
+#define LOCK_ACCOUNT_SHARED(l, spin) ((void)(spin))
+#endif
+
+/* --- Ticket spinlock --- */
+
+typedef struct {
+    volatile uint16_t owner;    // ticket being served
+    volatile uint16_t next;     // next ticket to hand out
+    LOCK_STATS_MEMBER
+} ticket_lock_t;
+
+#define TICKET_LOCK_INIT(name) { .owner = 0, .next = 0, LOCK_STATS_INIT(name) }
+
+static inline void ticket_lock_init(ticket_lock_t *l, const char *name) {
+    *l = (ticket_lock_t)TICKET_LOCK_INIT(name);
+    (void)name;
+}
+
+static inline void ticket_lock(ticket_lock_t *l) {
+    uint64_t spin = 0;
+    preempt_disable();
+    uint16_t t = __atomic_fetch_add(&l->next, 1, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&l->owner, __ATOMIC_ACQUIRE) != t) {
+        uint64_t t0 = lock_spin_start();
+        while (__atomic_load_n(&l->owner, __ATOMIC_ACQUIRE) != t) arch_x86_pause();
+        spin = lock_spin_end(t0);
+    }
+    LOCK_ACCOUNT(l, spin);
+}
+
+/* Returns 1 with the lock held, 0 without waiting when it is taken. */
+static inline int ticket_trylock(ticket_lock_t *l) {
+    preempt_disable();
+    uint16_t t = __atomic_load_n(&l->owner, __ATOMIC_ACQUIRE), expect = t;
+    if (!__atomic_compare_exchange_n(&l->next, &expect, (uint16_t)(t + 1), 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        preempt_enable();
+        return 0;
+    }
+    LOCK_ACCOUNT(l, 0);
+    return 1;
+}
+
+static inline void ticket_unlock(ticket_lock_t *l) {
+    __atomic_store_n(&l->owner, (uint16_t)(l->owner + 1), __ATOMIC_RELEASE);
+    preempt_enable();
+}
+
+static inline uint64_t ticket_lock_irqsave(ticket_lock_t *l) {
+    uint64_t flags = arch_x86_irq_save();
+    ticket_lock(l);
+    return flags;
+}
+
+static inline void ticket_unlock_irqrestore(ticket_lock_t *l, uint64_t flags) {
+    ticket_unlock(l);
+    arch_x86_irq_restore(flags);
+}
+
+/* --- MCS queue lock --- */
+
+/* One node per acquisition, owned by the acquirer until mcs_unlock()
+ * returns; a local variable is the usual place. */
+typedef struct mcs_node {
+    struct mcs_node *volatile next;
+    volatile int locked;
+} mcs_node_t;
+
+typedef struct {
+    mcs_node_t *volatile tail;  // last waiter, or the holder, or NULL when free
+    LOCK_STATS_MEMBER
+} mcs_lock_t;
+
+#define MCS_LOCK_INIT(name) { .tail = NULL, LOCK_STATS_INIT(name) }
+
+static inline void mcs_lock(mcs_lock_t *l, mcs_node_t *n) {
+    uint64_t spin = 0;
+    preempt_disable();
+    n->next = NULL;
+    n->locked = 1;
+    mcs_node_t *prev = __atomic_exchange_n(&l->tail, n, __ATOMIC_ACQ_REL);
+    if (prev) {
+        uint64_t t0 = lock_spin_start();
+        __atomic_store_n(&prev->next, n, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&n->locked, __ATOMIC_ACQUIRE)) arch_x86_pause();
+        spin = lock_spin_end(t0);
+    }
+    LOCK_ACCOUNT(l, spin);
+}
+
+static inline void mcs_unlock(mcs_lock_t *l, mcs_node_t *n) {
+    mcs_node_t *next = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE);
+    if (!next) {
+        mcs_node_t *expect = n;
+        if (__atomic_compare_exchange_n(&l->tail, &expect, NULL, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            preempt_enable();
+            return;
+        }
+        /* A waiter swapped itself in but has not linked to us yet. */
+        while (!(next = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE))) arch_x86_pause();
+    }
+    __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+    preempt_enable();
+}
+
+/* --- Reader-writer lock --- */
+
+#define RWLOCK_WRITER  1u       // held by a writer
+#define RWLOCK_WAITING 2u       // a writer waits; new readers hold off
+#define RWLOCK_READER  4u       // one reader; the count sits above the flags
+
+typedef struct {
+    volatile uint32_t state;
+    LOCK_STATS_MEMBER
+} rwlock_t;
+
+#define RWLOCK_INIT(name) { .state = 0, LOCK_STATS_INIT(name) }
+
+static inline void rwlock_init(rwlock_t *l, const char *name) {
+    *l = (rwlock_t)RWLOCK_INIT(name);
+    (void)name;
+}
+
+static inline void read_lock(rwlock_t *l) {
+    uint64_t spin = 0, t0 = 0;
+    preempt_disable();
+    for (;;) {
+        uint32_t s = __atomic_load_n(&l->state, __ATOMIC_RELAXED);
+        if (!(s & (RWLOCK_WRITER | RWLOCK_WAITING)) &&
+            __atomic_compare_exchange_n(&l->state, &s, s + RWLOCK_READER, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+        if (!spin) spin = 1, t0 = lock_spin_start();
+        arch_x86_pause();
+    }
+    if (spin) spin = lock_spin_end(t0);
+    LOCK_ACCOUNT_SHARED(l, spin);
+}
+
+static inline void read_unlock(rwlock_t *l) {
+    __atomic_fetch_sub(&l->state, RWLOCK_READER, __ATOMIC_RELEASE);
+    preempt_enable();
+}
+
+/* The waiting flag is re-raised on every pass, since a writer that gets
+ * in first clears it for everybody. */
+static inline void write_lock(rwlock_t *l) {
+    uint64_t spin = 0, t0 = 0;
+    preempt_disable();
+    for (;;) {
+        uint32_t s = __atomic_load_n(&l->state, __ATOMIC_RELAXED);
+        if (!(s & ~RWLOCK_WAITING) &&
+            __atomic_compare_exchange_n(&l->state, &s, RWLOCK_WRITER, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+        if (!(s & RWLOCK_WAITING)) __atomic_fetch_or(&l->state, RWLOCK_WAITING, __ATOMIC_RELAXED);
+        if (!spin) spin = 1, t0 = lock_spin_start();
+        arch_x86_pause();
+    }
+    if (spin) spin = lock_spin_end(t0);
+    LOCK_ACCOUNT(l, spin);
+}
+
+static inline void write_unlock(rwlock_t *l) {
+    __atomic_fetch_and(&l->state, ~RWLOCK_WRITER, __ATOMIC_RELEASE);
+    preempt_enable();
+}
+
+/* Every lock that has been taken since boot: acquisitions, how many had to
+ * wait, and average and maximum wait in cycles, to the log (and so the
+ * serial port). lock_reset_stats() zeroes the counters. */
+void lock_print_stats(void);
+void lock_reset_stats(void);
+
+#endif /* ORION_CORE_LOCK_H */
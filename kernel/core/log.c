@@ -0,0 +1,86 @@
+#include "core/log.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* Read on every enabled-at-compile-time log site, written almost never. */
+uint8_t log_levels[LOG_CAT_COUNT] = {
+    [0 ... LOG_CAT_COUNT - 1] = LOG_LEVEL_DEFAULT
+};
+
+static const char *const cat_names[LOG_CAT_COUNT] = {
+    [LOG_CAT_KERNEL] = "kernel",
+    [LOG_CAT_BOOT] = "boot",
+    [LOG_CAT_PMM] = "pmm",
+    [LOG_CAT_SLAB] = "slab",
+    [LOG_CAT_VMM] = "vmm",
+    [LOG_CAT_SCHED] = "sched",
+    [LOG_CAT_SMP] = "smp",
+    [LOG_CAT_TIMER] = "timer",
+    [LOG_CAT_LOCK] = "lock",
+    [LOG_CAT_RCU] = "rcu",
+    [LOG_CAT_FS] = "fs",
+};
+
+static const char *const level_names[] = { "trace", "debug", "info", "warn", "error" };
+
+/* Does the word s..end equal the string w? */
+static int word_is(const char *s, const char *end, const char *w) {
+    while (s < end && *w && *s == *w) {
+        s++;
+        w++;
+    }
+    return s == end && !*w;
+}
+
+static int parse_level(const char *s, const char *end) {
+    if (end - s == 1 && *s >= '0' && *s <= '0' + LOG_LEVEL_PANIC) return *s - '0';
+    for (int i = 0; i < (int)(sizeof(level_names) / sizeof(level_names[0])); i++)
+        if (word_is(s, end, level_names[i])) return i;
+    return -1;
+}
+
+static int set_level(const char *name, const char *end, int level) {
+    int all = word_is(name, end, "all"), found = all;
+    for (int i = 0; i < LOG_CAT_COUNT; i++) {
+        if (!all && !word_is(name, end, cat_names[i])) continue;
+        __atomic_store_n(&log_levels[i], (uint8_t)level, __ATOMIC_RELAXED);
+        found = 1;
+    }
+    return found ? 0 : -1;
+}
+
+int log_set_level(const char *name, int level) {
+    const char *end = name;
+    while (*end) end++;
+    return set_level(name, end, level);
+}
+
+/* One `cat:level` item of log=. */
+static int parse_item(const char *s, const char *end) {
+    const char *colon = s;
+    while (colon < end && *colon != ':') colon++;
+    int level = colon < end ? parse_level(colon + 1, end) : -1;
+    return level < 0 ? -1 : set_level(s, colon, level);
+}
+
+void log_parse_cmdline(const char *cmdline) {
+    if (!cmdline) return;
+    const char *p = cmdline;
+    while (*p) {
+        while (*p == ' ') p++;
+        const char *w = p;
+        while (*p && *p != ' ') p++;
+        if (p - w > 9 && word_is(w, w + 9, "loglevel=")) {
+            int level = parse_level(w + 9, p);
+            if (level >= 0) log_set_level("all", level);
+            else LOG_WARN("log: bad loglevel= in \"%s\"", cmdline);
+        } else if (p - w > 4 && word_is(w, w + 4, "log=")) {
+            for (const char *i = w + 4; i < p;) {
+                const char *e = i;
+                while (e < p && *e != ',') e++;
+                if (parse_item(i, e) != 0) LOG_WARN("log: bad log= item in \"%s\"", cmdline);
+                i = e < p ? e + 1 : e;
+            }
+        }
+    }
+}
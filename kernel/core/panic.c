@@ -2,14 +2,22 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "../drivers/serial.h"
+#include "log.h"
+#if LOG_BINARY
+#include "trace.h"
+#endif
 #include "../lib/include/libc.h"
 
 /* vsnprintf is provided by kernel/lib/printf.c */
 int vsnprintf(char *out, size_t size, const char *fmt, va_list ap);
 
 void panic(const char *fmt, ...) {
-    /* Ensure serial is initialized */
-    serial_init();
+    /* Unbuffered from here on: flush what was queued, bypassing its lock */
+    serial_panic();
+#if LOG_BINARY
+    /* The last log lines are still in the trace rings */
+    trace_drain(SIZE_MAX);
+#endif
 
     char buf[512];
     va_list ap;
@@ -21,7 +29,8 @@ void panic(const char *fmt, ...) {
     serial_write(buf);
     serial_write("\n");
 
-    /* Halt the CPU */
+    /* Halt the CPU for good: no timer or IPI may wake it */
+    __asm__ volatile ("cli");
     for (;;) {
         __asm__ volatile ("hlt");
     }
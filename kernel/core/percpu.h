@@ -0,0 +1,64 @@
+#ifndef ORION_CORE_PERCPU_H
+#define ORION_CORE_PERCPU_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Per-CPU data block. Every CPU points its GS base at its own block, so a
+ * field is read or bumped with a single gs-relative instruction and no
+ * lookup of the CPU number. The blocks themselves live in
+ * arch/x86_64/smp/smp.c; CPU 0 is the BSP.
+ *
+ * The PMM page caches and scheduler run queues stay in arrays indexed by
+ * this_cpu(). */
+#define PERCPU_MAX_CPUS 16
+
+struct Process;
+struct vmm_space;
+
+typedef struct percpu {
+    struct percpu *self;        // must stay first: this_percpu() reads gs:0
+    unsigned cpu;               // dense index, 0 .. PERCPU_MAX_CPUS-1
+    uint32_t apic_id;
+    unsigned preempt_count;     // see core/preempt.h
+    struct Process *current;    // task running here
+    struct vmm_space *space;    // address space loaded in CR3
+    uint64_t irqs;              // interrupts taken
+    volatile int online;
+} percpu_t;
+
+#ifdef ORION_HOSTED
+/* Host builds of kernel code (tests/) run as a single "CPU" whose block is
+ * defined by the harness. */
+extern percpu_t percpu_host;
+#define this_percpu()            (&percpu_host)
+#define percpu_read(field)       (percpu_host.field)
+#define percpu_write(field, v)   (percpu_host.field = (v))
+#define percpu_add(field, v)     (percpu_host.field += (v))
+#else
+static inline percpu_t *this_percpu(void) {
+    percpu_t *p;
+    __asm__ volatile ("mov %%gs:0, %0" : "=r"(p));
+    return p;
+}
+
+#define percpu_read(field) ({                                                   \
+    __typeof__(((percpu_t *)0)->field) v_;                                      \
+    __asm__ volatile ("mov %%gs:%c1, %0" : "=r"(v_) : "i"(offsetof(percpu_t, field))); \
+    v_; })
+
+#define percpu_write(field, v) do {                                             \
+    __typeof__(((percpu_t *)0)->field) v_ = (v);                                \
+    __asm__ volatile ("mov %0, %%gs:%c1" :: "r"(v_), "i"(offsetof(percpu_t, field)) : "memory"); \
+} while (0)
+
+/* Not atomic against other CPUs, only against interrupts on this one. */
+#define percpu_add(field, v) do {                                               \
+    __typeof__(((percpu_t *)0)->field) v_ = (v);                                \
+    __asm__ volatile ("add %0, %%gs:%c1" :: "r"(v_), "i"(offsetof(percpu_t, field)) : "memory"); \
+} while (0)
+#endif
+
+static inline unsigned this_cpu(void) { return percpu_read(cpu); }
+
+#endif /* ORION_CORE_PERCPU_H */
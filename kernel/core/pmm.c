@@ -1,6 +1,10 @@
+#define LOG_CAT LOG_CAT_PMM
 #include "core/pmm.h"
 #include "core/log.h"
 #include "lib/include/libc.h"
+#include "arch/x86_64/cpu.h"
+#include "core/preempt.h"
+#include "core/lock.h"
 #include <stdint.h>
 #include <stddef.h>
 
@@ -8,16 +12,75 @@
 #define DEFAULT_MEMORY_END 0x40000000ULL
 #define KERNEL_START MIN_MEMORY_START
 #define KERNEL_SIZE 0x200000ULL
+/* The boot page tables only identity-map the first 1 GiB, so metadata has
+ * to live below it until the VMM rebases the PMM onto the HHDM. */
+#define PMM_META_LIMIT 0x40000000ULL
 #define BLOCK_SIZE 32
+#define BLOCK_ORDER 5 /* log2(BLOCK_SIZE) */
+
+/* rdtsc around pmm_alloc()/pmm_free(); build with -DPMM_METRICS=0 to drop it */
+#ifndef PMM_METRICS
+#define PMM_METRICS 1
+#endif
+
+/* Buddy metadata lives out of band (free pages are not necessarily mapped):
+ * per-page list links plus one state byte. A page whose state byte has
+ * BUDDY_FREE set heads a free block of order (state & BUDDY_ORDER_MASK). */
+#define BUDDY_NONE 0xFFFFFFFFu
+#define BUDDY_FREE 0x80
+#define BUDDY_CONTIG 0x40   // head of a pmm_alloc_contig() run that is not a whole block
+#define BUDDY_ORDER_MASK 0x1F
+
+/* Deferred init: pmm_init_from_map() only releases the first
+ * PMM_EAGER_BYTES of usable RAM; the rest is queued and released in
+ * PMM_DEFER_CHUNK_PAGES steps when an allocation runs dry or the idle loop
+ * calls pmm_deferred_init_step(). Split points are aligned to the largest
+ * buddy block (which is also a multiple of a coarse block). */
+#ifndef PMM_EAGER_BYTES
+#define PMM_EAGER_BYTES (64ULL << 20)
+#endif
+#define PMM_DEFER_MAX 32
+#define PMM_DEFER_ALIGN ((uint64_t)PAGE_SIZE << PMM_MAX_ORDER)
 
 typedef struct {
-    uint8_t *bitmap;
+    uint64_t start;
+    uint64_t end;
+} PMMRange;
+
+/* Bitmap policies use a three-level bitmap so a search reads a handful of
+ * words instead of testing bits one by one:
+ *   bitmap   - 1 bit per unit (page, or BLOCK_SIZE pages for coarse), 1 = used
+ *   summary1 - bit w set while bitmap word w still has a free bit
+ *   summary2 - bit s set while summary1 word s is non-zero
+ * Bits past the last unit stay set in the bitmap so they never look free. */
+#define BM_NONE ((size_t)-1)
+
+typedef struct {
+    uint64_t *bitmap;
     size_t bitmap_bytes;
+    uint64_t *summary1;
+    uint64_t *summary2;
+    size_t bm_bits;         // units tracked by the bitmap
+    size_t bm_words;
+    size_t bm_hint[PMM_ZONE_COUNT];         // next-fit: unit of the last allocation per zone
+    size_t zone_start[PMM_ZONE_COUNT + 1];  // first page index of each zone; last entry = total_pages
+    size_t meta_bytes;      // metadata footprint, reserved out of a usable region
+    uint64_t meta_phys;
+    uint64_t kernel_start;  // kernel image, never handed out
+    uint64_t kernel_end;
     size_t total_pages;
     size_t used_pages;
     pmm_type_t type;
     uint64_t phys_start;
     uint64_t phys_end;
+    uint32_t *buddy_next;
+    uint32_t *buddy_prev;
+    uint8_t *buddy_state;
+    uint16_t *refs;         // owners - 1 per page, for frames shared copy-on-write
+    uint32_t free_head[PMM_ZONE_COUNT][PMM_MAX_ORDER + 1];
+    PMMRange deferred[PMM_DEFER_MAX];   // usable RAM not yet handed to the policy
+    size_t deferred_count;
+    size_t deferred_next;
 } PMMState;
 
 static PMMState pmm_state = {
@@ -27,44 +90,465 @@ static PMMState pmm_state = {
     .used_pages = 0,
     .type = PMM_BITMAP_FINE,
     .phys_start = MIN_MEMORY_START,
-    .phys_end = DEFAULT_MEMORY_END
+    .phys_end = DEFAULT_MEMORY_END,
+    .kernel_start = KERNEL_START,
+    .kernel_end = KERNEL_START + KERNEL_SIZE
 };
 
+uint64_t pmm_hhdm_offset = 0;
+
+uint64_t pmm_init_cycles = 0;
+uint64_t pmm_deferred_cycles = 0;
+
 uint64_t pmm_cycles_alloc = 0;
 uint64_t pmm_calls_alloc = 0;
 uint64_t pmm_cycles_free = 0;
 uint64_t pmm_calls_free = 0;
+uint64_t pmm_cache_hits_alloc = 0;
+uint64_t pmm_cache_hits_free = 0;
+uint64_t pmm_cache_refills = 0;
+uint64_t pmm_cache_drains = 0;
+
+/* Per-CPU page cache ("magazine") in front of the global allocator. Only
+ * the owning CPU touches its cache, so the common pmm_alloc()/pmm_free()
+ * path never reaches pmm_state. An empty cache is refilled with `low`
+ * frames in one batch; one that grows past `high` drains back to `low`.
+ * Counters are per CPU and folded into the pmm_* globals on demand. */
+typedef struct {
+    size_t count;
+    pmm_latency_t alloc_lat, free_lat;
+    uint64_t hits_alloc, hits_free;
+    uint64_t refills, drains;
+    void *frames[PMM_CACHE_SIZE];
+} __attribute__((aligned(64))) PMMCpuCache;
+
+/* pmm_state, the deferred queue and the zero pool. Every CPU's cache
+ * refills and drains through it, so it is a queue lock. Per-CPU caches are
+ * only guarded by preempt_count. */
+static mcs_lock_t pmm_lock = MCS_LOCK_INIT("pmm");
+
+/* Frames cleared ahead of time by pmm_zero_idle_work(). The policy sees
+ * them as allocated; the statistics count them as free. */
+static void *zero_pool[PMM_ZERO_POOL_SIZE];
+static size_t zero_pool_count = 0;
+uint64_t pmm_zero_hits = 0;
+uint64_t pmm_zero_misses = 0;
+
+static PMMCpuCache pmm_caches[PMM_MAX_CPUS];
+static size_t pmm_cache_low = PMM_CACHE_LOW_DEFAULT;
+static size_t pmm_cache_high = PMM_CACHE_HIGH_DEFAULT;
+
+/* --- Hierarchical bitmap --- */
+
+static inline size_t words_for(size_t bits) { return (bits + 63) / 64; }
+
+/* Refresh the summary bits covering bitmap word w. */
+static inline void bm_sync(size_t w) {
+    size_t s = w >> 6;
+    uint64_t bit = 1ULL << (w & 63);
+    if (pmm_state.bitmap[w] != ~0ULL) pmm_state.summary1[s] |= bit; else pmm_state.summary1[s] &= ~bit;
+    bit = 1ULL << (s & 63);
+    if (pmm_state.summary1[s]) pmm_state.summary2[s >> 6] |= bit; else pmm_state.summary2[s >> 6] &= ~bit;
+}
+
+static inline void bit_set(size_t i) { pmm_state.bitmap[i >> 6] |= 1ULL << (i & 63); bm_sync(i >> 6); }
+static inline void bit_clear(size_t i) { pmm_state.bitmap[i >> 6] &= ~(1ULL << (i & 63)); bm_sync(i >> 6); }
+static inline int bit_test(size_t i) { return (pmm_state.bitmap[i >> 6] >> (i & 63)) & 1; }
+
+/* First bitmap word at or after `from` with a free bit, found through the
+ * summaries: one summary1 word, then at most summary2's length. */
+static size_t bm_find_word(size_t from) {
+    if (from >= pmm_state.bm_words) return BM_NONE;
+    size_t s = from >> 6;
+    uint64_t m = pmm_state.summary1[s] & (~0ULL << (from & 63));
+    if (m) return (s << 6) + __builtin_ctzll(m);
+    if (++s >= words_for(pmm_state.bm_words)) return BM_NONE;
+    size_t t = s >> 6;
+    m = pmm_state.summary2[t] & (~0ULL << (s & 63));
+    while (!m) {
+        if (++t >= words_for(words_for(pmm_state.bm_words))) return BM_NONE;
+        m = pmm_state.summary2[t];
+    }
+    s = (t << 6) + __builtin_ctzll(m);
+    return (s << 6) + __builtin_ctzll(pmm_state.summary1[s]);
+}
+
+static size_t bm_find_free(size_t from) {
+    if (from >= pmm_state.bm_bits) return BM_NONE;
+    size_t w = from >> 6;
+    uint64_t m = ~pmm_state.bitmap[w] & (~0ULL << (from & 63));
+    if (m) return (w << 6) + __builtin_ctzll(m);
+    w = bm_find_word(w + 1);
+    return w == BM_NONE ? BM_NONE : (w << 6) + __builtin_ctzll(~pmm_state.bitmap[w]);
+}
+
+/* First used unit in [start, end), or BM_NONE if the range is all free. */
+static size_t bm_find_used(size_t start, size_t end) {
+    while (start < end) {
+        size_t w = start >> 6, n = 64 - (start & 63);
+        if (n > end - start) n = end - start;
+        uint64_t mask = (n == 64 ? ~0ULL : (1ULL << n) - 1) << (start & 63);
+        uint64_t m = pmm_state.bitmap[w] & mask;
+        if (m) return (w << 6) + __builtin_ctzll(m);
+        start += n;
+    }
+    return BM_NONE;
+}
 
-static inline void bit_set(size_t i) { pmm_state.bitmap[i >> 3] |= (1u << (i & 7)); }
-static inline void bit_clear(size_t i) { pmm_state.bitmap[i >> 3] &= ~(1u << (i & 7)); }
-static inline int bit_test(size_t i) { return (pmm_state.bitmap[i >> 3] >> (i & 7)) & 1; }
+/* Set or clear [start, end) a whole word at a time; returns units changed. */
+static size_t bm_fill(size_t start, size_t end, int used) {
+    size_t changed = 0;
+    while (start < end) {
+        size_t w = start >> 6, n = 64 - (start & 63);
+        if (n > end - start) n = end - start;
+        uint64_t mask = (n == 64 ? ~0ULL : (1ULL << n) - 1) << (start & 63);
+        uint64_t old = pmm_state.bitmap[w];
+        pmm_state.bitmap[w] = used ? old | mask : old & ~mask;
+        changed += __builtin_popcountll(old ^ pmm_state.bitmap[w]);
+        bm_sync(w);
+        start += n;
+    }
+    return changed;
+}
+
+/* --- Zones --- */
+
+/* Zones are contiguous page-index ranges of the managed range. The zone
+ * limits are multiples of the largest buddy block, so no block or bitmap
+ * run found inside one zone ever crosses into the next. */
+static const uint64_t zone_limit[PMM_ZONE_COUNT] = { PMM_ZONE_DMA_LIMIT, PMM_ZONE_DMA32_LIMIT, UINT64_MAX };
+
+static inline uint64_t page_pfn(size_t idx) { return pmm_state.phys_start / PAGE_SIZE + idx; }
+
+/* Number of managed pages lying entirely below physical address a. */
+static size_t pages_below(uint64_t a) {
+    if (a <= pmm_state.phys_start) return 0;
+    uint64_t n = (a - pmm_state.phys_start) / PAGE_SIZE;
+    return n > pmm_state.total_pages ? pmm_state.total_pages : (size_t)n;
+}
+
+static inline int zone_of(size_t idx) {
+    return idx >= pmm_state.zone_start[PMM_ZONE_NORMAL] ? PMM_ZONE_NORMAL
+         : idx >= pmm_state.zone_start[PMM_ZONE_DMA32] ? PMM_ZONE_DMA32 : PMM_ZONE_DMA;
+}
+
+/* Bitmap unit range of a zone. A coarse block straddling a zone boundary
+ * (only possible when phys_start is not block aligned) belongs to the
+ * upper zone. */
+static inline size_t bm_unit(void) { return pmm_state.type == PMM_BITMAP_COARSE ? BLOCK_SIZE : 1; }
+static inline size_t zone_unit_lo(int z) { return pmm_state.zone_start[z] / bm_unit(); }
+static inline size_t zone_unit_hi(int z) { return z == PMM_ZONE_COUNT - 1 ? pmm_state.bm_bits : pmm_state.zone_start[z + 1] / bm_unit(); }
+
+/* Round page index i up so its physical frame number is a multiple of align. */
+static inline size_t align_page(size_t i, size_t align) { return (size_t)(((page_pfn(i) + align - 1) & ~(uint64_t)(align - 1)) - page_pfn(0)); }
+
+/* Next-fit single-unit allocation in zone z below unit hi, starting from
+ * the zone's last allocation. */
+static size_t bm_alloc_one(int z, size_t hi) {
+    size_t i = bm_find_free(pmm_state.bm_hint[z]);
+    if (i >= hi) i = bm_find_free(zone_unit_lo(z));
+    if (i >= hi) return BM_NONE;
+    pmm_state.bm_hint[z] = i;
+    bit_set(i);
+    return i;
+}
+
+/* First-fit search in [lo, hi) for n free units whose first page is
+ * physically aligned to `align` pages. Used words are skipped through the
+ * summaries, runs are checked a word at a time, and a failed candidate
+ * resumes just past the blocking unit. */
+static size_t bm_find_run(size_t n, size_t align, size_t lo, size_t hi) {
+    size_t unit = bm_unit();
+    for (size_t i = lo;;) {
+        i = bm_find_free(i);
+        if (i >= hi) return BM_NONE;
+        if (page_pfn(i * unit) & (align - 1)) {
+            size_t a = (align_page(i * unit, align) + unit - 1) / unit;
+            i = a > i ? a : i + 1;
+            continue;
+        }
+        if (i + n > hi) return BM_NONE;
+        size_t u = bm_find_used(i, i + n);
+        if (u == BM_NONE) return i;
+        i = u + 1;
+    }
+}
 
 pmm_type_t pmm_get_type(void) { return pmm_state.type; }
-const char* pmm_get_type_name(pmm_type_t t) { return t == PMM_BITMAP_COARSE ? "coarse" : "fine"; }
+const char* pmm_get_type_name(pmm_type_t t) {
+    switch (t) {
+        case PMM_BITMAP_COARSE: return "coarse";
+        case PMM_BUDDY: return "buddy";
+        default: return "fine";
+    }
+}
+
+/* --- Buddy free lists (one set per zone) --- */
+
+static void buddy_push(size_t idx, unsigned order) {
+    uint32_t *head = &pmm_state.free_head[zone_of(idx)][order];
+    pmm_state.buddy_next[idx] = *head;
+    pmm_state.buddy_prev[idx] = BUDDY_NONE;
+    if (*head != BUDDY_NONE) pmm_state.buddy_prev[*head] = (uint32_t)idx;
+    *head = (uint32_t)idx;
+    pmm_state.buddy_state[idx] = BUDDY_FREE | order;
+}
+
+static void buddy_unlink(size_t idx, unsigned order) {
+    uint32_t next = pmm_state.buddy_next[idx], prev = pmm_state.buddy_prev[idx];
+    if (prev != BUDDY_NONE) pmm_state.buddy_next[prev] = next; else pmm_state.free_head[zone_of(idx)][order] = next;
+    if (next != BUDDY_NONE) pmm_state.buddy_prev[next] = prev;
+    pmm_state.buddy_state[idx] = 0;
+}
+
+/* Return a block to the free lists, coalescing with its buddy while the
+ * buddy is a free block of the same order. Buddies are computed on the
+ * physical frame number so blocks stay naturally aligned in physical memory
+ * regardless of where the managed range starts. */
+static void buddy_release(size_t idx, unsigned order) {
+    while (order < PMM_MAX_ORDER) {
+        uint64_t bpfn = page_pfn(idx) ^ (1ULL << order);
+        if (bpfn < page_pfn(0)) break;
+        size_t b = (size_t)(bpfn - page_pfn(0));
+        if (b + (1ULL << order) > pmm_state.total_pages) break;
+        if (pmm_state.buddy_state[b] != (BUDDY_FREE | order)) break;
+        buddy_unlink(b, order);
+        if (b < idx) idx = b;
+        order++;
+    }
+    buddy_push(idx, order);
+}
+
+static void free_buddy(void *p, unsigned order) {
+    uint64_t addr = (uint64_t)p;
+    if (addr < pmm_state.phys_start || addr >= pmm_state.phys_end) PANIC("pmm_free: bad addr 0x%llx", addr);
+    if (addr % ((uint64_t)PAGE_SIZE << order)) PANIC("pmm_free: unaligned 0x%llx for order %u", addr, order);
+    size_t idx = (addr - pmm_state.phys_start) / PAGE_SIZE;
+    if (idx + ((size_t)1 << order) > pmm_state.total_pages) PANIC("pmm_free: block 0x%llx past end", addr);
+    uint8_t st = pmm_state.buddy_state[idx];
+    if (st & BUDDY_FREE) PANIC("pmm_free: double free 0x%llx", addr);
+    if (st != order) PANIC("pmm_free: 0x%llx allocated at order %u, freed at %u", addr, st, order);
+    pmm_state.used_pages -= (size_t)1 << order;
+    buddy_release(idx, order);
+}
+
+/* Carve [p_start, p_end) into the largest naturally aligned blocks. */
+static void buddy_free_range(size_t p_start, size_t p_end) {
+    while (p_start < p_end) {
+        unsigned order = 0;
+        while (order < PMM_MAX_ORDER && !(page_pfn(p_start) & ((2ULL << order) - 1)) && p_start + (2ULL << order) <= p_end) order++;
+        pmm_state.used_pages -= (size_t)1 << order;
+        buddy_release(p_start, order);
+        p_start += (size_t)1 << order;
+    }
+}
+
+/* n pages from zone z ending at or below page index `limit`, aligned to
+ * `align` pages. Pops the smallest block that covers both n and align and
+ * splits it; when n is not the whole block the tail goes straight back to
+ * the free lists and the head is tagged BUDDY_CONTIG. The list is only
+ * walked when `limit` cuts through the zone; otherwise any head fits. */
+static void *alloc_buddy(int z, size_t n, size_t align, size_t limit) {
+    unsigned order = 0;
+    while (((size_t)1 << order) < n || ((size_t)1 << order) < align) order++;
+    if (order > PMM_MAX_ORDER) return NULL;
+    size_t want = (size_t)1 << order;
+    for (unsigned k = order; k <= PMM_MAX_ORDER; k++) {
+        uint32_t idx = pmm_state.free_head[z][k];
+        while (idx != BUDDY_NONE && idx + want > limit) idx = pmm_state.buddy_next[idx];
+        if (idx == BUDDY_NONE) continue;
+        buddy_unlink(idx, k);
+        while (k > order) { k--; buddy_push(idx + ((size_t)1 << k), k); }
+        pmm_state.used_pages += want;
+        if (n == want) {
+            pmm_state.buddy_state[idx] = (uint8_t)order;
+        } else {
+            memset(&pmm_state.buddy_state[idx], 0, n);
+            pmm_state.buddy_state[idx] = BUDDY_CONTIG;
+            buddy_free_range(idx + n, idx + want);
+        }
+        return (void*)(pmm_state.phys_start + (uint64_t)idx * PAGE_SIZE);
+    }
+    return NULL;
+}
+
+/* --- Range marking during init --- */
+
+static int clamp_range(uint64_t *start, uint64_t *end, size_t *p_start, size_t *p_end) {
+    if (*end <= pmm_state.phys_start || *start >= pmm_state.phys_end) return 0;
+    if (*start < pmm_state.phys_start) *start = pmm_state.phys_start;
+    if (*end > pmm_state.phys_end) *end = pmm_state.phys_end;
+    *p_start = (*start - pmm_state.phys_start + PAGE_SIZE - 1) / PAGE_SIZE;
+    *p_end = (*end - pmm_state.phys_start) / PAGE_SIZE;
+    if (*p_end > pmm_state.total_pages) *p_end = pmm_state.total_pages;
+    return *p_start < *p_end;
+}
+
+static void mark_range_free_fine(size_t p_start, size_t p_end) { pmm_state.used_pages -= bm_fill(p_start, p_end, 0); }
+
+static void mark_blocks_free_coarse(size_t b_start, size_t b_end) { if (b_start < b_end) pmm_state.used_pages -= bm_fill(b_start, b_end, 0) * BLOCK_SIZE; }
+
+/* Release a usable region to the active policy. Only whole pages inside
+ * [start, end) are freed; coarse blocks must lie entirely in the region. */
+static void free_region(uint64_t start, uint64_t end) {
+    size_t p_start, p_end;
+    if (!clamp_range(&start, &end, &p_start, &p_end)) return;
+    /* Refcounts are cleared here rather than at init, so deferred memory
+     * costs nothing until it is released. */
+    memset(&pmm_state.refs[p_start], 0, (p_end - p_start) * sizeof(uint16_t));
+    switch (pmm_state.type) {
+        case PMM_BITMAP_COARSE:
+            mark_blocks_free_coarse((p_start + BLOCK_SIZE - 1) / BLOCK_SIZE, p_end / BLOCK_SIZE);
+            break;
+        case PMM_BUDDY:
+            buddy_free_range(p_start, p_end);
+            break;
+        default:
+            mark_range_free_fine(p_start, p_end);
+            break;
+    }
+}
+
+/* Pages free_region(start, end) would release into still-used metadata. */
+static size_t region_pages(uint64_t start, uint64_t end) {
+    size_t p_start, p_end;
+    if (!clamp_range(&start, &end, &p_start, &p_end)) return 0;
+    if (pmm_state.type != PMM_BITMAP_COARSE) return p_end - p_start;
+    size_t b_start = (p_start + BLOCK_SIZE - 1) / BLOCK_SIZE, b_end = p_end / BLOCK_SIZE;
+    return b_start < b_end ? (b_end - b_start) * BLOCK_SIZE : 0;
+}
+
+static size_t deferred_pages(void) {
+    size_t n = 0;
+    for (size_t i = pmm_state.deferred_next; i < pmm_state.deferred_count; i++)
+        n += region_pages(pmm_state.deferred[i].start, pmm_state.deferred[i].end);
+    return n;
+}
+
+static size_t deferred_step(size_t max_pages) {
+    uint64_t t0 = arch_x86_rdtsc();
+    size_t released = 0;
+    while (released < max_pages && pmm_state.deferred_next < pmm_state.deferred_count) {
+        PMMRange *r = &pmm_state.deferred[pmm_state.deferred_next];
+        uint64_t cut = r->start + (uint64_t)(max_pages - released) * PAGE_SIZE;
+        cut = (cut + PMM_DEFER_ALIGN - 1) & ~(PMM_DEFER_ALIGN - 1);
+        if (cut >= r->end || cut <= r->start) cut = r->end;
+        size_t used_before = pmm_state.used_pages;
+        free_region(r->start, cut);
+        released += used_before - pmm_state.used_pages;
+        r->start = cut;
+        if (r->start >= r->end) pmm_state.deferred_next++;
+    }
+    pmm_deferred_cycles += arch_x86_rdtsc() - t0;
+    return released;
+}
+
+size_t pmm_deferred_init_step(size_t max_pages) {
+    if (pmm_state.deferred_next == pmm_state.deferred_count) return 0;
+    mcs_node_t n;
+    mcs_lock(&pmm_lock, &n);
+    size_t released = deferred_step(max_pages);
+    mcs_unlock(&pmm_lock, &n);
+    return released;
+}
+
+void pmm_deferred_init_all(void) { while (pmm_deferred_init_step(PMM_DEFER_CHUNK_PAGES)) { } }
+
+size_t pmm_deferred_remaining(void) {
+    mcs_node_t n;
+    mcs_lock(&pmm_lock, &n);
+    size_t pages = deferred_pages();
+    mcs_unlock(&pmm_lock, &n);
+    return pages * PAGE_SIZE;
+}
+
+/* Queue [start, end) for deferred release; releases it now if the queue is full. */
+static void defer_region(uint64_t start, uint64_t end) {
+    if (pmm_state.deferred_count == PMM_DEFER_MAX) { free_region(start, end); return; }
+    pmm_state.deferred[pmm_state.deferred_count++] = (PMMRange){ .start = start, .end = end };
+}
+
+static size_t bitmap_units(pmm_type_t type, size_t pages) { return type == PMM_BITMAP_COARSE ? (pages + BLOCK_SIZE - 1) / BLOCK_SIZE : pages; }
+
+/* The refcounts come first, padded so the policy's arrays stay aligned. */
+static size_t refs_bytes(size_t pages) { return (pages * sizeof(uint16_t) + 7) & ~(size_t)7; }
+
+static size_t metadata_bytes(pmm_type_t type, size_t pages) {
+    if (type == PMM_BUDDY) return refs_bytes(pages) + pages * (2 * sizeof(uint32_t) + 1);
+    size_t words = words_for(bitmap_units(type, pages));
+    return refs_bytes(pages) + (words + words_for(words) + words_for(words_for(words))) * sizeof(uint64_t);
+}
+
+/* Point the metadata arrays at `meta` (a virtual address). */
+static void meta_layout(uint8_t *meta) {
+    pmm_state.refs = (uint16_t*)meta;
+    meta += refs_bytes(pmm_state.total_pages);
+    if (pmm_state.type == PMM_BUDDY) {
+        pmm_state.buddy_next = (uint32_t*)meta;
+        pmm_state.buddy_prev = pmm_state.buddy_next + pmm_state.total_pages;
+        pmm_state.buddy_state = (uint8_t*)(pmm_state.buddy_prev + pmm_state.total_pages);
+    } else {
+        pmm_state.bitmap = (uint64_t*)meta;
+        pmm_state.summary1 = pmm_state.bitmap + pmm_state.bm_words;
+        pmm_state.summary2 = pmm_state.summary1 + words_for(pmm_state.bm_words);
+    }
+}
 
-static void mark_range_used_fine(uint64_t start, uint64_t end) {
-    if (end <= pmm_state.phys_start || start >= pmm_state.phys_end) return;
-    if (start < pmm_state.phys_start) start = pmm_state.phys_start;
-    if (end > pmm_state.phys_end) end = pmm_state.phys_end;
-    size_t p_start = (start - pmm_state.phys_start) / PAGE_SIZE;
-    size_t p_end = (end - pmm_state.phys_start + PAGE_SIZE - 1) / PAGE_SIZE;
-    for (size_t p = p_start; p < p_end && p < pmm_state.total_pages; p++) if (!bit_test(p)) { bit_set(p); pmm_state.used_pages++; }
+/* Lowest page-aligned spot for `bytes` of metadata inside a usable region,
+ * clear of the kernel image and below PMM_META_LIMIT. Memory above
+ * ZONE_DMA is preferred. Returns 0 if nothing fits. */
+static uint64_t place_metadata(const phys_mem_region_t *map, size_t entries, size_t bytes) {
+    static const uint64_t floors[2] = { PMM_ZONE_DMA_LIMIT, 0 };
+    uint64_t len = (bytes + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    for (int f = 0; f < 2; f++) {
+        for (size_t i = 0; i < entries; i++) {
+            if (map[i].type != 1) continue;
+            uint64_t s = (map[i].addr + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1), e = map[i].addr + map[i].len;
+            if (s < floors[f]) s = floors[f];
+            if (s < pmm_state.phys_start) s = pmm_state.phys_start;
+            if (e > PMM_META_LIMIT) e = PMM_META_LIMIT;
+            if (s < pmm_state.kernel_end && s + len > pmm_state.kernel_start)
+                s = (pmm_state.kernel_end + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+            if (s + len <= e) return s;
+        }
+    }
+    return 0;
 }
 
-static void mark_range_free_fine(uint64_t start, uint64_t end) {
-    if (end <= pmm_state.phys_start || start >= pmm_state.phys_end) return;
-    if (start < pmm_state.phys_start) start = pmm_state.phys_start;
-    if (end > pmm_state.phys_end) end = pmm_state.phys_end;
-    size_t p_start = (start - pmm_state.phys_start) / PAGE_SIZE;
-    size_t p_end = (end - pmm_state.phys_start + PAGE_SIZE - 1) / PAGE_SIZE;
-    for (size_t p = p_start; p < p_end && p < pmm_state.total_pages; p++) if (bit_test(p)) { bit_clear(p); pmm_state.used_pages--; }
+/* Hand the usable range [s, e) minus the reserved ranges to the policy:
+ * the first *eager bytes now, the rest through the deferred queue. */
+static void release_usable(uint64_t s, uint64_t e, const PMMRange *resv, size_t nresv, uint64_t *eager) {
+    for (size_t i = 0; i < nresv; i++) {
+        if (resv[i].end <= s || resv[i].start >= e) continue;
+        release_usable(s, resv[i].start, resv + i + 1, nresv - i - 1, eager);
+        release_usable(resv[i].end, e, resv + i + 1, nresv - i - 1, eager);
+        return;
+    }
+    if (s < pmm_state.phys_start) s = pmm_state.phys_start;
+    if (s >= e) return;
+    uint64_t cut = s + *eager;
+    cut = (cut + PMM_DEFER_ALIGN - 1) & ~(PMM_DEFER_ALIGN - 1);
+    if (*eager == 0) cut = s;
+    if (cut > e || cut < s) cut = e;
+    if (cut > s) { free_region(s, cut); *eager -= (cut - s < *eager) ? cut - s : *eager; }
+    if (cut < e) defer_region(cut, e);
 }
 
-static void mark_block_used_coarse(size_t b) { if (!bit_test(b)) { bit_set(b); pmm_state.used_pages += BLOCK_SIZE; } }
-static void mark_block_free_coarse(size_t b) { if (bit_test(b)) { bit_clear(b); pmm_state.used_pages -= BLOCK_SIZE; } }
+void pmm_set_kernel_range(uint64_t start, uint64_t end) {
+    pmm_state.kernel_start = start;
+    pmm_state.kernel_end = end;
+}
+
+void pmm_set_hhdm_offset(uint64_t offset) {
+    pmm_hhdm_offset = offset;
+    meta_layout(phys_to_virt(pmm_state.meta_phys));
+}
 
 void pmm_init_from_map(const phys_mem_region_t *map, size_t entries, pmm_type_t type) {
+    uint64_t t0 = arch_x86_rdtsc();
     if (!map || entries == 0) PANIC("pmm_init_from_map: invalid memory map");
+    pmm_state.deferred_count = pmm_state.deferred_next = 0;
+    pmm_deferred_cycles = 0;
     pmm_state.type = type;
     uint64_t min_start = UINT64_MAX; uint64_t max_end = 0;
     for (size_t i = 0; i < entries; i++) { if (map[i].len == 0) continue; if (map[i].addr < min_start) min_start = map[i].addr; uint64_t e = map[i].addr + map[i].len; if (e > max_end) max_end = e; }
@@ -73,29 +557,42 @@ void pmm_init_from_map(const phys_mem_region_t *map, size_t entries, pmm_type_t
     pmm_state.phys_end = max_end; if (pmm_state.phys_end <= pmm_state.phys_start) PANIC("pmm_init_from_map: no usable physical range");
     pmm_state.total_pages = (pmm_state.phys_end - pmm_state.phys_start) / PAGE_SIZE;
     if (pmm_state.total_pages == 0 || pmm_state.total_pages > (1ULL << 30)) PANIC("pmm_init_from_map: suspicious total_pages=%llu", (unsigned long long)pmm_state.total_pages);
-    if (type == PMM_BITMAP_COARSE) pmm_state.bitmap_bytes = ((pmm_state.total_pages + BLOCK_SIZE - 1) / BLOCK_SIZE + 7) / 8; else pmm_state.bitmap_bytes = (pmm_state.total_pages + 7) / 8;
-    pmm_state.bitmap = (uint8_t*)(KERNEL_START + KERNEL_SIZE);
-    memset(pmm_state.bitmap, 0xFF, pmm_state.bitmap_bytes);
+    memset(pmm_caches, 0, sizeof(pmm_caches));
+    zero_pool_count = 0;
+    pmm_state.zone_start[0] = 0;
+    for (int z = 0; z < PMM_ZONE_COUNT; z++) pmm_state.zone_start[z + 1] = pages_below(zone_limit[z]);
+    pmm_state.meta_bytes = metadata_bytes(type, pmm_state.total_pages);
+    pmm_state.meta_phys = place_metadata(map, entries, pmm_state.meta_bytes);
+    if (!pmm_state.meta_phys) PANIC("pmm_init_from_map: no room for %lu bytes of metadata below 1 GiB", (unsigned long)pmm_state.meta_bytes);
     pmm_state.used_pages = pmm_state.total_pages;
-    if (type == PMM_BITMAP_COARSE) {
-        size_t blocks = (pmm_state.total_pages + BLOCK_SIZE - 1) / BLOCK_SIZE;
-        for (size_t b = 0; b < blocks; b++) {
-            uint64_t b_start = pmm_state.phys_start + b * (uint64_t)BLOCK_SIZE * PAGE_SIZE;
-            uint64_t b_end = b_start + (uint64_t)BLOCK_SIZE * PAGE_SIZE;
-            for (size_t i = 0; i < entries; i++) {
-                if (map[i].type != 1) continue;
-                uint64_t r_start = map[i].addr; uint64_t r_end = map[i].addr + map[i].len;
-                if (b_start >= r_start && b_end <= r_end) { mark_block_free_coarse(b); break; }
-            }
-        }
+    if (type == PMM_BUDDY) {
+        /* Every page starts out allocated at order 0; the links are only
+         * read for pages on a free list, so they need no initialization. */
+        pmm_state.bitmap = NULL; pmm_state.bitmap_bytes = 0;
+        meta_layout(phys_to_virt(pmm_state.meta_phys));
+        memset(pmm_state.buddy_state, 0, pmm_state.total_pages);
+        for (int z = 0; z < PMM_ZONE_COUNT; z++)
+            for (unsigned o = 0; o <= PMM_MAX_ORDER; o++) pmm_state.free_head[z][o] = BUDDY_NONE;
     } else {
-        for (size_t i = 0; i < entries; i++) if (map[i].type == 1) mark_range_free_fine(map[i].addr, map[i].addr + map[i].len);
+        pmm_state.bm_bits = bitmap_units(type, pmm_state.total_pages);
+        pmm_state.bm_words = words_for(pmm_state.bm_bits);
+        pmm_state.bitmap_bytes = pmm_state.bm_words * sizeof(uint64_t);
+        meta_layout(phys_to_virt(pmm_state.meta_phys));
+        memset(pmm_state.bitmap, 0xFF, pmm_state.bitmap_bytes);
+        memset(pmm_state.summary1, 0, pmm_state.meta_bytes - refs_bytes(pmm_state.total_pages) - pmm_state.bitmap_bytes);
+        for (int z = 0; z < PMM_ZONE_COUNT; z++) pmm_state.bm_hint[z] = zone_unit_lo(z);
     }
-    uint64_t r_end = KERNEL_START + KERNEL_SIZE + pmm_state.bitmap_bytes; if (r_end < pmm_state.phys_start) r_end = pmm_state.phys_start;
-    if (type == PMM_BITMAP_COARSE) {
-        size_t blocks = (pmm_state.total_pages + BLOCK_SIZE - 1) / BLOCK_SIZE;
-        for (size_t b = 0; b < blocks; b++) { uint64_t addr = pmm_state.phys_start + b * (uint64_t)BLOCK_SIZE * PAGE_SIZE; if (addr < r_end) mark_block_used_coarse(b); }
-    } else mark_range_used_fine(pmm_state.phys_start, r_end);
+    /* Kernel image and PMM metadata stay used: clip them out of every usable
+     * region up front so no policy has to re-reserve pages it just freed.
+     * Only the first PMM_EAGER_BYTES are released now; the rest is deferred. */
+    PMMRange resv[2] = {
+        { .start = pmm_state.kernel_start, .end = pmm_state.kernel_end },
+        { .start = pmm_state.meta_phys, .end = pmm_state.meta_phys + pmm_state.meta_bytes },
+    };
+    uint64_t eager = PMM_EAGER_BYTES;
+    for (size_t i = 0; i < entries; i++)
+        if (map[i].type == 1) release_usable(map[i].addr, map[i].addr + map[i].len, resv, 2, &eager);
+    pmm_init_cycles = arch_x86_rdtsc() - t0;
 }
 
 void pmm_init(pmm_type_t type) {
@@ -103,23 +600,585 @@ void pmm_init(pmm_type_t type) {
     pmm_init_from_map(&fake, 1, type);
 }
 
+/* Pages parked in per-CPU caches or the zero pool are free from the
+ * caller's point of view. */
+static size_t cached_pages(void) {
+    size_t n = zero_pool_count;
+    for (unsigned c = 0; c < PMM_MAX_CPUS; c++) n += pmm_caches[c].count;
+    return pmm_state.type == PMM_BITMAP_COARSE ? n * BLOCK_SIZE : n;
+}
+
 size_t pmm_get_total_memory(void) { return pmm_state.total_pages * PAGE_SIZE; }
-size_t pmm_get_used_memory(void) { return pmm_state.used_pages * PAGE_SIZE; }
-size_t pmm_get_free_memory(void) { return (pmm_state.total_pages - pmm_state.used_pages) * PAGE_SIZE; }
+size_t pmm_get_used_memory(void) { return (pmm_state.used_pages - cached_pages() - deferred_pages()) * PAGE_SIZE; }
+size_t pmm_get_free_memory(void) { return (pmm_state.total_pages - pmm_state.used_pages + cached_pages() + deferred_pages()) * PAGE_SIZE; }
 
-static void *alloc_fine(void) { for (size_t i = 0; i < pmm_state.total_pages; i++) if (!bit_test(i)) { bit_set(i); pmm_state.used_pages++; return (void*)(pmm_state.phys_start + i * PAGE_SIZE); } return NULL; }
-static void *alloc_coarse(void) { size_t blocks = (pmm_state.total_pages + BLOCK_SIZE - 1) / BLOCK_SIZE; for (size_t b = 0; b < blocks; b++) if (!bit_test(b)) { bit_set(b); pmm_state.used_pages += BLOCK_SIZE; return (void*)(pmm_state.phys_start + b * BLOCK_SIZE * PAGE_SIZE); } return NULL; }
+/* n pages (rounded up to whole units) from zone z ending at or below page
+ * index `limit`, first page aligned to `align` pages. Single units go
+ * through the next-fit path, everything else through the run search. */
+static void *alloc_bitmap(int z, size_t n, size_t align, size_t limit) {
+    size_t unit = bm_unit(), units = (n + unit - 1) / unit;
+    size_t hi = zone_unit_hi(z);
+    if (hi > limit / unit) hi = limit / unit;
+    size_t i;
+    if (units == 1 && align <= unit) i = bm_alloc_one(z, hi);
+    else if ((i = bm_find_run(units, align, zone_unit_lo(z), hi)) != BM_NONE) bm_fill(i, i + units, 1);
+    if (i == BM_NONE) return NULL;
+    pmm_state.used_pages += units * unit;
+    return (void*)(pmm_state.phys_start + i * unit * PAGE_SIZE);
+}
 
-void *pmm_alloc(void) { return pmm_state.type == PMM_BITMAP_COARSE ? alloc_coarse() : alloc_fine(); }
+static void *zone_alloc(int z, size_t n, size_t align, size_t limit) {
+    if (pmm_state.zone_start[z] >= limit) return NULL;
+    return pmm_state.type == PMM_BUDDY ? alloc_buddy(z, n, align, limit) : alloc_bitmap(z, n, align, limit);
+}
+
+/* Whether releasing the next deferred chunk can add pages below `limit`.
+ * The queue is in map order, which is ascending on every firmware seen. */
+static int deferred_below(size_t limit) {
+    return pmm_state.deferred_next < pmm_state.deferred_count &&
+           pmm_state.deferred[pmm_state.deferred_next].start < pmm_state.phys_start + (uint64_t)limit * PAGE_SIZE;
+}
+
+/* Try zones from the highest one below `limit` downwards. ZONE_DMA is only
+ * used once deferred memory has been released (or cannot help), so early
+ * boot allocations do not eat the memory legacy devices depend on. */
+static void *global_alloc_contig(size_t n, size_t align, size_t limit) {
+    int top = PMM_ZONE_NORMAL;
+    while (top > PMM_ZONE_DMA && pmm_state.zone_start[top] >= limit) top--;
+    int floor = top > PMM_ZONE_DMA ? PMM_ZONE_DMA32 : PMM_ZONE_DMA;
+    void *p = NULL;
+    for (;;) {
+        for (int z = top; z >= floor && !p; z--) p = zone_alloc(z, n, align, limit);
+        if (p || !deferred_below(limit) || !deferred_step(PMM_DEFER_CHUNK_PAGES)) break;
+    }
+    if (!p && floor > PMM_ZONE_DMA) p = zone_alloc(PMM_ZONE_DMA, n, align, limit);
+    return p;
+}
+
+static void *global_alloc(void) { return global_alloc_contig(1, 1, pmm_state.total_pages); }
+
+void *pmm_alloc_order(unsigned order) {
+    if (order > PMM_MAX_ORDER) return NULL;
+    if (pmm_state.type == PMM_BITMAP_COARSE && order > BLOCK_ORDER) return NULL;
+    mcs_node_t node;
+    mcs_lock(&pmm_lock, &node);
+    void *p = global_alloc_contig((size_t)1 << order, (size_t)1 << order, pmm_state.total_pages);
+    mcs_unlock(&pmm_lock, &node);
+    return p;
+}
+
+void *pmm_alloc_zone(pmm_zone_t max_zone) {
+    if ((unsigned)max_zone >= PMM_ZONE_COUNT) return NULL;
+    mcs_node_t node;
+    mcs_lock(&pmm_lock, &node);
+    void *p = global_alloc_contig(1, 1, pmm_state.zone_start[max_zone + 1]);
+    mcs_unlock(&pmm_lock, &node);
+    return p;
+}
+
+void *pmm_alloc_contig(size_t n, uint64_t max_phys, uint64_t align) {
+    if (n == 0 || (align & (align - 1))) return NULL;
+    if (align < PAGE_SIZE) align = PAGE_SIZE;
+    size_t limit = max_phys ? pages_below(max_phys) : pmm_state.total_pages;
+    if (n > limit) return NULL;
+    mcs_node_t node;
+    mcs_lock(&pmm_lock, &node);
+    void *p = global_alloc_contig(n, (size_t)(align / PAGE_SIZE), limit);
+    mcs_unlock(&pmm_lock, &node);
+    return p;
+}
 
 static void free_fine(void *p) { uint64_t addr = (uint64_t)p; if (addr < pmm_state.phys_start || addr >= pmm_state.phys_end) PANIC("pmm_free: bad addr 0x%llx", addr); if (addr % PAGE_SIZE) PANIC("pmm_free: unaligned 0x%llx", addr); size_t idx = (addr - pmm_state.phys_start) / PAGE_SIZE; if (!bit_test(idx)) PANIC("pmm_free: double free 0x%llx", addr); bit_clear(idx); pmm_state.used_pages--; }
 static void free_coarse(void *p) { uint64_t addr = (uint64_t)p; if (addr < pmm_state.phys_start || addr >= pmm_state.phys_end) PANIC("pmm_free: bad addr 0x%llx", addr); if (addr % PAGE_SIZE) PANIC("pmm_free: unaligned 0x%llx", addr); size_t idx = (addr - pmm_state.phys_start) / (BLOCK_SIZE * PAGE_SIZE); if (!bit_test(idx)) PANIC("pmm_free: double free 0x%llx", addr); bit_clear(idx); pmm_state.used_pages -= BLOCK_SIZE; }
 
-void pmm_free(void *p) { if (pmm_state.type == PMM_BITMAP_COARSE) free_coarse(p); else free_fine(p); }
+static void global_free(void *p) {
+    switch (pmm_state.type) {
+        case PMM_BITMAP_COARSE: free_coarse(p); break;
+        case PMM_BUDDY: free_buddy(p, 0); break;
+        default: free_fine(p); break;
+    }
+}
+
+/* Whether the policy holds page idx as free. Read without pmm_lock: the
+ * caller owns the page it frees, so nothing can be making it free right
+ * now, and a stale read can only miss a double free, never invent one. */
+static int policy_has_free(size_t idx) {
+    if (pmm_state.type != PMM_BUDDY) return !bit_test(pmm_state.type == PMM_BITMAP_COARSE ? idx / BLOCK_SIZE : idx);
+    for (unsigned o = 0; o <= PMM_MAX_ORDER; o++) {
+        uint64_t head = page_pfn(idx) & ~((1ULL << o) - 1);
+        if (head < page_pfn(0)) break;
+        if (__atomic_load_n(&pmm_state.buddy_state[head - page_pfn(0)], __ATOMIC_RELAXED) == (BUDDY_FREE | o)) return 1;
+    }
+    return 0;
+}
+
+/* --- Per-CPU cache front end --- */
+
+/* A cached frame has no owners, so its refcount slot marks it instead.
+ * pmm_frame_ref() never lets a real count reach the mark. */
+#define REF_CACHED UINT16_MAX
+
+static inline uint16_t *cache_mark(void *p) { return &pmm_state.refs[((uint64_t)p - pmm_state.phys_start) / PAGE_SIZE]; }
+
+/* Both move a whole batch under one acquisition of pmm_lock. */
+static void cache_refill(PMMCpuCache *c) {
+    mcs_node_t n;
+    c->refills++;
+    mcs_lock(&pmm_lock, &n);
+    while (c->count < pmm_cache_low) {
+        void *p = global_alloc();
+        if (!p && zero_pool_count) p = zero_pool[--zero_pool_count];
+        if (!p) break;
+        __atomic_store_n(cache_mark(p), REF_CACHED, __ATOMIC_RELAXED);
+        c->frames[c->count++] = p;
+    }
+    mcs_unlock(&pmm_lock, &n);
+}
+
+static void cache_drain_to(PMMCpuCache *c, size_t target) {
+    mcs_node_t n;
+    c->drains++;
+    mcs_lock(&pmm_lock, &n);
+    while (c->count > target) {
+        void *p = c->frames[--c->count];
+        __atomic_store_n(cache_mark(p), 0, __ATOMIC_RELAXED);
+        global_free(p);
+    }
+    mcs_unlock(&pmm_lock, &n);
+}
+
+static inline void lat_record(pmm_latency_t *l, uint64_t t0) {
+#if PMM_METRICS
+    hist_record(l, arch_x86_rdtsc() - t0);
+#else
+    (void)t0;
+    l->count++;
+#endif
+}
+
+static inline uint64_t lat_start(void) {
+#if PMM_METRICS
+    return arch_x86_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+void *pmm_alloc(void) {
+    uint64_t t0 = lat_start();
+    preempt_disable();
+    PMMCpuCache *c = &pmm_caches[this_cpu()];
+    if (c->count) c->hits_alloc++;
+    else cache_refill(c);
+    void *p = c->count ? c->frames[--c->count] : NULL;
+    if (p) __atomic_store_n(cache_mark(p), 0, __ATOMIC_RELAXED);
+    lat_record(&c->alloc_lat, t0);
+    preempt_enable();
+    return p;
+}
+
+/* A double free is caught before the frame is cached: either it is still
+ * in some CPU's cache (marked) or the policy already holds it as free.
+ * Only two frees of one frame racing on two CPUs can both get through. */
+void pmm_free(void *p) {
+    uint64_t t0 = lat_start();
+    uint64_t addr = (uint64_t)p;
+    if (addr < pmm_state.phys_start || addr >= pmm_state.phys_end) PANIC("pmm_free: bad addr 0x%llx", addr);
+    if (addr % PAGE_SIZE) PANIC("pmm_free: unaligned 0x%llx", addr);
+    uint16_t *mark = cache_mark(p);
+    if (__atomic_load_n(mark, __ATOMIC_RELAXED) == REF_CACHED || policy_has_free((addr - pmm_state.phys_start) / PAGE_SIZE))
+        PANIC("pmm_free: double free 0x%llx", addr);
+    __atomic_store_n(mark, REF_CACHED, __ATOMIC_RELAXED);
+    preempt_disable();
+    PMMCpuCache *c = &pmm_caches[this_cpu()];
+    if (c->count < pmm_cache_high) c->hits_free++;
+    else cache_drain_to(c, pmm_cache_low);
+    c->frames[c->count++] = p;
+    lat_record(&c->free_lat, t0);
+    preempt_enable();
+}
+
+/* The pool only takes frames that are free right now in the zones above
+ * ZONE_DMA; releasing deferred memory is left to pmm_deferred_init_step().
+ * Frames are cleared outside pmm_lock; one that finds the pool filled by
+ * another CPU in the meantime goes back to the policy. */
+size_t pmm_zero_idle_work(size_t max_frames) {
+    size_t added = 0;
+    mcs_node_t n;
+    while (added < max_frames) {
+        mcs_lock(&pmm_lock, &n);
+        void *p = NULL;
+        if (zero_pool_count < PMM_ZERO_POOL_SIZE) {
+            p = zone_alloc(PMM_ZONE_NORMAL, 1, 1, pmm_state.total_pages);
+            if (!p) p = zone_alloc(PMM_ZONE_DMA32, 1, 1, pmm_state.total_pages);
+        }
+        mcs_unlock(&pmm_lock, &n);
+        if (!p) break;
+        arch_x86_clear_page_nt(phys_to_virt((uint64_t)p));
+        arch_x86_sfence();
+        mcs_lock(&pmm_lock, &n);
+        if (zero_pool_count < PMM_ZERO_POOL_SIZE) zero_pool[zero_pool_count++] = p, p = NULL;
+        else global_free(p);
+        mcs_unlock(&pmm_lock, &n);
+        if (p) break;
+        added++;
+    }
+    return added;
+}
+
+void *pmm_alloc_zeroed(void) {
+    mcs_node_t n;
+    mcs_lock(&pmm_lock, &n);
+    void *p = zero_pool_count ? zero_pool[--zero_pool_count] : NULL;
+    if (p) pmm_zero_hits++;
+    else pmm_zero_misses++;
+    mcs_unlock(&pmm_lock, &n);
+    if (p) return p;
+    p = pmm_alloc();
+    if (p) memset(phys_to_virt((uint64_t)p), 0, PAGE_SIZE);
+    return p;
+}
+
+void pmm_cache_drain(void) {
+    preempt_disable();
+    cache_drain_to(&pmm_caches[this_cpu()], 0);
+    preempt_enable();
+}
 
-void pmm_self_test(void) { void *a = pmm_alloc(); if (!a) PANIC("pmm_self_test: alloc failed"); pmm_free(a); }
+static uint16_t *frame_ref(void *p, const char *who) {
+    uint64_t addr = (uint64_t)p;
+    if (addr < pmm_state.phys_start || addr >= pmm_state.phys_end || addr % PAGE_SIZE) PANIC("%s: bad addr 0x%llx", who, addr);
+    return &pmm_state.refs[(addr - pmm_state.phys_start) / PAGE_SIZE];
+}
 
-void print_pmm_metrics(void) { }
-void pmm_print_memory_map(void) { }
+void pmm_frame_ref(void *p) {
+    if (__atomic_fetch_add(frame_ref(p, "pmm_frame_ref"), 1, __ATOMIC_RELAXED) >= REF_CACHED - 1)
+        PANIC("pmm_frame_ref: too many owners of 0x%llx", (uint64_t)p);
+}
+
+/* The CAS loop keeps two owners dropping the last two references at once
+ * from both seeing a shared frame (or both freeing it). */
+size_t pmm_frame_unref(void *p) {
+    uint16_t *r = frame_ref(p, "pmm_frame_unref");
+    uint16_t old = __atomic_load_n(r, __ATOMIC_ACQUIRE);
+    while (old && !__atomic_compare_exchange_n(r, &old, old - 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {}
+    if (old == 0) pmm_free(p);
+    return old;
+}
 
+size_t pmm_frame_owners(void *p) { return (size_t)__atomic_load_n(frame_ref(p, "pmm_frame_owners"), __ATOMIC_ACQUIRE) + 1; }
 
+void pmm_cache_set_watermarks(size_t low, size_t high) {
+    if (high > PMM_CACHE_SIZE - 1) high = PMM_CACHE_SIZE - 1;
+    if (high == 0) high = 1;
+    if (low == 0) low = 1;
+    if (low > high) low = high;
+    pmm_cache_low = low;
+    pmm_cache_high = high;
+    PMMCpuCache *c = &pmm_caches[this_cpu()];
+    if (c->count > high) cache_drain_to(c, low);
+}
+
+void pmm_get_latency(pmm_latency_t *alloc, pmm_latency_t *free) {
+    memset(alloc, 0, sizeof(*alloc));
+    memset(free, 0, sizeof(*free));
+    for (unsigned i = 0; i < PMM_MAX_CPUS; i++) {
+        hist_merge(alloc, &pmm_caches[i].alloc_lat);
+        hist_merge(free, &pmm_caches[i].free_lat);
+    }
+}
+
+void pmm_collect_metrics(void) {
+    pmm_latency_t a, f;
+    uint64_t ha = 0, hf = 0, r = 0, d = 0;
+    pmm_get_latency(&a, &f);
+    for (unsigned i = 0; i < PMM_MAX_CPUS; i++) {
+        PMMCpuCache *c = &pmm_caches[i];
+        ha += c->hits_alloc; hf += c->hits_free; r += c->refills; d += c->drains;
+    }
+    pmm_calls_alloc = a.count; pmm_cycles_alloc = a.sum;
+    pmm_calls_free = f.count; pmm_cycles_free = f.sum;
+    pmm_cache_hits_alloc = ha; pmm_cache_hits_free = hf;
+    pmm_cache_refills = r; pmm_cache_drains = d;
+}
+
+void pmm_reset_metrics(void) {
+    for (unsigned i = 0; i < PMM_MAX_CPUS; i++) {
+        PMMCpuCache *c = &pmm_caches[i];
+        memset(&c->alloc_lat, 0, sizeof(c->alloc_lat));
+        memset(&c->free_lat, 0, sizeof(c->free_lat));
+        c->hits_alloc = c->hits_free = c->refills = c->drains = 0;
+    }
+    pmm_zero_hits = pmm_zero_misses = 0;
+    pmm_collect_metrics();
+}
+
+void pmm_free_order(void *p, unsigned order) {
+    if (order > PMM_MAX_ORDER) PANIC("pmm_free_order: bad order %u", order);
+    mcs_node_t node;
+    mcs_lock(&pmm_lock, &node);
+    switch (pmm_state.type) {
+        case PMM_BITMAP_COARSE: free_coarse(p); break;
+        case PMM_BUDDY: free_buddy(p, order); break;
+        default: {
+            uint64_t addr = (uint64_t)p;
+            size_t n = (size_t)1 << order;
+            if (addr < pmm_state.phys_start || addr + n * PAGE_SIZE > pmm_state.phys_end) PANIC("pmm_free_order: bad addr 0x%llx", addr);
+            if (addr % ((uint64_t)PAGE_SIZE << order)) PANIC("pmm_free_order: unaligned 0x%llx", addr);
+            size_t idx = (addr - pmm_state.phys_start) / PAGE_SIZE;
+            size_t freed = bm_fill(idx, idx + n, 0);
+            pmm_state.used_pages -= freed;
+            if (freed != n) PANIC("pmm_free_order: double free in 0x%llx order %u", addr, order);
+        } break;
+    }
+    mcs_unlock(&pmm_lock, &node);
+}
+
+void pmm_free_contig(void *p, size_t n) {
+    uint64_t addr = (uint64_t)p;
+    if (n == 0) return;
+    if (addr < pmm_state.phys_start || addr + (uint64_t)n * PAGE_SIZE > pmm_state.phys_end) PANIC("pmm_free_contig: bad range 0x%llx +%lu", addr, (unsigned long)n);
+    if (addr % PAGE_SIZE) PANIC("pmm_free_contig: unaligned 0x%llx", addr);
+    size_t idx = (addr - pmm_state.phys_start) / PAGE_SIZE;
+    mcs_node_t node;
+    mcs_lock(&pmm_lock, &node);
+    switch (pmm_state.type) {
+        case PMM_BITMAP_COARSE: {
+            if (idx % BLOCK_SIZE) PANIC("pmm_free_contig: 0x%llx is not a block start", addr);
+            size_t b = idx / BLOCK_SIZE, blocks = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+            size_t freed = bm_fill(b, b + blocks, 0);
+            pmm_state.used_pages -= freed * BLOCK_SIZE;
+            if (freed != blocks) PANIC("pmm_free_contig: double free in 0x%llx", addr);
+        } break;
+        case PMM_BUDDY: {
+            /* Whole-block runs were handed out like pmm_alloc_order() blocks. */
+            if (pmm_state.buddy_state[idx] != BUDDY_CONTIG) {
+                if (n & (n - 1)) PANIC("pmm_free_contig: 0x%llx was not allocated as %lu pages", addr, (unsigned long)n);
+                free_buddy(p, (unsigned)__builtin_ctzll(n));
+                break;
+            }
+            pmm_state.buddy_state[idx] = 0;
+            buddy_free_range(idx, idx + n);
+        } break;
+        default: {
+            size_t freed = bm_fill(idx, idx + n, 0);
+            pmm_state.used_pages -= freed;
+            if (freed != n) PANIC("pmm_free_contig: double free in 0x%llx", addr);
+        } break;
+    }
+    mcs_unlock(&pmm_lock, &node);
+}
+
+const char *pmm_zone_name(pmm_zone_t zone) {
+    switch (zone) {
+        case PMM_ZONE_DMA: return "DMA";
+        case PMM_ZONE_DMA32: return "DMA32";
+        default: return "Normal";
+    }
+}
+
+size_t pmm_zone_pages(pmm_zone_t zone) {
+    if ((unsigned)zone >= PMM_ZONE_COUNT) return 0;
+    return pmm_state.zone_start[zone + 1] - pmm_state.zone_start[zone];
+}
+
+static size_t zone_free_pages(pmm_zone_t zone) {
+    size_t n = 0;
+    if (pmm_state.type == PMM_BUDDY) {
+        for (unsigned o = 0; o <= PMM_MAX_ORDER; o++)
+            for (uint32_t i = pmm_state.free_head[zone][o]; i != BUDDY_NONE; i = pmm_state.buddy_next[i]) n += (size_t)1 << o;
+        return n;
+    }
+    size_t hi = zone_unit_hi(zone);
+    for (size_t i = bm_find_free(zone_unit_lo(zone)); i < hi;) {
+        size_t end = bm_find_used(i, hi);
+        if (end == BM_NONE) end = hi;
+        n += end - i;
+        i = bm_find_free(end);
+    }
+    return n * bm_unit();
+}
+
+size_t pmm_zone_free_pages(pmm_zone_t zone) {
+    if ((unsigned)zone >= PMM_ZONE_COUNT) return 0;
+    mcs_node_t node;
+    mcs_lock(&pmm_lock, &node);
+    size_t n = zone_free_pages(zone);
+    mcs_unlock(&pmm_lock, &node);
+    return n;
+}
+
+void pmm_self_test(void) {
+    void *a = pmm_alloc(); if (!a) PANIC("pmm_self_test: alloc failed"); pmm_free(a);
+    void *b = pmm_alloc_order(2);
+    if (b) { if ((uint64_t)b % (4 * PAGE_SIZE)) PANIC("pmm_self_test: order-2 block 0x%llx unaligned", (uint64_t)b); pmm_free_order(b, 2); }
+    void *z = pmm_alloc_zeroed();
+    if (!z) PANIC("pmm_self_test: zeroed alloc failed");
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++)
+        if (((uint64_t *)phys_to_virt((uint64_t)z))[i]) PANIC("pmm_self_test: frame 0x%llx not zeroed", (uint64_t)z);
+    pmm_free(z);
+    void *c = pmm_alloc_contig(3, PMM_ZONE_DMA32_LIMIT, 0x10000);
+    if (c) {
+        if ((uint64_t)c % 0x10000 || (uint64_t)c + 3 * PAGE_SIZE > PMM_ZONE_DMA32_LIMIT) PANIC("pmm_self_test: contig run 0x%llx out of bounds", (uint64_t)c);
+        pmm_free_contig(c, 3);
+    }
+}
+
+/* Randomized stress run against the active policy: interleaves single-page,
+ * block and zone-limited contiguous allocations with frees, checking
+ * alignment, range and overlap, then verifies that every page is accounted
+ * for once everything is back. */
+#define PMM_TEST_SLOTS 256
+#define PMM_TEST_ROUNDS 20000
+
+enum { TEST_PAGE, TEST_ORDER, TEST_CONTIG };
+
+static void test_release(void *p, uint8_t kind, size_t n) {
+    if (kind == TEST_ORDER) pmm_free_order(p, (unsigned)__builtin_ctzll(n));
+    else if (kind == TEST_CONTIG) pmm_free_contig(p, n);
+    else pmm_free(p);
+}
+
+void pmm_run_tests(void) {
+    static void *addr[PMM_TEST_SLOTS];
+    static uint64_t len[PMM_TEST_SLOTS];
+    static uint32_t pages[PMM_TEST_SLOTS];
+    static uint8_t kind[PMM_TEST_SLOTS];
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    size_t live = 0;
+    pmm_cache_drain();
+    size_t free_before = pmm_get_free_memory();
+    unsigned max_order = pmm_state.type == PMM_BITMAP_COARSE ? BLOCK_ORDER : 4;
+    uint64_t unit_bytes = (uint64_t)bm_unit() * PAGE_SIZE;
+
+    for (unsigned round = 0; round < PMM_TEST_ROUNDS; round++) {
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        if (live < PMM_TEST_SLOTS && (seed & 1 || live == 0)) {
+            unsigned pick = (unsigned)((seed >> 8) % 8);
+            uint8_t k = pick == 0 ? TEST_CONTIG : pick < 3 ? TEST_ORDER : TEST_PAGE;
+            size_t n = 1;
+            uint64_t align = PAGE_SIZE, limit = pmm_state.phys_end;
+            void *p;
+            if (k == TEST_CONTIG) {
+                n = 1 + (size_t)((seed >> 16) % 48);
+                align = (uint64_t)PAGE_SIZE << ((seed >> 24) % 6);
+                limit = (seed >> 32) & 1 ? PMM_ZONE_DMA_LIMIT : PMM_ZONE_DMA32_LIMIT;
+                p = pmm_alloc_contig(n, limit, align);
+            } else if (k == TEST_ORDER) {
+                n = (size_t)1 << (1 + (seed >> 16) % max_order);
+                align = (uint64_t)n * PAGE_SIZE;
+                p = pmm_alloc_order((unsigned)__builtin_ctzll(n));
+            } else {
+                p = pmm_alloc();
+            }
+            if (!p) continue;
+            uint64_t a = (uint64_t)p, l = (uint64_t)n * PAGE_SIZE;
+            if (pmm_state.type == PMM_BITMAP_COARSE) l = (l + unit_bytes - 1) / unit_bytes * unit_bytes;
+            if (a % align || a < pmm_state.phys_start || a + l > pmm_state.phys_end || a + (uint64_t)n * PAGE_SIZE > limit)
+                PANIC("pmm_run_tests: bad block 0x%llx (%lu pages)", a, (unsigned long)n);
+            for (size_t i = 0; i < live; i++) {
+                uint64_t b = (uint64_t)addr[i];
+                if (a < b + len[i] && b < a + l) PANIC("pmm_run_tests: 0x%llx overlaps 0x%llx", a, b);
+            }
+            addr[live] = p; len[live] = l; pages[live] = (uint32_t)n; kind[live] = k; live++;
+        } else {
+            size_t j = (size_t)((seed >> 24) % live);
+            test_release(addr[j], kind[j], pages[j]);
+            live--; addr[j] = addr[live]; len[j] = len[live]; pages[j] = pages[live]; kind[j] = kind[live];
+        }
+    }
+    while (live) { live--; test_release(addr[live], kind[live], pages[live]); }
+    pmm_cache_drain();
+    if (pmm_get_free_memory() != free_before)
+        PANIC("pmm_run_tests: leaked %llu bytes", (unsigned long long)(free_before - pmm_get_free_memory()));
+    LOG_INFO("pmm: run_tests passed (%s)", pmm_get_type_name(pmm_state.type));
+}
+
+/* Free-space fragmentation as seen by the policy; frames parked in per-CPU
+ * caches count as used here. */
+static void fragmentation(pmm_frag_t *out) {
+    if (pmm_state.type == PMM_BUDDY) {
+        size_t run = 0;
+        for (size_t i = 0; i < pmm_state.total_pages;) {
+            uint8_t st = pmm_state.buddy_state[i];
+            size_t n = (size_t)1 << (st & BUDDY_ORDER_MASK);
+            if (st & BUDDY_FREE) {
+                if (!run) out->free_runs++;
+                run += n;
+                out->free_pages += n;
+                out->free_blocks[st & BUDDY_ORDER_MASK]++;
+                if (run > out->largest_free_run) out->largest_free_run = run;
+            } else {
+                run = 0;
+            }
+            i += n;
+        }
+        return;
+    }
+    size_t unit = pmm_state.type == PMM_BITMAP_COARSE ? BLOCK_SIZE : 1;
+    for (size_t i = bm_find_free(0); i != BM_NONE;) {
+        size_t end = bm_find_used(i, pmm_state.bm_bits);
+        if (end == BM_NONE) end = pmm_state.bm_bits;
+        size_t run = (end - i) * unit;
+        out->free_runs++;
+        out->free_pages += run;
+        if (run > out->largest_free_run) out->largest_free_run = run;
+        i = bm_find_free(end);
+    }
+}
+
+void pmm_get_fragmentation(pmm_frag_t *out) {
+    mcs_node_t node;
+    memset(out, 0, sizeof(*out));
+    mcs_lock(&pmm_lock, &node);
+    fragmentation(out);
+    mcs_unlock(&pmm_lock, &node);
+}
+
+static void print_latency(const char *what, const pmm_latency_t *l) {
+    LOG_INFO("pmm: %s calls=%lu avg=%lu p50<=%lu p99<=%lu max=%lu cycles", what,
+             (unsigned long)l->count, (unsigned long)(l->count ? l->sum / l->count : 0),
+             (unsigned long)hist_percentile(l, 50), (unsigned long)hist_percentile(l, 99),
+             (unsigned long)l->max);
+    for (unsigned b = 0; b < HIST_BUCKETS; b++)
+        if (l->hist[b]) LOG_INFO("pmm:   %s [%lu, %lu) %lu", what, 1UL << b, b == 63 ? ~0UL : 2UL << b, (unsigned long)l->hist[b]);
+}
+
+void print_pmm_metrics(void) {
+    pmm_latency_t a, f;
+    pmm_frag_t frag;
+    pmm_collect_metrics();
+    pmm_get_latency(&a, &f);
+    pmm_get_fragmentation(&frag);
+    LOG_INFO("pmm: policy=%s used=%lu KiB free=%lu KiB", pmm_get_type_name(pmm_state.type),
+             (unsigned long)(pmm_get_used_memory() / 1024), (unsigned long)(pmm_get_free_memory() / 1024));
+    print_latency("alloc", &a);
+    print_latency("free", &f);
+    LOG_INFO("pmm: cache hits alloc=%lu free=%lu refills=%lu drains=%lu", (unsigned long)pmm_cache_hits_alloc,
+             (unsigned long)pmm_cache_hits_free, (unsigned long)pmm_cache_refills, (unsigned long)pmm_cache_drains);
+    LOG_INFO("pmm: zero pool %lu frames, hits=%lu misses=%lu", (unsigned long)zero_pool_count,
+             (unsigned long)pmm_zero_hits, (unsigned long)pmm_zero_misses);
+    LOG_INFO("pmm: init %lu cycles, deferred release %lu cycles, %lu KiB still deferred", (unsigned long)pmm_init_cycles,
+             (unsigned long)pmm_deferred_cycles, (unsigned long)(pmm_deferred_remaining() / 1024));
+    LOG_INFO("pmm: fragmentation free_runs=%lu largest_run=%lu pages free=%lu pages", (unsigned long)frag.free_runs,
+             (unsigned long)frag.largest_free_run, (unsigned long)frag.free_pages);
+    if (pmm_state.type == PMM_BUDDY)
+        for (unsigned o = 0; o <= PMM_MAX_ORDER; o++)
+            if (frag.free_blocks[o]) LOG_INFO("pmm:   order %u free blocks %lu", o, (unsigned long)frag.free_blocks[o]);
+}
+
+void pmm_print_memory_map(void) {
+    LOG_INFO("pmm: managing 0x%lx-0x%lx (%lu pages), policy=%s", (unsigned long)pmm_state.phys_start,
+             (unsigned long)pmm_state.phys_end, (unsigned long)pmm_state.total_pages, pmm_get_type_name(pmm_state.type));
+    LOG_INFO("pmm: kernel 0x%lx-0x%lx, metadata at 0x%lx, %lu bytes", (unsigned long)pmm_state.kernel_start,
+             (unsigned long)pmm_state.kernel_end, (unsigned long)pmm_state.meta_phys, (unsigned long)pmm_state.meta_bytes);
+    LOG_INFO("pmm: init took %lu cycles, %lu KiB deferred (%lu cycles spent releasing so far)", (unsigned long)pmm_init_cycles,
+             (unsigned long)(pmm_deferred_remaining() / 1024), (unsigned long)pmm_deferred_cycles);
+    for (int z = 0; z < PMM_ZONE_COUNT; z++) {
+        if (!pmm_zone_pages(z)) continue;
+        LOG_INFO("pmm: zone %s 0x%lx-0x%lx, %lu pages, %lu free", pmm_zone_name(z),
+                 (unsigned long)(pmm_state.phys_start + pmm_state.zone_start[z] * PAGE_SIZE),
+                 (unsigned long)(pmm_state.phys_start + pmm_state.zone_start[z + 1] * PAGE_SIZE),
+                 (unsigned long)pmm_zone_pages(z), (unsigned long)pmm_zone_free_pages(z));
+    }
+}
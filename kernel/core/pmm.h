@@ -3,13 +3,18 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include "core/hist.h"
 
 #define PAGE_SIZE 4096
 
+/* Largest block order handed out by pmm_alloc_order(): 2^10 pages = 4 MiB */
+#define PMM_MAX_ORDER 10
+
 /* PMM types */
 typedef enum {
     PMM_BITMAP_FINE,    // 1 bit per page (original)
-    PMM_BITMAP_COARSE   // 1 bit per block of pages (coarse-grained)
+    PMM_BITMAP_COARSE,  // 1 bit per block of pages (coarse-grained)
+    PMM_BUDDY           // power-of-two blocks on per-order free lists
 } pmm_type_t;
 
 /* Physical memory region descriptor used by pmm_init_from_map().
@@ -21,16 +26,120 @@ typedef struct {
     uint32_t type; /* 1 = usable */
 } phys_mem_region_t;
 
+/* Virtual offset at which the kernel reaches physical memory. The boot page
+ * tables identity-map low memory, so this starts out as 0; vmm_init() moves
+ * it to the higher-half direct map. Everything that dereferences a frame
+ * returned by the PMM must go through phys_to_virt(). */
+extern uint64_t pmm_hhdm_offset;
+static inline void *phys_to_virt(uint64_t paddr) { return (void*)(paddr + pmm_hhdm_offset); }
+static inline uint64_t virt_to_phys(const void *vaddr) { return (uint64_t)vaddr - pmm_hhdm_offset; }
+
 /* --- Core Public API --- */
 void pmm_init(pmm_type_t type);
 void* pmm_alloc(void);
 void pmm_free(void* p_addr);
 
+/* Allocate 2^order physically contiguous pages, naturally aligned to the
+ * block size. Returns NULL if no such block is free. The block must be
+ * released with pmm_free_order() using the same order. O(log n) with
+ * PMM_BUDDY; the bitmap policies fall back to a scan (coarse only serves
+ * orders that fit in one of its blocks). */
+void* pmm_alloc_order(unsigned order);
+void pmm_free_order(void* p_addr, unsigned order);
+
+/* Physical memory zones. Every allocation is served from the highest zone
+ * it may use, so the small low zones stay available for devices that can
+ * only address them. */
+typedef enum {
+    PMM_ZONE_DMA,       // below 16 MiB (ISA DMA)
+    PMM_ZONE_DMA32,     // below 4 GiB (32-bit DMA masks)
+    PMM_ZONE_NORMAL,    // everything above
+    PMM_ZONE_COUNT
+} pmm_zone_t;
+
+#define PMM_ZONE_DMA_LIMIT   0x1000000ULL
+#define PMM_ZONE_DMA32_LIMIT 0x100000000ULL
+
+/* One page from max_zone or a lower zone; release with pmm_free(). */
+void* pmm_alloc_zone(pmm_zone_t max_zone);
+
+/* Allocate n physically contiguous pages lying entirely below max_phys
+ * (0 = no limit), with the first page aligned to `align` bytes (a power of
+ * two; anything below PAGE_SIZE means page aligned). Returns NULL if no
+ * such run is free. Release with pmm_free_contig() and the same n.
+ * PMM_BUDDY serves up to 2^PMM_MAX_ORDER pages and returns the unused tail
+ * of the rounded-up block; PMM_BITMAP_COARSE rounds n up to whole blocks. */
+void* pmm_alloc_contig(size_t n, uint64_t max_phys, uint64_t align);
+void pmm_free_contig(void* p_addr, size_t n);
+
+const char* pmm_zone_name(pmm_zone_t zone);
+/* Pages spanned by a zone (holes included) and pages currently free in it
+ * (not counting per-CPU caches or deferred memory). */
+size_t pmm_zone_pages(pmm_zone_t zone);
+size_t pmm_zone_free_pages(pmm_zone_t zone);
+
 /* Initialize PMM from a firmware/bootloader memory map. The map is an
  * array of phys_mem_region_t; only entries with type==1 are treated as
- * usable RAM. */
+ * usable RAM. The PMM's own metadata is carved out of a usable region
+ * below 1 GiB (the boot identity map), clear of the kernel image. */
 void pmm_init_from_map(const phys_mem_region_t *map, size_t entries, pmm_type_t type);
 
+/* Physical extent of the kernel image, kept out of the allocator. Call
+ * before pmm_init_from_map(); defaults to [1 MiB, 3 MiB). */
+void pmm_set_kernel_range(uint64_t start, uint64_t end);
+
+/* Move phys_to_virt() to a new direct-map offset. Called by the VMM once
+ * its higher-half direct map is live. */
+void pmm_set_hhdm_offset(uint64_t offset);
+
+/* Per-CPU page caches sitting in front of pmm_alloc()/pmm_free(). An empty
+ * cache is refilled from the global allocator with `low` frames in one
+ * batch; a cache that grows past `high` is drained back down to `low`. */
+#define PMM_MAX_CPUS 16
+#define PMM_CACHE_SIZE 128
+#define PMM_CACHE_LOW_DEFAULT 16
+#define PMM_CACHE_HIGH_DEFAULT 64
+void pmm_cache_set_watermarks(size_t low, size_t high);
+/* Return every frame cached by the calling CPU to the global allocator. */
+void pmm_cache_drain(void);
+
+/* Deferred initialization. pmm_init_from_map() hands only the first part
+ * of usable RAM to the allocator and queues the rest. Queued memory is
+ * released PMM_DEFER_CHUNK_PAGES at a time when an allocation would fail,
+ * or ahead of time by calling pmm_deferred_init_step() from idle context.
+ * Deferred memory counts as free in the statistics below. */
+#define PMM_DEFER_CHUNK_PAGES 8192   // 32 MiB
+/* Release up to ~max_pages of deferred memory; returns pages released. */
+size_t pmm_deferred_init_step(size_t max_pages);
+void pmm_deferred_init_all(void);
+size_t pmm_deferred_remaining(void);
+
+/* Pre-zeroed frames. pmm_zero_idle_work() tops up a pool of up to
+ * PMM_ZERO_POOL_SIZE frames from idle context, clearing them with
+ * non-temporal stores. pmm_alloc_zeroed() takes from that pool and only
+ * clears a frame synchronously when the pool is empty; release the frame
+ * with pmm_free(). Pooled frames count as free in the statistics below. */
+#define PMM_ZERO_POOL_SIZE 256      // 1 MiB
+#define PMM_ZERO_BATCH 16           // frames per idle-loop pass
+void* pmm_alloc_zeroed(void);
+/* Zero up to max_frames frames into the pool; returns frames added. */
+size_t pmm_zero_idle_work(size_t max_frames);
+extern uint64_t pmm_zero_hits;
+extern uint64_t pmm_zero_misses;
+
+/* Frames shared by several address spaces (copy-on-write). A frame fresh
+ * from the allocator has one owner. pmm_frame_ref() adds an owner;
+ * pmm_frame_unref() drops one, frees the frame when it was the last, and
+ * returns the owners left. Costs 2 bytes of metadata per page. */
+void pmm_frame_ref(void* p_addr);
+size_t pmm_frame_unref(void* p_addr);
+size_t pmm_frame_owners(void* p_addr);
+
+/* Boot-time cost: TSC cycles spent in pmm_init_from_map() and in deferred
+ * release steps since. */
+extern uint64_t pmm_init_cycles;
+extern uint64_t pmm_deferred_cycles;
+
 /* Statistics & Testing */
 size_t pmm_get_total_memory(void);
 size_t pmm_get_used_memory(void);
@@ -45,12 +154,38 @@ extern uint64_t pmm_cycles_alloc;
 extern uint64_t pmm_calls_alloc;
 extern uint64_t pmm_cycles_free;
 extern uint64_t pmm_calls_free;
+extern uint64_t pmm_cache_hits_alloc;
+extern uint64_t pmm_cache_hits_free;
+extern uint64_t pmm_cache_refills;
+extern uint64_t pmm_cache_drains;
+
+/* Fold the per-CPU counters into the globals above. */
+void pmm_collect_metrics(void);
+void pmm_reset_metrics(void);
+
+/* Latency of pmm_alloc()/pmm_free() in TSC cycles. With PMM_METRICS=0
+ * only `count` is kept. */
+typedef hist_t pmm_latency_t;
+
+/* Sum of all CPUs' latency records. */
+void pmm_get_latency(pmm_latency_t *alloc, pmm_latency_t *free);
+
+typedef struct {
+    size_t free_pages;
+    size_t free_runs;          // maximal runs of physically contiguous free pages
+    size_t largest_free_run;   // in pages
+    size_t free_blocks[PMM_MAX_ORDER + 1]; // buddy only: free blocks per order
+} pmm_frag_t;
+
+void pmm_get_fragmentation(pmm_frag_t *out);
 
-/* Performance metrics */
+/* Performance metrics: latency histograms, cache and fragmentation stats
+ * dumped to the serial log. */
 void print_pmm_metrics(void);
 
 /* Help debug: run a small self-test after init */
 void pmm_self_test(void);
+/* Randomized alloc/free stress against the active policy; panics on error. */
 void pmm_run_tests(void);
 
 /* Declare the print_pmm_metrics function */
@@ -0,0 +1,25 @@
+#ifndef ORION_CORE_PREEMPT_H
+#define ORION_CORE_PREEMPT_H
+
+#include "core/percpu.h"
+
+/* Preemption counter. While it is non-zero the timer does not switch
+ * tasks; a tick that wants to only marks the task for rescheduling and the
+ * switch happens on a later tick. Per-CPU and shared allocator state (PMM
+ * page caches, zero pool, slab lists) is only touched with it raised.
+ *
+ * The counter lives in the per-CPU block. A task cannot move to another
+ * CPU while it holds the counter up, so it behaves as the task's own. */
+static inline void preempt_disable(void) {
+    percpu_add(preempt_count, 1);
+    __asm__ volatile ("" ::: "memory");
+}
+
+static inline void preempt_enable(void) {
+    __asm__ volatile ("" ::: "memory");
+    percpu_add(preempt_count, -1);
+}
+
+static inline int preemptible(void) { return percpu_read(preempt_count) == 0; }
+
+#endif /* ORION_CORE_PREEMPT_H */
@@ -1,18 +1,92 @@
 #include "core/process.h"
 #include "core/pmm.h"
+#include "core/slab.h"
+#include "core/lock.h"
+#include "core/rcu.h"
 #include <stdint.h>
 #include <stdatomic.h>
 
 // Global variable to track the next PID
 static atomic_int next_pid = 2;
 
+// PID hash table: readers walk the chains under RCU, writers serialise on
+// pid_lock and never change a link a reader may still follow.
+static Process *pid_table[PROCESS_PID_BUCKETS];
+static ticket_lock_t pid_lock = TICKET_LOCK_INIT("pid table");
+
+static inline Process **pid_bucket(int pid) { return &pid_table[(unsigned)pid % PROCESS_PID_BUCKETS]; }
+
+int process_create(Process *p, const char *name, void (*entry_point)(void)) {
+    vmm_space_t *space = kmalloc(sizeof(*space));
+    if (!space || vmm_space_create(space) != 0) {
+        kfree(space);
+        return -1;
+    }
+    uint64_t stack = vmm_region_anon(space, VMM_USER_END - PROCESS_STACK_SIZE, PROCESS_STACK_SIZE, VMM_WRITE);
+    if (!stack) {
+        vmm_space_destroy(space);
+        kfree(space);
+        return -1;
+    }
+    *p = (Process){
+        .name = name,
+        .pid = atomic_fetch_add(&next_pid, 1),
+        .entry_point = entry_point,
+        .stack_pointer = stack + PROCESS_STACK_SIZE,
+        .space = space
+    };
+    return 0;
+}
+
 // Fork function to create a child process
 Process fork(Process *parent) {
-    void* p = pmm_alloc();
+    vmm_space_t *space = kmalloc(sizeof(*space));
+    if (!space || vmm_space_clone(space, parent->space ? parent->space : vmm_kernel_space()) != 0) {
+        kfree(space);
+        return (Process){ .pid = -1 };
+    }
     return (Process){
-        .pid = p ? atomic_fetch_add(&next_pid, 1) : -1,
-        .cpuid = p ? parent->cpuid : 0,
-        .entry_point = p ? parent->entry_point : 0,
-        .stack_pointer = p ? (uint64_t)p + PAGE_SIZE : 0
+        .name = parent->name,
+        .pid = atomic_fetch_add(&next_pid, 1),
+        .cpuid = parent->cpuid,
+        .entry_point = parent->entry_point,
+        .stack_pointer = parent->stack_pointer,
+        .space = space,
+        .priority = parent->priority
     };
 }
+
+void process_destroy(Process *p) {
+    if (!p->space) return;
+    vmm_space_destroy(p->space);
+    kfree(p->space);
+    p->space = NULL;
+}
+
+void process_publish(Process *p) {
+    Process **b = pid_bucket(p->pid);
+    ticket_lock(&pid_lock);
+    p->pid_next = *b;
+    rcu_assign_pointer(*b, p);
+    ticket_unlock(&pid_lock);
+}
+
+// p keeps its own link, so a reader standing on it still reaches the rest
+// of the chain.
+void process_unpublish(Process *p) {
+    ticket_lock(&pid_lock);
+    for (Process **pp = pid_bucket(p->pid); *pp; pp = &(*pp)->pid_next) {
+        if (*pp == p) {
+            rcu_assign_pointer(*pp, p->pid_next);
+            break;
+        }
+    }
+    ticket_unlock(&pid_lock);
+    synchronize_rcu();
+}
+
+Process *process_lookup(int pid) {
+    for (Process *p = rcu_dereference(*pid_bucket(pid)); p; p = rcu_dereference(p->pid_next))
+        if (p->pid == pid) return p;
+    return NULL;
+}
@@ -2,15 +2,60 @@
 #define PROCESS_H
 
 #include <stdint.h>
+#include "arch/x86_64/mm/vmm.h"
+#include "core/timer.h"
 
-typedef struct {
+typedef enum {
+    PROCESS_READY,      // on a run queue (or not yet spawned)
+    PROCESS_RUNNING,
+    PROCESS_SLEEPING,   // off the run queues until its wake timer fires
+    PROCESS_DEAD        // exited; its kernel stack goes once it is switched away from
+} process_state_t;
+
+typedef struct Process {
     const char *name;
     int pid; // Process ID
-    int cpuid; // CPU core ID
+    int cpuid; // CPU core ID; the run queue the scheduler keeps it on
     void (*entry_point)(void);
     uint64_t stack_pointer; // Top of the stack
+    vmm_space_t *space; // Address space; NULL runs in the kernel space
+
+    /* Scheduler state, see core/sched.h */
+    process_state_t state;
+    int priority;           // 0 .. SCHED_PRIORITIES-1, higher runs first
+    int slice;              // timer ticks left before preemption
+    int on_cpu;             // its registers are live on a CPU (or being saved)
+    uint64_t kstack;        // base of its kernel stack, 0 for the boot thread
+    uint64_t context;       // saved kernel rsp while switched out
+    void *fpu;              // x87/SSE save area, allocated on first FPU use
+    ktimer_t wake;          // sched_sleep_ns()
+    struct Process *next;   // run queue link
+    struct Process *pid_next;   // PID table chain, see process_lookup()
 } Process;
 
+/* User stack reserved for every new process at the top of its user half.
+ * It is demand-paged, so only the pages actually touched get frames. */
+#define PROCESS_STACK_SIZE (8ULL << 20)
+
+/* Set up a process with a fresh address space holding only its stack
+ * region. Returns 0, or -1 when out of memory. */
+int process_create(Process *p, const char *name, void (*entry_point)(void));
+
+/* Clone `parent`. The child gets a copy-on-write clone of the parent's
+ * address space and the same stack pointer, so nothing is copied until
+ * either side writes. Returns a Process with pid -1 when out of memory. */
 Process fork(Process *parent);
 
+/* Release the address space of a process that is not running. */
+void process_destroy(Process *p);
+
+/* PID table. Lookups take no lock: call process_lookup() inside
+ * rcu_read_lock(), and the Process it returns stays valid until
+ * rcu_read_unlock(). process_unpublish() waits for a grace period, so the
+ * caller may free the Process once it returns. */
+#define PROCESS_PID_BUCKETS 64
+void process_publish(Process *p);
+void process_unpublish(Process *p);
+Process *process_lookup(int pid);
+
 #endif // PROCESS_H
@@ -0,0 +1,125 @@
+#define LOG_CAT LOG_CAT_RCU
+#include "core/rcu.h"
+#include "core/percpu.h"
+#include "core/pmm.h"
+#include "core/slab.h"
+#include "core/sched.h"
+#include "core/log.h"
+#include "arch/x86_64/cpu.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define RCU_IDLE UINT64_MAX     // `seen` of a halted CPU: past every grace period
+
+/* Per-CPU state, one cache line each: `seen` is written by its CPU on
+ * every tick and read by everyone waiting for a grace period. The callback
+ * list is only touched by its own CPU, with interrupts off. */
+typedef struct {
+    volatile uint64_t seen;     // latest grace period this CPU was quiescent in
+    struct rcu_head *head;      // callbacks in queueing order, so `gp` ascends
+    struct rcu_head **tail;
+    uint64_t pending;
+    uint64_t invoked;
+} __attribute__((aligned(64))) rcu_cpu_t;
+
+/* Number of the most recently started grace period. Starting one is just
+ * bumping it; CPUs notice by copying it into `seen`. */
+static uint64_t rcu_gp = 1;
+static uint32_t rcu_online;     // CPUs that report quiescent states
+static rcu_cpu_t rcu_cpus[PERCPU_MAX_CPUS];
+
+static int gp_done(uint64_t gp) {
+    uint32_t m = __atomic_load_n(&rcu_online, __ATOMIC_ACQUIRE);
+    for (; m; m &= m - 1)
+        if (__atomic_load_n(&rcu_cpus[__builtin_ctz(m)].seen, __ATOMIC_ACQUIRE) < gp) return 0;
+    return 1;
+}
+
+/* Start grace period `gp` unless it (or a later one) already has. */
+static void gp_start(uint64_t gp) {
+    uint64_t cur = __atomic_load_n(&rcu_gp, __ATOMIC_ACQUIRE);
+    while (cur < gp && !__atomic_compare_exchange_n(&rcu_gp, &cur, gp, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {}
+}
+
+void rcu_cpu_online(void) {
+    unsigned cpu = this_cpu();
+    rcu_cpu_t *rc = &rcu_cpus[cpu];
+    if (!rc->tail) rc->tail = &rc->head;
+    __atomic_store_n(&rc->seen, __atomic_load_n(&rcu_gp, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+    __atomic_fetch_or(&rcu_online, 1u << cpu, __ATOMIC_RELEASE);
+}
+
+/* x86 keeps loads ordered with later stores, so every load of the sections
+ * that ended here is done before `seen` moves, and a section starting after
+ * it sees whatever was unpublished before the grace period began. */
+void rcu_quiescent(void) {
+    rcu_cpu_t *rc = &rcu_cpus[this_cpu()];
+    uint64_t gp = __atomic_load_n(&rcu_gp, __ATOMIC_ACQUIRE);
+    if (rc->seen != gp) __atomic_store_n(&rc->seen, gp, __ATOMIC_RELEASE);
+}
+
+void rcu_idle_enter(void) {
+    __atomic_store_n(&rcu_cpus[this_cpu()].seen, RCU_IDLE, __ATOMIC_RELEASE);
+}
+
+void synchronize_rcu(void) {
+    if (!preemptible()) PANIC("synchronize_rcu: called with preempt_count %u", percpu_read(preempt_count));
+    uint64_t gp = __atomic_add_fetch(&rcu_gp, 1, __ATOMIC_ACQ_REL);
+    rcu_quiescent();
+    while (!gp_done(gp)) sched_yield();
+}
+
+/* The grace period a callback waits for is the one after the current one,
+ * so no atomic is needed here; rcu_work() starts it. */
+void call_rcu(struct rcu_head *head, rcu_callback_t func) {
+    head->func = func;
+    head->next = NULL;
+    uint64_t flags = arch_x86_irq_save();
+    rcu_cpu_t *rc = &rcu_cpus[this_cpu()];
+    if (!rc->tail) rc->tail = &rc->head;
+    head->gp = __atomic_load_n(&rcu_gp, __ATOMIC_ACQUIRE) + 1;
+    *rc->tail = head;
+    rc->tail = &head->next;
+    rc->pending++;
+    arch_x86_irq_restore(flags);
+}
+
+size_t rcu_work(size_t max) {
+    struct rcu_head *done = NULL, **done_tail = &done;
+    size_t n = 0;
+    uint64_t flags = arch_x86_irq_save();
+    rcu_cpu_t *rc = &rcu_cpus[this_cpu()];
+    while (rc->head && n < max && gp_done(rc->head->gp)) {
+        struct rcu_head *h = rc->head;
+        if (!(rc->head = h->next)) rc->tail = &rc->head;
+        *done_tail = h;
+        done_tail = &h->next;
+        n++;
+    }
+    *done_tail = NULL;
+    rc->pending -= n;
+    rc->invoked += n;
+    if (rc->head) gp_start(rc->head->gp);
+    arch_x86_irq_restore(flags);
+
+    while (done) {
+        struct rcu_head *h = done;
+        done = h->next;
+        uintptr_t f = (uintptr_t)h->func;
+        if (f < PAGE_SIZE) kfree((uint8_t *)h - f);
+        else h->func(h);
+    }
+    return n;
+}
+
+int rcu_pending(void) { return rcu_cpus[this_cpu()].pending != 0; }
+
+void rcu_print_stats(void) {
+    uint32_t m = __atomic_load_n(&rcu_online, __ATOMIC_ACQUIRE);
+    LOG_INFO("rcu: grace period %lu", (unsigned long)__atomic_load_n(&rcu_gp, __ATOMIC_ACQUIRE));
+    for (; m; m &= m - 1) {
+        const rcu_cpu_t *rc = &rcu_cpus[__builtin_ctz(m)];
+        LOG_INFO("rcu: cpu%u callbacks run=%lu pending=%lu", (unsigned)__builtin_ctz(m),
+                 (unsigned long)rc->invoked, (unsigned long)rc->pending);
+    }
+}
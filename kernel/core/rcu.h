@@ -0,0 +1,70 @@
+#ifndef ORION_CORE_RCU_H
+#define ORION_CORE_RCU_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "core/preempt.h"
+
+/* Read-copy-update for read-mostly tables, quiescent-state based.
+ *
+ * Readers take no lock and write nothing shared: a read-side section only
+ * raises preempt_count, so the task cannot be switched out inside it. A CPU
+ * that context-switches, takes a timer tick with preempt_count at zero, or
+ * goes idle is therefore past every section it had started, and reports a
+ * quiescent state by copying the global grace-period number. Updaters
+ * publish a new version with rcu_assign_pointer(), then either wait with
+ * synchronize_rcu() or queue the old version with call_rcu()/kfree_rcu().
+ * A grace period ends once every online CPU has reported after it began.
+ *
+ * Read-side sections must not block, yield or sleep. An idle CPU counts as
+ * quiescent while it halts, so interrupt handlers that can run in idle
+ * must not enter read-side sections. */
+struct rcu_head {
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *head);
+    uint64_t gp;                // grace period the callback waits for
+};
+
+typedef void (*rcu_callback_t)(struct rcu_head *head);
+
+#define RCU_TICK_BATCH 16       // callbacks a timer tick runs at most
+
+static inline void rcu_read_lock(void) { preempt_disable(); }
+static inline void rcu_read_unlock(void) { preempt_enable(); }
+
+/* Publish a fully initialised object, and read a pointer that may be
+ * republished concurrently. */
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_CONSUME)
+
+/* Wait for every read-side section running at the call to finish. Yields
+ * while it waits; must not be called with preempt_count raised. */
+void synchronize_rcu(void);
+
+/* Run func(head) from a later tick or idle loop on this CPU, after a grace
+ * period. head is normally embedded in the object being retired. */
+void call_rcu(struct rcu_head *head, rcu_callback_t func);
+
+/* kfree() ptr after a grace period; `field` is its struct rcu_head. The
+ * offset of the head travels in place of the callback; no function lives
+ * in the first page. */
+#define kfree_rcu(ptr, field) \
+    call_rcu(&(ptr)->field, (rcu_callback_t)(uintptr_t)offsetof(__typeof__(*(ptr)), field))
+
+/* Scheduler hooks. rcu_cpu_online() makes the calling CPU take part in
+ * grace periods. rcu_quiescent() reports a quiescent state; call it only
+ * outside read-side sections. rcu_idle_enter() marks the CPU quiescent
+ * until its next rcu_quiescent(); call it with interrupts disabled right
+ * before halting. rcu_work() runs up to max callbacks whose grace period
+ * is over and returns how many ran. */
+void rcu_cpu_online(void);
+void rcu_quiescent(void);
+void rcu_idle_enter(void);
+size_t rcu_work(size_t max);
+/* Whether this CPU has callbacks waiting; it keeps its tick until not. */
+int rcu_pending(void);
+
+/* Grace periods started, callbacks run and still pending, to the log. */
+void rcu_print_stats(void);
+
+#endif /* ORION_CORE_RCU_H */
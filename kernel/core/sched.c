@@ -0,0 +1,456 @@
+#define LOG_CAT LOG_CAT_SCHED
+#include "core/sched.h"
+#include "core/preempt.h"
+#include "core/lock.h"
+#include "core/rcu.h"
+#include "core/timer.h"
+#include "core/pmm.h"
+#include "core/slab.h"
+#include "core/log.h"
+#include "arch/x86_64/cpu.h"
+#include "arch/x86_64/mm/vmm.h"
+#include "arch/x86_64/interrupts/idt.h"
+#include "arch/x86_64/interrupts/lapic.h"
+#include "arch/x86_64/smp/smp.h"
+#include "arch/x86_64/sched/switch.h"
+#include "arch/x86_64/sched/fpu.h"
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+    ticket_lock_t lock;
+    uint32_t bitmap;                    // bit p set: head[p] is non-empty
+    Process *head[SCHED_PRIORITIES];
+    Process *tail[SCHED_PRIORITIES];
+    unsigned nr_ready;                  // queued, not counting current
+    Process *current;
+    Process *idle;
+    Process *prev;                      // handed from schedule() to finish_switch()
+    Process *fpu_owner;                 // whose FPU state is in the registers
+    int fpu_ts;                         // CR0.TS is set
+    int fpu_kernel;                     // inside sched_fpu_begin()
+    int need_resched;
+    uint64_t switch_start;              // TSC at entry of the schedule() in progress
+    ktimer_t tick;                      // armed while there is something to run
+    sched_switch_stats_t sw;
+    uint64_t steals;
+    uint64_t ticks;
+    uint64_t idle_ticks;
+    uint64_t fpu_traps;
+    uint64_t fpu_saves;
+} sched_rq_t;
+
+static sched_rq_t runqueues[SCHED_MAX_CPUS];
+static unsigned sched_cpus = 1;         // CPUs scheduling; APs join in sched_ap_main()
+static Process idle_tasks[SCHED_MAX_CPUS];
+static kmem_cache_t *fpu_cache;
+static size_t fpu_size;
+static uint64_t tick_cycles;            // TSC cycles per SCHED_HZ tick
+
+/* Queue locks are taken with interrupts disabled. */
+static inline void rq_lock(sched_rq_t *rq) { ticket_lock(&rq->lock); }
+static inline void rq_unlock(sched_rq_t *rq) { ticket_unlock(&rq->lock); }
+
+static void enqueue(sched_rq_t *rq, Process *p) {
+    int prio = p->priority;
+    p->next = NULL;
+    if (rq->tail[prio]) rq->tail[prio]->next = p;
+    else rq->head[prio] = p;
+    rq->tail[prio] = p;
+    rq->bitmap |= 1u << prio;
+    rq->nr_ready++;
+}
+
+static void unlink(sched_rq_t *rq, Process *p, Process *before) {
+    int prio = p->priority;
+    if (before) before->next = p->next;
+    else rq->head[prio] = p->next;
+    if (rq->tail[prio] == p) rq->tail[prio] = before;
+    if (!rq->head[prio]) rq->bitmap &= ~(1u << prio);
+    p->next = NULL;
+    rq->nr_ready--;
+}
+
+static inline int highest_ready(const sched_rq_t *rq) {
+    return rq->bitmap ? 31 - __builtin_clz(rq->bitmap) : -1;
+}
+
+static Process *dequeue(sched_rq_t *rq) {
+    int prio = highest_ready(rq);
+    if (prio < 0) return NULL;
+    Process *p = rq->head[prio];
+    unlink(rq, p, NULL);
+    return p;
+}
+
+/* Is there anything for `cpu` to run, on its own queue or to steal? The
+ * other queues are peeked at without their locks. */
+static int work_available(unsigned cpu) {
+    unsigned n = __atomic_load_n(&sched_cpus, __ATOMIC_ACQUIRE);
+    if (runqueues[cpu].nr_ready) return 1;
+    for (unsigned i = 0; i < n; i++)
+        if (i != cpu && runqueues[i].nr_ready) return 1;
+    return 0;
+}
+
+/* Wake `cpu` from its idle halt so it looks for work. Returns whether it
+ * was idle. */
+static int kick(unsigned cpu) {
+    sched_rq_t *rq = &runqueues[cpu];
+    if (cpu == this_cpu() || !rq->idle || rq->current != rq->idle) return 0;
+    arch_x86_smp_send_ipi(cpu, X86_VEC_RESCHED);
+    return 1;
+}
+
+/* A task was just queued on `cpu`: wake that CPU, or when it is this one,
+ * any idle CPU, which will steal it. */
+static void kick_for(unsigned cpu) {
+    unsigned n = __atomic_load_n(&sched_cpus, __ATOMIC_ACQUIRE);
+    if (cpu != this_cpu()) kick(cpu);
+    else for (unsigned i = 0; i < n && !kick(i); i++) {}
+}
+
+/* Take the best waiting task of the busiest other queue. A task whose
+ * registers are still being saved by the CPU that just queued it is
+ * skipped. */
+static Process *steal(unsigned cpu) {
+    sched_rq_t *busiest = NULL;
+    unsigned n = __atomic_load_n(&sched_cpus, __ATOMIC_ACQUIRE);
+    for (unsigned i = 0; i < n; i++) {
+        if (i == cpu) continue;
+        if (runqueues[i].nr_ready && (!busiest || runqueues[i].nr_ready > busiest->nr_ready))
+            busiest = &runqueues[i];
+    }
+    if (!busiest) return NULL;
+    Process *p = NULL;
+    rq_lock(busiest);
+    for (uint32_t bits = busiest->bitmap; bits && !p; bits &= ~(1u << (31 - __builtin_clz(bits)))) {
+        Process *before = NULL;
+        for (Process *q = busiest->head[31 - __builtin_clz(bits)]; q; before = q, q = q->next) {
+            /* Its FPU registers are live on the other CPU; leave it there. */
+            if (__atomic_load_n(&q->on_cpu, __ATOMIC_ACQUIRE) || q == busiest->fpu_owner) continue;
+            unlink(busiest, q, before);
+            p = q;
+            break;
+        }
+    }
+    rq_unlock(busiest);
+    if (p) {
+        p->cpuid = cpu;
+        runqueues[cpu].steals++;
+    }
+    return p;
+}
+
+/* First thing every task runs after being switched to. */
+static void finish_switch(void) {
+    sched_rq_t *rq = &runqueues[this_cpu()];
+    Process *prev = rq->prev;
+    hist_record(&rq->sw, arch_x86_rdtsc() - rq->switch_start);
+    __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
+    if (prev->state == PROCESS_DEAD) {
+        if (rq->fpu_owner == prev) rq->fpu_owner = NULL;
+        if (prev->fpu) {
+            kmem_cache_free(fpu_cache, prev->fpu);
+            prev->fpu = NULL;
+        }
+        if (prev->kstack) {
+            pmm_free_order((void *)virt_to_phys((void *)prev->kstack), SCHED_KSTACK_ORDER);
+            prev->kstack = 0;
+        }
+    }
+}
+
+/* #NM: the current task used the FPU while another task's state (or none)
+ * was in the registers. CR0.TS is already clear. */
+static void fpu_trap(void) {
+    sched_rq_t *rq = &runqueues[this_cpu()];
+    Process *cur = rq->current;
+    rq->fpu_ts = 0;
+    rq->fpu_traps++;
+    if (rq->fpu_owner == cur) return;
+    if (rq->fpu_owner) {
+        arch_x86_fpu_save(rq->fpu_owner->fpu);
+        rq->fpu_saves++;
+    }
+    if (!cur->fpu) {
+        if (!(cur->fpu = kmem_cache_alloc(fpu_cache))) PANIC("sched: no memory for FPU state of %s", cur->name);
+        arch_x86_fpu_init_area(cur->fpu);
+    }
+    arch_x86_fpu_restore(cur->fpu);
+    rq->fpu_owner = cur;
+}
+
+int sched_fpu_begin(void) {
+    uint64_t flags = arch_x86_irq_save();
+    sched_rq_t *rq = &runqueues[this_cpu()];
+    if (!fpu_cache || rq->fpu_kernel) {
+        arch_x86_irq_restore(flags);
+        return 0;
+    }
+    preempt_disable();
+    if (rq->fpu_ts) arch_x86_clts();
+    if (rq->fpu_owner) {
+        arch_x86_fpu_save(rq->fpu_owner->fpu);
+        rq->fpu_saves++;
+        rq->fpu_owner = NULL;
+    }
+    rq->fpu_ts = 0;
+    rq->fpu_kernel = 1;
+    arch_x86_irq_restore(flags);
+    return 1;
+}
+
+/* No task's state is in the registers any more, so the next FPU user
+ * traps and restores its own. */
+void sched_fpu_end(void) {
+    uint64_t flags = arch_x86_irq_save();
+    sched_rq_t *rq = &runqueues[this_cpu()];
+    arch_x86_stts();
+    rq->fpu_ts = 1;
+    rq->fpu_kernel = 0;
+    arch_x86_irq_restore(flags);
+    preempt_enable();
+}
+
+/* Tickless idle: the tick only runs while the CPU has a task, or RCU
+ * callbacks waiting for a grace period. An idle CPU sleeps until its next
+ * timer or an IPI. */
+static void tick_update(sched_rq_t *rq, Process *next) {
+    int want = next != rq->idle || rcu_pending();
+    if (want && !timer_armed(&rq->tick)) timer_arm(&rq->tick, arch_x86_rdtsc() + tick_cycles);
+    else if (!want && timer_armed(&rq->tick)) timer_cancel(&rq->tick);
+}
+
+/* Pick the next task and switch to it. Interrupts must be disabled. */
+static void schedule(void) {
+    unsigned cpu = this_cpu();
+    sched_rq_t *rq = &runqueues[cpu];
+    Process *prev = rq->current;
+    rq->switch_start = arch_x86_rdtsc();
+    rq->need_resched = 0;
+    rcu_quiescent();
+
+    rq_lock(rq);
+    if (prev->state == PROCESS_RUNNING && prev != rq->idle) {
+        prev->state = PROCESS_READY;
+        enqueue(rq, prev);
+    }
+    Process *next = dequeue(rq);
+    rq_unlock(rq);
+    if (!next) next = steal(cpu);
+    if (!next) next = rq->idle;
+
+    next->state = PROCESS_RUNNING;
+    next->slice = SCHED_SLICE_TICKS;
+    tick_update(rq, next);
+    if (next == prev) return;
+
+    next->on_cpu = 1;
+    vmm_space_t *from = prev->space ? prev->space : vmm_kernel_space();
+    vmm_space_t *to = next->space ? next->space : vmm_kernel_space();
+    if (from != to) vmm_activate(to);
+    /* Lazy FPU: only the owner may run with TS clear. */
+    int ts = next != rq->fpu_owner;
+    if (ts != rq->fpu_ts) {
+        if (ts) arch_x86_stts();
+        else arch_x86_clts();
+        rq->fpu_ts = ts;
+    }
+    rq->prev = prev;
+    rq->current = next;
+    percpu_write(current, next);
+    arch_x86_switch(&prev->context, next->context);
+    finish_switch();
+}
+
+static void thread_start(void) {
+    finish_switch();
+    arch_x86_irq_enable();
+    sched_current()->entry_point();
+    sched_exit();
+}
+
+/* The tick timer: interrupts are off. It only asks for a switch, which
+ * timer_irq() makes once every expired timer has run. */
+static void sched_tick(ktimer_t *t) {
+    sched_rq_t *rq = &runqueues[this_cpu()];
+    Process *cur = rq->current;
+    uint64_t next = t->expires + tick_cycles, now = arch_x86_rdtsc();
+    timer_arm(t, next > now ? next : now + tick_cycles);
+    rq->ticks++;
+    if (cur == rq->idle) {
+        rq->idle_ticks++;
+        if (work_available(this_cpu())) rq->need_resched = 1;
+    } else if (--cur->slice <= 0 || highest_ready(rq) > cur->priority) {
+        rq->need_resched = 1;
+    }
+    if (!preemptible()) return;
+    /* Not inside any read-side section: a quiescent state. */
+    rcu_quiescent();
+    rcu_work(RCU_TICK_BATCH);
+}
+
+/* A sleeping task's timer, on the CPU it went to sleep on. */
+static void wake_expired(ktimer_t *t) {
+    Process *p = (Process *)((uint8_t *)t - offsetof(Process, wake));
+    unsigned cpu = this_cpu();
+    sched_rq_t *rq = &runqueues[cpu];
+    p->cpuid = (int)cpu;
+    rq_lock(rq);
+    p->state = PROCESS_READY;
+    enqueue(rq, p);
+    rq_unlock(rq);
+    if (rq->current == rq->idle || p->priority > rq->current->priority) rq->need_resched = 1;
+    else kick_for(cpu);
+}
+
+/* Local timer interrupt, after the EOI. */
+static void timer_irq(void) {
+    timer_run_expired();
+    if (runqueues[this_cpu()].need_resched && preemptible()) schedule();
+}
+
+/* Another CPU queued work for this one or wants it to steal. */
+static void resched_ipi(arch_x86_regs_t *regs) {
+    (void)regs;
+    arch_x86_lapic_eoi();
+    runqueues[this_cpu()].need_resched = 1;
+    if (preemptible()) schedule();
+}
+
+/* Make the calling CPU's boot thread its idle task. */
+static void adopt_idle(unsigned cpu) {
+    Process *idle = &idle_tasks[cpu];
+    *idle = (Process){
+        .name = "idle",
+        .cpuid = (int)cpu,
+        .state = PROCESS_RUNNING,
+        .on_cpu = 1
+    };
+    runqueues[cpu].idle = idle;
+    runqueues[cpu].current = idle;
+    timer_setup(&runqueues[cpu].tick, sched_tick);
+    runqueues[cpu].fpu_ts = 1;
+    percpu_write(current, idle);
+    rcu_cpu_online();
+}
+
+int sched_init(void) {
+    for (unsigned i = 0; i < SCHED_MAX_CPUS; i++) ticket_lock_init(&runqueues[i].lock, "runqueue");
+    adopt_idle(0);
+    fpu_size = arch_x86_fpu_init(fpu_trap);
+    fpu_cache = kmem_cache_create("fpu", fpu_size, ARCH_X86_FPU_ALIGN, NULL);
+    if (!fpu_cache) PANIC("sched: cannot create the FPU state cache (%lu bytes)", (unsigned long)fpu_size);
+    arch_x86_set_handler(X86_VEC_RESCHED, resched_ipi);
+    timer_init(timer_irq);
+    tick_cycles = timer_ns_to_tsc(1000000000ULL / SCHED_HZ);
+    LOG_INFO("sched: %u Hz tick while busy, %u-tick slices, %u priorities, lazy FPU via %s (%lu bytes)", SCHED_HZ,
+             SCHED_SLICE_TICKS, SCHED_PRIORITIES, arch_x86_fpu_mode(), (unsigned long)fpu_size);
+    return 0;
+}
+
+void sched_ap_main(void) {
+    unsigned cpu = this_cpu();
+    if (cpu >= SCHED_MAX_CPUS) PANIC("sched: cpu%u beyond SCHED_MAX_CPUS", cpu);
+    adopt_idle(cpu);
+    timer_init_ap();
+    __atomic_fetch_add(&sched_cpus, 1, __ATOMIC_RELEASE);
+    arch_x86_irq_enable();
+    for (;;) sched_idle();
+}
+
+int sched_spawn(Process *p) {
+    void *stack = pmm_alloc_order(SCHED_KSTACK_ORDER);
+    if (!stack) return -1;
+    p->kstack = (uint64_t)phys_to_virt((uint64_t)stack);
+
+    /* arch_x86_switch() pops six callee-saved registers and returns into
+     * thread_start; the zero above is its return address slot, leaving rsp
+     * aligned as on a normal function entry. */
+    uint64_t *sp = (uint64_t *)(p->kstack + SCHED_KSTACK_SIZE);
+    *--sp = 0;
+    *--sp = (uint64_t)thread_start;
+    for (int i = 0; i < 6; i++) *--sp = 0;
+    p->context = (uint64_t)sp;
+
+    if (p->priority < 0) p->priority = 0;
+    if (p->priority >= SCHED_PRIORITIES) p->priority = SCHED_PRIORITIES - 1;
+    if (p->cpuid < 0 || (unsigned)p->cpuid >= __atomic_load_n(&sched_cpus, __ATOMIC_ACQUIRE)) p->cpuid = 0;
+    p->state = PROCESS_READY;
+    p->on_cpu = 0;
+    p->fpu = NULL;
+
+    uint64_t flags = arch_x86_irq_save();
+    sched_rq_t *rq = &runqueues[p->cpuid];
+    rq_lock(rq);
+    enqueue(rq, p);
+    rq_unlock(rq);
+    kick_for((unsigned)p->cpuid);
+    arch_x86_irq_restore(flags);
+    return 0;
+}
+
+void sched_yield(void) {
+    uint64_t flags = arch_x86_irq_save();
+    schedule();
+    arch_x86_irq_restore(flags);
+}
+
+/* The wake timer is armed before the switch with interrupts off, so it
+ * cannot fire before this task is off the CPU. */
+void sched_sleep_ns(uint64_t ns) {
+    uint64_t flags = arch_x86_irq_save();
+    sched_rq_t *rq = &runqueues[this_cpu()];
+    Process *cur = rq->current;
+    if (cur == rq->idle) PANIC("sched_sleep_ns: idle task cannot sleep");
+    timer_setup(&cur->wake, wake_expired);
+    timer_arm_ns(&cur->wake, ns);
+    cur->state = PROCESS_SLEEPING;
+    schedule();
+    arch_x86_irq_restore(flags);
+}
+
+void sched_exit(void) {
+    arch_x86_irq_save();
+    sched_rq_t *rq = &runqueues[this_cpu()];
+    if (rq->current == rq->idle) PANIC("sched_exit: idle task cannot exit");
+    rq->current->state = PROCESS_DEAD;
+    schedule();
+    PANIC("sched_exit: dead task was scheduled");
+    for (;;) {}
+}
+
+Process *sched_current(void) { return percpu_read(current); }
+
+void sched_idle(void) {
+    rcu_work(SIZE_MAX);
+    arch_x86_irq_save();
+    schedule();
+    if (work_available(this_cpu())) {
+        arch_x86_irq_enable();
+    } else {
+        rcu_idle_enter();
+        arch_x86_idle_halt();
+    }
+}
+
+void sched_get_switch_stats(sched_switch_stats_t *out) {
+    *out = (sched_switch_stats_t){0};
+    for (unsigned i = 0; i < __atomic_load_n(&sched_cpus, __ATOMIC_ACQUIRE); i++) hist_merge(out, &runqueues[i].sw);
+}
+
+void sched_print_stats(void) {
+    for (unsigned i = 0; i < __atomic_load_n(&sched_cpus, __ATOMIC_ACQUIRE); i++) {
+        sched_rq_t *rq = &runqueues[i];
+        LOG_INFO("sched: cpu%u ready=%u switches=%lu steals=%lu ticks=%lu idle=%lu fpu traps=%lu saves=%lu", i,
+                 rq->nr_ready, (unsigned long)rq->sw.count, (unsigned long)rq->steals, (unsigned long)rq->ticks,
+                 (unsigned long)rq->idle_ticks, (unsigned long)rq->fpu_traps, (unsigned long)rq->fpu_saves);
+    }
+    sched_switch_stats_t sw;
+    sched_get_switch_stats(&sw);
+    if (sw.count)
+        LOG_INFO("sched: switch cycles avg=%lu p50<=%lu p99<=%lu max=%lu", (unsigned long)(sw.sum / sw.count),
+                 (unsigned long)hist_percentile(&sw, 50), (unsigned long)hist_percentile(&sw, 99),
+                 (unsigned long)sw.max);
+}
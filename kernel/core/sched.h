@@ -0,0 +1,83 @@
+#ifndef ORION_CORE_SCHED_H
+#define ORION_CORE_SCHED_H
+
+#include <stdint.h>
+#include "core/process.h"
+#include "core/percpu.h"
+#include "core/hist.h"
+
+/* Preemptive priority scheduler with one run queue per CPU.
+ *
+ * A process lives on the queue of Process.cpuid. Each queue keeps a FIFO
+ * per priority plus a bitmap of the non-empty ones, so picking the next
+ * task is a find-highest-bit and a list pop regardless of how many are
+ * queued. Tasks of equal priority round-robin on SCHED_SLICE_TICKS ticks;
+ * a queued task of higher priority preempts at the next tick. A CPU whose
+ * queue runs dry steals the highest-priority waiting task of the busiest
+ * other queue and adopts it (cpuid changes) before falling back to its idle
+ * task. Only one queue lock is ever held at a time. Queuing work for an
+ * idle CPU, or work that an idle CPU could steal, wakes it with an IPI.
+ *
+ * The tick is a core/timer.h timer, armed only while the CPU has a task
+ * (or RCU callbacks) and cancelled when it goes idle, so an idle CPU
+ * sleeps until its next timer or an IPI. The timer never switches while
+ * preempt_count is raised; see core/preempt.h.
+ *
+ * FPU state is switched lazily (arch/x86_64/sched/fpu.h): a task gets a
+ * save area on its first FPU instruction, and its registers are only saved
+ * when another task on the same CPU uses the FPU. A task whose FPU state
+ * is live in a CPU's registers is not stolen from it. Kernel code borrows
+ * the registers between sched_fpu_begin() and sched_fpu_end(). */
+#define SCHED_PRIORITIES   32
+#define SCHED_MAX_CPUS     PERCPU_MAX_CPUS
+#define SCHED_HZ           1000     // tick rate while the CPU is busy
+#define SCHED_SLICE_TICKS  10
+#define SCHED_KSTACK_ORDER 2        // 16 KiB kernel stack per task
+#define SCHED_KSTACK_SIZE  (PAGE_SIZE << SCHED_KSTACK_ORDER)
+
+/* Adopt the calling (boot) thread as CPU 0's idle task and start the
+ * periodic tick. Returns 0. */
+int sched_init(void);
+/* Entry point for APs (see arch_x86_smp_init()): become that CPU's idle
+ * task, start its tick and join the scheduler. Does not return. */
+void sched_ap_main(void) __attribute__((noreturn));
+
+/* Give `p` a kernel stack and queue it on CPU p->cpuid. It starts in
+ * p->entry_point with interrupts enabled and exits when that returns. The
+ * Process must stay allocated until it has exited. Returns 0, or -1 when
+ * out of memory. */
+int sched_spawn(Process *p);
+
+/* Use SSE/AVX registers in kernel code. Saves whichever task's state is
+ * in them and keeps preemption off until sched_fpu_end(). Returns 0, and
+ * does nothing, before sched_init() or when this CPU is already inside
+ * such a section (an interrupt handler that interrupted one); the caller
+ * then has to do without. Must not sleep or yield in between. */
+int sched_fpu_begin(void);
+void sched_fpu_end(void);
+/* Let equal- or higher-priority tasks run. */
+void sched_yield(void);
+/* Block the calling task for at least `ns` nanoseconds. It wakes on the
+ * same CPU, from that CPU's timer heap. */
+void sched_sleep_ns(uint64_t ns);
+/* End the calling task; its kernel stack is released after the switch. */
+void sched_exit(void) __attribute__((noreturn));
+Process *sched_current(void);
+
+/* Body of the idle loop: run whatever is queued or can be stolen, else
+ * halt until the next interrupt. Call with interrupts enabled. */
+void sched_idle(void);
+
+/* Cost of each context switch in TSC cycles, from entering the scheduler
+ * to running on the next task's stack (queue pick, CR3 and CR0.TS updates
+ * and the register switch). */
+typedef hist_t sched_switch_stats_t;
+
+/* Sum over all CPUs. */
+void sched_get_switch_stats(sched_switch_stats_t *out);
+
+/* Switches, steals, ticks and FPU traps per CPU, and switch latency, to
+ * the log. */
+void sched_print_stats(void);
+
+#endif /* ORION_CORE_SCHED_H */
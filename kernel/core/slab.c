@@ -0,0 +1,230 @@
+#define LOG_CAT LOG_CAT_SLAB
+#include "core/slab.h"
+#include "core/pmm.h"
+#include "core/log.h"
+#include "core/lock.h"
+#include "lib/include/libc.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define SLAB_MAGIC 0x51AB51ABu
+#define SLAB_MIN_ALIGN 16
+#define KMALLOC_MIN_SHIFT 4   // 16 B
+#define KMALLOC_MAX_SHIFT 11  // 2 KiB
+#define KMALLOC_CLASSES (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+#define SLAB_KEEP_EMPTY 1     // empty slabs a cache holds on to before returning pages
+
+// Slab header at the start of every slab page; objects follow it.
+typedef struct slab {
+    struct slab *next;
+    struct slab *prev;
+    kmem_cache_t *cache;
+    void *free;         // intrusive list of free objects
+    uint16_t inuse;
+    uint16_t total;
+    uint32_t magic;
+} slab_t;
+
+typedef struct {
+    slab_t *head;
+    size_t count;
+} slab_list_t;
+
+struct kmem_cache {
+    const char *name;
+    size_t size;        // object stride
+    size_t offset;      // first object offset inside the slab page
+    size_t free_off;    // where the free-list link lives inside an object
+    uint16_t per_slab;
+    void (*ctor)(void *obj);
+    slab_list_t partial;
+    slab_list_t full;
+    slab_list_t empty;
+    size_t objs_inuse;
+    ticket_lock_t lock;     // the slab lists and every free list of this cache
+    struct kmem_cache *next;
+};
+
+// Caches are themselves slab objects; this one is bootstrapped statically.
+static kmem_cache_t cache_cache;
+static kmem_cache_t *cache_list = NULL;
+static ticket_lock_t cache_list_lock = TICKET_LOCK_INIT("slab cache list");
+static kmem_cache_t *kmalloc_caches[KMALLOC_CLASSES];
+
+static inline size_t align_up(size_t v, size_t a) { return (v + a - 1) & ~(a - 1); }
+
+static void list_push(slab_list_t *l, slab_t *s) {
+    s->prev = NULL;
+    s->next = l->head;
+    if (l->head) l->head->prev = s;
+    l->head = s;
+    l->count++;
+}
+
+static void list_remove(slab_list_t *l, slab_t *s) {
+    if (s->prev) s->prev->next = s->next; else l->head = s->next;
+    if (s->next) s->next->prev = s->prev;
+    s->next = s->prev = NULL;
+    l->count--;
+}
+
+/* Returns -1 when not even one object fits next to the slab header. */
+static int cache_setup(kmem_cache_t *c, const char *name, size_t size, size_t align, void (*ctor)(void *)) {
+    if (align < SLAB_MIN_ALIGN) align = SLAB_MIN_ALIGN;
+    if (size < sizeof(void *)) size = sizeof(void *);
+    memset(c, 0, sizeof(*c));
+    c->name = name;
+    /* Constructed objects must survive a free/alloc cycle, so caches with a
+     * constructor keep the free-list link after the object, not in it. */
+    c->free_off = ctor ? align_up(size, sizeof(void *)) : 0;
+    c->size = align_up(ctor ? c->free_off + sizeof(void *) : size, align);
+    c->offset = align_up(sizeof(slab_t), align);
+    if (c->offset + c->size > PAGE_SIZE) return -1;
+    c->per_slab = (uint16_t)((PAGE_SIZE - c->offset) / c->size);
+    c->ctor = ctor;
+    ticket_lock_init(&c->lock, name);
+    ticket_lock(&cache_list_lock);
+    c->next = cache_list;
+    cache_list = c;
+    ticket_unlock(&cache_list_lock);
+    return 0;
+}
+
+static inline void **free_link(kmem_cache_t *c, void *obj) { return (void **)((uint8_t *)obj + c->free_off); }
+
+static slab_t *slab_grow(kmem_cache_t *c) {
+    void *frame = pmm_alloc();
+    if (!frame) return NULL;
+    slab_t *s = (slab_t *)phys_to_virt((uint64_t)frame);
+    s->cache = c;
+    s->inuse = 0;
+    s->total = c->per_slab;
+    s->magic = SLAB_MAGIC;
+    s->free = NULL;
+    // Thread the free list back to front so objects come out in address order.
+    for (size_t i = c->per_slab; i-- > 0;) {
+        void *obj = (uint8_t *)s + c->offset + i * c->size;
+        if (c->ctor) c->ctor(obj);
+        *free_link(c, obj) = s->free;
+        s->free = obj;
+    }
+    return s;
+}
+
+static inline slab_t *slab_of(const void *obj) {
+    return (slab_t *)((uintptr_t)obj & ~(uintptr_t)(PAGE_SIZE - 1));
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, void (*ctor)(void *obj)) {
+    if (size == 0 || align & (align - 1) || align > PAGE_SIZE / 2) return NULL;
+    if (size + (ctor ? sizeof(void *) : 0) > KMEM_MAX_OBJECT) return NULL;
+    kmem_cache_t *c = kmem_cache_alloc(&cache_cache);
+    if (!c) return NULL;
+    if (cache_setup(c, name, size, align, ctor)) {
+        kmem_cache_free(&cache_cache, c);
+        return NULL;
+    }
+    return c;
+}
+
+/* A new slab's page comes from the PMM with the cache lock held; the PMM
+ * never calls back into the slab allocator, so the order is fixed. */
+void *kmem_cache_alloc(kmem_cache_t *c) {
+    ticket_lock(&c->lock);
+    slab_t *s = c->partial.head;
+    if (!s) {
+        s = c->empty.head;
+        if (s) list_remove(&c->empty, s);
+        else if (!(s = slab_grow(c))) {
+            ticket_unlock(&c->lock);
+            return NULL;
+        }
+        list_push(&c->partial, s);
+    }
+    void *obj = s->free;
+    s->free = *free_link(c, obj);
+    s->inuse++;
+    c->objs_inuse++;
+    if (s->inuse == s->total) {
+        list_remove(&c->partial, s);
+        list_push(&c->full, s);
+    }
+    ticket_unlock(&c->lock);
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *c, void *obj) {
+    slab_t *s = slab_of(obj);
+    if (s->magic != SLAB_MAGIC || s->cache != c) PANIC("kmem_cache_free: %p not from cache %s", obj, c->name);
+    if (((uintptr_t)obj - (uintptr_t)s - c->offset) % c->size) PANIC("kmem_cache_free: %p misaligned in %s", obj, c->name);
+    ticket_lock(&c->lock);
+    if (s->inuse == s->total) {
+        list_remove(&c->full, s);
+        list_push(&c->partial, s);
+    }
+    *free_link(c, obj) = s->free;
+    s->free = obj;
+    s->inuse--;
+    c->objs_inuse--;
+    if (s->inuse == 0) {
+        list_remove(&c->partial, s);
+        if (c->empty.count < SLAB_KEEP_EMPTY) {
+            list_push(&c->empty, s);
+        } else {
+            s->magic = 0;
+            pmm_free((void *)virt_to_phys(s));
+        }
+    }
+    ticket_unlock(&c->lock);
+}
+
+static inline int kmalloc_class(size_t size) {
+    int shift = KMALLOC_MIN_SHIFT;
+    while (((size_t)1 << shift) < size) shift++;
+    return shift - KMALLOC_MIN_SHIFT;
+}
+
+void *kmalloc(size_t size) {
+    if (size == 0) return NULL;
+    if (size <= KMEM_MAX_OBJECT) return kmem_cache_alloc(kmalloc_caches[kmalloc_class(size)]);
+    if (size > PAGE_SIZE) return NULL;
+    void *frame = pmm_alloc();
+    return frame ? phys_to_virt((uint64_t)frame) : NULL;
+}
+
+/* Slab objects never sit at the start of a page (the header does), so a
+ * page-aligned pointer can only be a whole-frame allocation. */
+void kfree(void *ptr) {
+    if (!ptr) return;
+    if (((uintptr_t)ptr & (PAGE_SIZE - 1)) == 0) {
+        pmm_free((void *)virt_to_phys(ptr));
+        return;
+    }
+    slab_t *s = slab_of(ptr);
+    if (s->magic != SLAB_MAGIC) PANIC("kfree: %p is not a kmalloc pointer", ptr);
+    kmem_cache_free(s->cache, ptr);
+}
+
+int slab_init(void) {
+    static const char *const names[KMALLOC_CLASSES] = {
+        "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+        "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048"
+    };
+    cache_list = NULL;
+    if (cache_setup(&cache_cache, "kmem_cache", sizeof(kmem_cache_t), SLAB_MIN_ALIGN, NULL)) return -1;
+    for (int i = 0; i < KMALLOC_CLASSES; i++) {
+        kmalloc_caches[i] = kmem_cache_create(names[i], (size_t)1 << (i + KMALLOC_MIN_SHIFT), SLAB_MIN_ALIGN, NULL);
+        if (!kmalloc_caches[i]) return -1;
+    }
+    return 0;
+}
+
+void slab_print_stats(void) {
+    ticket_lock(&cache_list_lock);
+    for (kmem_cache_t *c = cache_list; c; c = c->next) {
+        size_t slabs = c->partial.count + c->full.count + c->empty.count;
+        LOG_INFO("slab: %s size=%u inuse=%u slabs=%u (per slab %u)", c->name, (unsigned)c->size,
+                 (unsigned)c->objs_inuse, (unsigned)slabs, (unsigned)c->per_slab);
+    }
+    ticket_unlock(&cache_list_lock);
+}
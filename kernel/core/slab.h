@@ -0,0 +1,38 @@
+#ifndef ORION_CORE_SLAB_H
+#define ORION_CORE_SLAB_H
+
+#include <stddef.h>
+
+/* Slab object allocator on top of the PMM.
+ *
+ * A cache hands out fixed-size objects carved from single-page slabs. Each
+ * slab keeps an intrusive free list of its objects, and the cache keeps its
+ * slabs on partial/full/empty lists, so alloc and free are O(1). An optional
+ * constructor runs once per object when its slab is created; objects must be
+ * returned to the cache in their constructed state.
+ */
+typedef struct kmem_cache kmem_cache_t;
+
+/* Largest object a single-page slab can hold (the slab header shares the page). */
+#define KMEM_MAX_OBJECT 2048
+
+/* align is a power of two up to PAGE_SIZE / 2. Returns NULL when the
+ * arguments are invalid or no object fits in a slab page. */
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, void (*ctor)(void *obj));
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+/* General-purpose allocation through power-of-two size classes from 16 B to
+ * 2 KiB. Requests above KMEM_MAX_OBJECT and up to PAGE_SIZE get a whole
+ * frame; larger requests return NULL (use pmm_alloc_order()). Memory is
+ * 16-byte aligned and not zeroed. */
+void *kmalloc(size_t size);
+void kfree(void *ptr);
+
+/* Create the kmalloc size-class caches. Call once after the PMM is up. */
+int slab_init(void);
+
+/* Dump per-cache object/slab counts to the log. */
+void slab_print_stats(void);
+
+#endif /* ORION_CORE_SLAB_H */
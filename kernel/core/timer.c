@@ -0,0 +1,154 @@
+#define LOG_CAT LOG_CAT_TIMER
+#include "core/timer.h"
+#include "core/percpu.h"
+#include "core/log.h"
+#include "arch/x86_64/cpu.h"
+#include "arch/x86_64/interrupts/lapic.h"
+#include "arch/x86_64/interrupts/timer.h"
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+    ktimer_t *heap[TIMER_HEAP_SIZE];
+    unsigned n;
+    uint64_t programmed;        // deadline the hardware holds, 0 for none
+    int running;                // in timer_run_expired(), which reprograms at the end
+    uint64_t interrupts;
+    uint64_t fired;
+} __attribute__((aligned(64))) timer_cpu_t;
+
+static timer_cpu_t timer_cpus[PERCPU_MAX_CPUS];
+
+/* 32.32 fixed-point factors, so conversions are a multiply and a shift. */
+static uint64_t ns_per_tsc;
+static uint64_t tsc_per_ns;
+
+static inline uint64_t mul_shr32(uint64_t a, uint64_t b) {
+    return (uint64_t)(((unsigned __int128)a * b) >> 32);
+}
+
+uint64_t timer_ns_to_tsc(uint64_t ns) { return mul_shr32(ns, tsc_per_ns); }
+uint64_t timer_tsc_to_ns(uint64_t tsc) { return mul_shr32(tsc, ns_per_tsc); }
+uint64_t timer_now_ns(void) { return timer_tsc_to_ns(arch_x86_rdtsc()); }
+
+int timer_init(void (*handler)(void)) {
+    arch_x86_timer_init(handler);
+    ns_per_tsc = (1000000ULL << 32) / arch_x86_tsc_khz;
+    tsc_per_ns = (arch_x86_tsc_khz << 32) / 1000000ULL;
+    LOG_INFO("timer: %s, tsc %lu kHz, heap of %u timers per CPU", arch_x86_timer_mode(),
+             (unsigned long)arch_x86_tsc_khz, TIMER_HEAP_SIZE);
+    return 0;
+}
+
+void timer_init_ap(void) { arch_x86_timer_init_ap(); }
+
+/* --- Min-heap on `expires`; every move updates the timer's slot --- */
+
+static inline void heap_put(timer_cpu_t *tc, unsigned i, ktimer_t *t) {
+    tc->heap[i] = t;
+    t->slot = (int)i;
+}
+
+static void sift_up(timer_cpu_t *tc, unsigned i) {
+    ktimer_t *t = tc->heap[i];
+    while (i > 0 && tc->heap[(i - 1) / 2]->expires > t->expires) {
+        heap_put(tc, i, tc->heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    heap_put(tc, i, t);
+}
+
+static void sift_down(timer_cpu_t *tc, unsigned i) {
+    ktimer_t *t = tc->heap[i];
+    for (;;) {
+        unsigned c = 2 * i + 1;
+        if (c >= tc->n) break;
+        if (c + 1 < tc->n && tc->heap[c + 1]->expires < tc->heap[c]->expires) c++;
+        if (tc->heap[c]->expires >= t->expires) break;
+        heap_put(tc, i, tc->heap[c]);
+        i = c;
+    }
+    heap_put(tc, i, t);
+}
+
+static void heap_remove(timer_cpu_t *tc, ktimer_t *t) {
+    unsigned i = (unsigned)t->slot;
+    t->slot = -1;
+    if (i == --tc->n) return;
+    ktimer_t *last = tc->heap[tc->n];
+    heap_put(tc, i, last);
+    sift_up(tc, i);
+    sift_down(tc, (unsigned)last->slot);
+}
+
+/* Point the hardware at the earliest deadline, touching it only when that
+ * changed. An empty heap stops the timer: no interrupts until re-armed. */
+static void reprogram(timer_cpu_t *tc) {
+    uint64_t want = tc->n ? tc->heap[0]->expires : 0;
+    if (want == tc->programmed) return;
+    if (want) arch_x86_timer_arm(want);
+    else arch_x86_timer_disarm();
+    tc->programmed = want;
+}
+
+void timer_setup(ktimer_t *t, void (*fn)(ktimer_t *t)) {
+    *t = (ktimer_t){ .fn = fn, .slot = -1 };
+}
+
+void timer_arm(ktimer_t *t, uint64_t tsc) {
+    uint64_t flags = arch_x86_irq_save();
+    unsigned cpu = this_cpu();
+    timer_cpu_t *tc = &timer_cpus[cpu];
+    if (timer_armed(t)) {
+        if (t->cpu != cpu) PANIC("timer_arm: timer %p is armed on cpu%u", (void *)t, t->cpu);
+        heap_remove(tc, t);
+    }
+    if (tc->n == TIMER_HEAP_SIZE) PANIC("timer_arm: more than %u timers on cpu%u", TIMER_HEAP_SIZE, cpu);
+    t->expires = tsc ? tsc : 1;
+    t->cpu = cpu;
+    tc->heap[tc->n] = t;
+    t->slot = (int)tc->n++;
+    sift_up(tc, (unsigned)t->slot);
+    if (!tc->running) reprogram(tc);
+    arch_x86_irq_restore(flags);
+}
+
+void timer_arm_ns(ktimer_t *t, uint64_t delay_ns) {
+    timer_arm(t, arch_x86_rdtsc() + timer_ns_to_tsc(delay_ns));
+}
+
+void timer_cancel(ktimer_t *t) {
+    uint64_t flags = arch_x86_irq_save();
+    if (timer_armed(t)) {
+        if (t->cpu != this_cpu()) PANIC("timer_cancel: timer %p is armed on cpu%u", (void *)t, t->cpu);
+        timer_cpu_t *tc = &timer_cpus[t->cpu];
+        heap_remove(tc, t);
+        if (!tc->running) reprogram(tc);
+    }
+    arch_x86_irq_restore(flags);
+}
+
+void timer_run_expired(void) {
+    timer_cpu_t *tc = &timer_cpus[this_cpu()];
+    uint64_t now = arch_x86_rdtsc();
+    tc->interrupts++;
+    tc->programmed = 0;         // a one-shot request is used up once it fires
+    tc->running = 1;
+    while (tc->n && tc->heap[0]->expires <= now) {
+        ktimer_t *t = tc->heap[0];
+        heap_remove(tc, t);
+        tc->fired++;
+        t->fn(t);
+    }
+    tc->running = 0;
+    reprogram(tc);
+}
+
+void timer_print_stats(void) {
+    for (unsigned i = 0; i < PERCPU_MAX_CPUS; i++) {
+        const timer_cpu_t *tc = &timer_cpus[i];
+        if (!tc->interrupts && !tc->n) continue;
+        LOG_INFO("timer: cpu%u interrupts=%lu fired=%lu armed=%u", i, (unsigned long)tc->interrupts,
+                 (unsigned long)tc->fired, tc->n);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef ORION_CORE_TIMER_H
+#define ORION_CORE_TIMER_H
+
+#include <stdint.h>
+
+/* High-resolution one-shot timers.
+ *
+ * Each CPU keeps its armed timers in a binary min-heap ordered by TSC
+ * deadline, and programs the local timer interrupt for the earliest one
+ * only. A CPU with nothing armed takes no timer interrupts at all; the
+ * scheduler tick is itself a timer, armed only while the CPU has a task to
+ * run (see core/sched.h).
+ *
+ * A timer is armed, re-armed and cancelled on one CPU, and its callback
+ * runs there from the timer interrupt with interrupts disabled. The
+ * callback may re-arm its timer, to a deadline that has not passed yet. */
+#define TIMER_HEAP_SIZE 128         // timers armed per CPU at most
+
+typedef struct ktimer {
+    uint64_t expires;               // TSC deadline
+    void (*fn)(struct ktimer *t);
+    int slot;                       // heap index, -1 while not armed
+    unsigned cpu;
+} ktimer_t;
+
+/* Start the local timer interrupt on the BSP (handler: see
+ * arch_x86_timer_init()) and derive the TSC <-> ns conversions. */
+int timer_init(void (*handler)(void));
+void timer_init_ap(void);
+
+uint64_t timer_ns_to_tsc(uint64_t ns);
+uint64_t timer_tsc_to_ns(uint64_t tsc);
+/* Nanoseconds of TSC time since reset. */
+uint64_t timer_now_ns(void);
+
+void timer_setup(ktimer_t *t, void (*fn)(ktimer_t *t));
+/* Fire at TSC value `tsc`, or right away if it has passed. */
+void timer_arm(ktimer_t *t, uint64_t tsc);
+void timer_arm_ns(ktimer_t *t, uint64_t delay_ns);
+void timer_cancel(ktimer_t *t);
+static inline int timer_armed(const ktimer_t *t) { return t->slot >= 0; }
+
+/* Run every expired timer of this CPU and program the next deadline. Call
+ * from the timer interrupt. */
+void timer_run_expired(void);
+
+/* Timer interrupts and callbacks per CPU, to the log. */
+void timer_print_stats(void);
+
+#endif /* ORION_CORE_TIMER_H */
@@ -0,0 +1,182 @@
+#include "core/trace.h"
+#include "core/percpu.h"
+#include "core/preempt.h"
+#include "core/sched.h"
+#include "core/timer.h"
+#include "drivers/serial.h"
+#include "arch/x86_64/cpu.h"
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+
+int snprintf(char *out, size_t size, const char *fmt, ...);
+
+extern char _kernel_start[], _kernel_end[];
+
+_Static_assert(sizeof(trace_rec_t) == 128, "trace_rec_t is two cache lines");
+_Static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "TRACE_RING_SIZE must be a power of two");
+
+/* head is bumped by this CPU only, from task or interrupt context; tail
+ * and dropped belong to the drain. */
+typedef struct {
+    uint64_t head;
+    uint64_t tail;
+    uint64_t dropped;
+    trace_rec_t recs[TRACE_RING_SIZE] __attribute__((aligned(64)));
+} trace_ring_t;
+
+/* Not static: a debugger dumps these for scripts/trace_decode.py. */
+trace_ring_t trace_rings[PERCPU_MAX_CPUS];
+
+const trace_layout_t trace_layout = {
+    .magic = TRACE_MAGIC,
+    .cpus = PERCPU_MAX_CPUS,
+    .ring_size = TRACE_RING_SIZE,
+    .rec_size = sizeof(trace_rec_t),
+    .max_args = TRACE_MAX_ARGS,
+    .recs_offset = offsetof(trace_ring_t, recs),
+    .ring_bytes = sizeof(trace_ring_t),
+};
+
+/* The task cannot migrate while it holds preempt_count, so the only other
+ * writers of this ring are interrupts on this CPU; the atomic add keeps
+ * their slots apart. */
+void trace_emit(unsigned level, const char *fmt, unsigned nargs, ...) {
+    preempt_disable();
+    unsigned cpu = this_cpu();
+    trace_ring_t *r = &trace_rings[cpu];
+    uint64_t i = __atomic_fetch_add(&r->head, 1, __ATOMIC_RELAXED);
+    trace_rec_t *e = &r->recs[i & (TRACE_RING_SIZE - 1)];
+    __atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    e->tsc = arch_x86_rdtsc();
+    e->fmt = fmt;
+    e->cpu = (uint16_t)cpu;
+    e->level = (uint8_t)level;
+    if (nargs > TRACE_MAX_ARGS) nargs = TRACE_MAX_ARGS;
+    e->nargs = (uint8_t)nargs;
+    va_list ap;
+    va_start(ap, nargs);
+    for (unsigned k = 0; k < nargs; k++) e->args[k] = va_arg(ap, uint64_t);
+    va_end(ap);
+    __atomic_store_n(&e->seq, i + 1, __ATOMIC_RELEASE);
+    preempt_enable();
+}
+
+/* Copy the next complete record of r into out. Records the writer lapped
+ * are skipped and counted; one still being written ends the scan. */
+static int next_rec(trace_ring_t *r, trace_rec_t *out) {
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    if (head - r->tail > TRACE_RING_SIZE) {
+        r->dropped += head - TRACE_RING_SIZE - r->tail;
+        r->tail = head - TRACE_RING_SIZE;
+    }
+    for (; r->tail != head; r->tail++) {
+        const trace_rec_t *e = &r->recs[r->tail & (TRACE_RING_SIZE - 1)];
+        uint64_t seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+        if (seq != r->tail + 1) {
+            if (seq > r->tail + 1) { r->dropped++; continue; }
+            return 0;
+        }
+        *out = *e;
+        /* Keeps the plain loads of the copy ahead of the re-check, or a torn
+         * record could pass as complete. */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq) { r->dropped++; continue; }
+        r->tail++;
+        return 1;
+    }
+    return 0;
+}
+
+/* Length modifiers of a 64-bit argument. */
+static int is_wide(char c) { return c == 'l' || c == 'z' || c == 'j' || c == 't'; }
+
+static int in_image(uint64_t p) {
+    return p >= (uint64_t)_kernel_start && p < (uint64_t)_kernel_end;
+}
+
+/* Flags, width, precision and length between '%' and the conversion. */
+static int is_modifier(char c) {
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == ' ' || c == '#' || c == '.' || c == 'h' ||
+           is_wide(c);
+}
+
+/* Expand one record with the kernel's snprintf, one conversion at a time,
+ * each argument passed as the type its conversion expects. */
+static size_t render(char *out, size_t size, const trace_rec_t *e) {
+    size_t n = 0, arg = 0;
+    const char *f = e->fmt;
+    while (*f && n + 1 < size) {
+        if (*f != '%') { out[n++] = *f++; continue; }
+        char spec[16];
+        size_t k = 0;
+        spec[k++] = *f++;
+        while (*f && k < sizeof(spec) - 2 && is_modifier(*f)) spec[k++] = *f++;
+        if (!*f) break;
+        char conv = *f++;
+        spec[k++] = conv;
+        spec[k] = '\0';
+        if (conv == '%') { out[n++] = '%'; continue; }
+        uint64_t v = arg < e->nargs ? e->args[arg] : 0;
+        arg++;
+        int w;
+        if (conv == 's') {
+            if (in_image(v)) w = snprintf(out + n, size - n, spec, (const char *)v);
+            else w = snprintf(out + n, size - n, "<%p>", (void *)v);
+        } else if (conv == 'p') {
+            w = snprintf(out + n, size - n, spec, (void *)v);
+        } else if (k > 2 && is_wide(spec[k - 2])) {
+            w = snprintf(out + n, size - n, spec, (unsigned long)v);
+        } else {
+            w = snprintf(out + n, size - n, spec, (unsigned)v);
+        }
+        if (w > 0) n += (size_t)w < size - n ? (size_t)w : size - n - 1;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+size_t trace_drain(size_t max) {
+    /* One pending record per CPU; the oldest of them goes out next. */
+    static trace_rec_t pend[PERCPU_MAX_CPUS];
+    static uint64_t reported;
+    uint32_t have = 0;
+    size_t done = 0;
+    char line[256];
+
+    for (unsigned c = 0; c < PERCPU_MAX_CPUS; c++)
+        if (next_rec(&trace_rings[c], &pend[c])) have |= 1u << c;
+    while (have && done < max) {
+        unsigned best = __builtin_ctz(have);
+        for (uint32_t m = have & (have - 1); m; m &= m - 1)
+            if (pend[__builtin_ctz(m)].tsc < pend[best].tsc) best = __builtin_ctz(m);
+        const trace_rec_t *e = &pend[best];
+        int n = snprintf(line, sizeof(line), "[%u] cpu%u %lu us: ", (unsigned)e->level, (unsigned)e->cpu,
+                         (unsigned long)(timer_tsc_to_ns(e->tsc) / 1000));
+        size_t len = (size_t)n + render(line + n, sizeof(line) - (size_t)n - 1, e);
+        line[len++] = '\n';
+        line[len] = '\0';
+        serial_write(line);
+        done++;
+        if (!next_rec(&trace_rings[best], &pend[best])) have &= ~(1u << best);
+    }
+    /* Records still pending go back: the next drain reads them again. */
+    for (; have; have &= have - 1) trace_rings[__builtin_ctz(have)].tail--;
+
+    uint64_t dropped = 0;
+    for (unsigned c = 0; c < PERCPU_MAX_CPUS; c++) dropped += trace_rings[c].dropped;
+    if (dropped != reported) {
+        snprintf(line, sizeof(line), "trace: %lu records dropped\n", (unsigned long)(dropped - reported));
+        serial_write(line);
+        reported = dropped;
+    }
+    return done;
+}
+
+void trace_drain_main(void) {
+    for (;;) {
+        trace_drain(SIZE_MAX);
+        sched_sleep_ns((uint64_t)TRACE_DRAIN_MS * 1000000);
+    }
+}
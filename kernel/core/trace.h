@@ -0,0 +1,88 @@
+#ifndef ORION_CORE_TRACE_H
+#define ORION_CORE_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "core/log.h"
+
+/* Binary trace: a record is the format string's address, the TSC, the CPU
+ * and the raw arguments, stored in a per-CPU ring with no lock and no
+ * formatting. The text is produced later, by trace_drain() in the kernel
+ * or by scripts/trace_decode.py from a dump of `trace_rings`.
+ *
+ * The ring overwrites its oldest records when the drain falls behind, and
+ * counts them as dropped. Arguments must be integers or pointers. A %s
+ * argument is only printed if it points into the kernel image (string
+ * literals, static names); anything else is shown as a pointer. */
+#define TRACE_RING_SIZE 512         // records per CPU, a power of two
+#define TRACE_MAX_ARGS  12
+#define TRACE_DRAIN_MS  20          // period of trace_drain_main()
+
+/* 128 bytes. `seq` is the ring index plus one once the record is
+ * complete, and 0 while it is being written. */
+typedef struct {
+    uint64_t seq;
+    uint64_t tsc;
+    const char *fmt;
+    uint16_t cpu;
+    uint8_t level;
+    uint8_t nargs;
+    uint32_t reserved;
+    uint64_t args[TRACE_MAX_ARGS];
+} trace_rec_t;
+
+/* Layout description for the host decoder, kept in .rodata. */
+typedef struct {
+    uint32_t magic;                 // TRACE_MAGIC
+    uint32_t cpus;
+    uint32_t ring_size;
+    uint32_t rec_size;
+    uint32_t max_args;
+    uint32_t recs_offset;           // of recs[] in a ring
+    uint32_t ring_bytes;
+} trace_layout_t;
+
+#define TRACE_MAGIC 0x45435254u     // "TRCE" in memory
+
+#if LOG_BINARY
+/* Record one entry on this CPU's ring; each variadic argument is a
+ * uint64_t. Use TRACE() or TRACE_LOG(), which count and widen them. */
+void trace_emit(unsigned level, const char *fmt, unsigned nargs, ...);
+
+#define TRACE_LOG(level, fmt, ...) \
+    trace_emit((level), fmt, TRACE_NARGS(__VA_ARGS__) TRACE_ARGS(__VA_ARGS__))
+
+/* Format up to `max` records, oldest first across all CPUs, to serial.
+ * Returns how many were printed. There must be only one caller at a time,
+ * except for panic(). */
+size_t trace_drain(size_t max);
+/* Entry point of a kernel thread that drains every TRACE_DRAIN_MS. */
+void trace_drain_main(void);
+#else
+/* trace.o is only linked with LOG_BINARY, so without it TRACE() is a no-op. */
+#define TRACE_LOG(level, fmt, ...) do {} while (0)
+#endif
+#define TRACE(fmt, ...) TRACE_LOG(LOG_LEVEL_TRACE, fmt, ##__VA_ARGS__)
+
+/* --- Argument counting and widening, up to TRACE_MAX_ARGS --- */
+#define TRACE_NARGS(...) TRACE_NARGS_(0, ##__VA_ARGS__, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define TRACE_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, n, ...) n
+#define TRACE_CAT(a, b) TRACE_CAT_(a, b)
+#define TRACE_CAT_(a, b) a##b
+#define TRACE_ARGS(...) TRACE_CAT(TRACE_ARGS_, TRACE_NARGS(__VA_ARGS__))(__VA_ARGS__)
+#define TRACE_U64(x) ((uint64_t)(uintptr_t)(x))
+#define TRACE_ARGS_0(...)
+#define TRACE_ARGS_1(a) , TRACE_U64(a)
+#define TRACE_ARGS_2(a, ...) , TRACE_U64(a) TRACE_ARGS_1(__VA_ARGS__)
+#define TRACE_ARGS_3(a, ...) , TRACE_U64(a) TRACE_ARGS_2(__VA_ARGS__)
+#define TRACE_ARGS_4(a, ...) , TRACE_U64(a) TRACE_ARGS_3(__VA_ARGS__)
+#define TRACE_ARGS_5(a, ...) , TRACE_U64(a) TRACE_ARGS_4(__VA_ARGS__)
+#define TRACE_ARGS_6(a, ...) , TRACE_U64(a) TRACE_ARGS_5(__VA_ARGS__)
+#define TRACE_ARGS_7(a, ...) , TRACE_U64(a) TRACE_ARGS_6(__VA_ARGS__)
+#define TRACE_ARGS_8(a, ...) , TRACE_U64(a) TRACE_ARGS_7(__VA_ARGS__)
+#define TRACE_ARGS_9(a, ...) , TRACE_U64(a) TRACE_ARGS_8(__VA_ARGS__)
+#define TRACE_ARGS_10(a, ...) , TRACE_U64(a) TRACE_ARGS_9(__VA_ARGS__)
+#define TRACE_ARGS_11(a, ...) , TRACE_U64(a) TRACE_ARGS_10(__VA_ARGS__)
+#define TRACE_ARGS_12(a, ...) , TRACE_U64(a) TRACE_ARGS_11(__VA_ARGS__)
+
+#endif /* ORION_CORE_TRACE_H */
@@ -1,38 +1,157 @@
 #include "../core/io.h"
 #include "serial.h"
+#include "core/lock.h"
+#include "arch/x86_64/cpu.h"
+#include "arch/x86_64/interrupts/idt.h"
+#include "arch/x86_64/interrupts/pic.h"
+#include <stdint.h>
 
 #define COM1_PORT 0x3F8
+#define COM1_IRQ  4
+#define UART_CLOCK 115200       // baud at divisor 1
+
+#define REG_DATA 0              // THR on write, divisor low with DLAB
+#define REG_IER  1              // divisor high with DLAB
+#define REG_IIR  2              // FCR on write
+#define REG_LCR  3
+#define REG_MCR  4
+#define REG_LSR  5
+
+#define IER_THRE  0x02          // interrupt when the transmit FIFO empties
+#define LSR_THRE  0x20
+#define SERIAL_DIVISOR (UART_CLOCK / SERIAL_BAUD)
+#define RING_MASK (SERIAL_TX_RING - 1)
+
+_Static_assert(SERIAL_DIVISOR >= 1 && SERIAL_DIVISOR <= 0xFFFF && UART_CLOCK % SERIAL_BAUD == 0,
+               "SERIAL_BAUD must divide 115200");
+_Static_assert((SERIAL_TX_RING & RING_MASK) == 0, "SERIAL_TX_RING must be a power of two");
+
+enum { SERIAL_OFF, SERIAL_POLLED, SERIAL_IRQ, SERIAL_SYNC };
+
+/* head and tail run freely and are masked on use; head - tail is the fill.
+ * Both move under serial_lock only, except in serial_panic(). */
+static char ring[SERIAL_TX_RING];
+static uint32_t head, tail;
+static volatile int mode = SERIAL_OFF;
+static int tx_busy;             // a THRE interrupt is on its way
+static unsigned fifo_depth = 1;
+static ticket_lock_t serial_lock = TICKET_LOCK_INIT("serial");
+
+static inline int thr_empty(void) {
+    return inb(COM1_PORT + REG_LSR) & LSR_THRE;
+}
+
+static void putc_sync(char c) {
+    while (!thr_empty()) arch_x86_pause();
+    outb(COM1_PORT + REG_DATA, (uint8_t)c);
+}
+
+/* One FIFO load from the ring, if the transmitter has room. Returns the
+ * number of bytes written. */
+static unsigned fill(void) {
+    unsigned n = 0;
+    if (!thr_empty()) return 0;
+    for (; n < fifo_depth && tail != head; n++) outb(COM1_PORT + REG_DATA, (uint8_t)ring[tail++ & RING_MASK]);
+    return n;
+}
+
+static void put_locked(char c) {
+    /* Full: make room by polling. The only case where a writer waits once
+     * interrupts drive the transmitter. */
+    while (head - tail == SERIAL_TX_RING) {
+        while (!thr_empty()) arch_x86_pause();
+        fill();
+    }
+    ring[head++ & RING_MASK] = c;
+}
+
+/* Start the transmitter on what was just queued. Before serial_irq_init()
+ * that means sending all of it. */
+static void kick_locked(void) {
+    if (mode != SERIAL_IRQ) {
+        while (tail != head) {
+            while (!thr_empty()) arch_x86_pause();
+            fill();
+        }
+    } else if (!tx_busy && tail != head) {
+        /* Bytes left in the FIFO raise THRE when they are out, so the
+         * interrupt is due even if fill() found no room. */
+        fill();
+        tx_busy = 1;
+    }
+}
+
+static void serial_irq(arch_x86_regs_t *regs) {
+    (void)regs;
+    arch_x86_pic_eoi(COM1_IRQ);
+    ticket_lock(&serial_lock);
+    (void)inb(COM1_PORT + REG_IIR);     // acknowledges THRE
+    tx_busy = fill() != 0;
+    ticket_unlock(&serial_lock);
+}
 
 void serial_init(void) {
-    // Disable interrupts
-    outb(COM1_PORT + 1, 0x00);
+    outb(COM1_PORT + REG_IER, 0x00);
     // Enable DLAB (set baud rate divisor)
-    outb(COM1_PORT + 3, 0x80);
-    // Set divisor to 3 (38400 baud)
-    outb(COM1_PORT + 0, 0x03);
-    outb(COM1_PORT + 1, 0x00);
+    outb(COM1_PORT + REG_LCR, 0x80);
+    outb(COM1_PORT + REG_DATA, SERIAL_DIVISOR & 0xFF);
+    outb(COM1_PORT + REG_IER, SERIAL_DIVISOR >> 8);
     // 8 bits, no parity, one stop bit
-    outb(COM1_PORT + 3, 0x03);
-    // Enable FIFO, clear them, with 14-byte threshold
-    outb(COM1_PORT + 2, 0xC7);
-    // IRQs enabled, RTS/DSR set
-    outb(COM1_PORT + 4, 0x0B);
+    outb(COM1_PORT + REG_LCR, 0x03);
+    // Enable FIFO, clear them, with 14-byte receive threshold
+    outb(COM1_PORT + REG_IIR, 0xC7);
+    // A 16550A reports working FIFOs in IIR bits 7:6; older parts have none
+    fifo_depth = (inb(COM1_PORT + REG_IIR) & 0xC0) == 0xC0 ? 16 : 1;
+    // RTS/DTR set; OUT2 gates the interrupt line to the PIC
+    outb(COM1_PORT + REG_MCR, 0x0B);
+    mode = SERIAL_POLLED;
 }
 
-static inline int serial_transmit_empty() {
-    return inb(COM1_PORT + 5) & 0x20;
+void serial_irq_init(void) {
+    uint64_t flags = ticket_lock_irqsave(&serial_lock);
+    arch_x86_set_handler(X86_VEC_IRQ0 + COM1_IRQ, serial_irq);
+    arch_x86_pic_unmask(COM1_IRQ);
+    mode = SERIAL_IRQ;
+    /* The transmitter is idle, so enabling THRE raises it right away. */
+    tx_busy = 1;
+    outb(COM1_PORT + REG_IER, IER_THRE);
+    ticket_unlock_irqrestore(&serial_lock, flags);
 }
 
 void serial_putc(char c) {
-    while (!serial_transmit_empty()) { }
-    outb(COM1_PORT, (uint8_t)c);
+    if (mode == SERIAL_SYNC) {
+        putc_sync(c);
+        return;
+    }
+    uint64_t flags = ticket_lock_irqsave(&serial_lock);
+    put_locked(c);
+    kick_locked();
+    ticket_unlock_irqrestore(&serial_lock, flags);
 }
 
 void serial_write(const char *s) {
-    // Simple, robust serial string writer: converts \n to \r\n and writes bytes
-    while (*s) {
-        if (*s == '\n') serial_putc('\r');
-        serial_putc(*s);
-        s++;
+    // Converts \n to \r\n; a whole string is queued under one acquisition
+    if (mode == SERIAL_SYNC) {
+        for (; *s; s++) {
+            if (*s == '\n') putc_sync('\r');
+            putc_sync(*s);
+        }
+        return;
+    }
+    uint64_t flags = ticket_lock_irqsave(&serial_lock);
+    for (; *s; s++) {
+        if (*s == '\n') put_locked('\r');
+        put_locked(*s);
     }
+    kick_locked();
+    ticket_unlock_irqrestore(&serial_lock, flags);
+}
+
+/* The lock may be held by this CPU or by one that will never release it,
+ * so the ring is drained as it stands. */
+void serial_panic(void) {
+    if (mode == SERIAL_OFF) serial_init();
+    outb(COM1_PORT + REG_IER, 0x00);
+    mode = SERIAL_SYNC;
+    for (uint32_t t = tail, h = head; t != h; t++) putc_sync(ring[t & RING_MASK]);
 }
@@ -3,8 +3,22 @@
 
 #include <stddef.h>
 
+/* COM1, 8N1. Output goes into a ring buffer. Until serial_irq_init() the
+ * caller drains it by polling, a FIFO load per wait; after it, the THRE
+ * interrupt refills the FIFO and writers only block when the ring is full.
+ * serial_panic() switches to unbuffered, lock-free output for good. */
+#ifndef SERIAL_BAUD
+#define SERIAL_BAUD 115200          // divisor 115200 / SERIAL_BAUD
+#endif
+#define SERIAL_TX_RING 4096         // bytes, a power of two
+
 void serial_init(void);
+/* Hook IRQ4; the PIC must already be remapped (timer_init()). */
+void serial_irq_init(void);
 void serial_putc(char c);
 void serial_write(const char *s);
+/* Push out what is queued without locks, then write synchronously from
+ * here on. Safe from any CPU in any state; for panic(). */
+void serial_panic(void);
 
 #endif /* ORION_SERIAL_H */
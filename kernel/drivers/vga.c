@@ -1,4 +1,5 @@
 #include "vga.h"
+#include "core/lock.h"
 #include <stdint.h>
 
 
@@ -11,6 +12,10 @@ static volatile uint16_t *const VGA_BUFFER = (uint16_t *)0xB8000;
 
 static size_t vga_row = 0;
 static size_t vga_col = 0;
+/* Cursor and buffer. Taken with interrupts off, since handlers print too;
+ * a whole vga_write() goes out under one acquisition so lines from
+ * different CPUs do not interleave. */
+static ticket_lock_t vga_lock = TICKET_LOCK_INIT("vga");
 
 static inline uint16_t make_entry(char c, uint8_t color) {
     return (uint16_t)c | ((uint16_t)color << 8);
@@ -21,14 +26,16 @@ static const uint8_t DEFAULT_ATTR = 0x07;
 void vga_init(void) {
     size_t total_cells = VGA_WIDTH * VGA_HEIGHT; // Define total_cells locally
     uint16_t blank_entry = make_entry(' ', DEFAULT_ATTR); // Precompute the blank cell with a space
+    uint64_t flags = ticket_lock_irqsave(&vga_lock);
     for (size_t i = 0; i < total_cells; ++i) {
         VGA_BUFFER[i] = blank_entry;
     }
     vga_row = 0; vga_col = 0;
+    ticket_unlock_irqrestore(&vga_lock, flags);
 }
 
 
-void vga_putc(char c) {
+static void putc_locked(char c) {
     if (c == '\n') {
         vga_col = 0; ++vga_row;
         if (vga_row >= VGA_HEIGHT) vga_row = 0;
@@ -42,6 +49,14 @@ void vga_putc(char c) {
     }
 }
 
+void vga_putc(char c) {
+    uint64_t flags = ticket_lock_irqsave(&vga_lock);
+    putc_locked(c);
+    ticket_unlock_irqrestore(&vga_lock, flags);
+}
+
 void vga_write(const char *s) {
-    while (*s) vga_putc(*s++);
+    uint64_t flags = ticket_lock_irqsave(&vga_lock);
+    while (*s) putc_locked(*s++);
+    ticket_unlock_irqrestore(&vga_lock, flags);
 }
@@ -1,6 +1,8 @@
+#define LOG_CAT LOG_CAT_FS
 #include "fs/fs.h"
-#include "drivers/serial.h" // Corrected path for serial_write
+#include "core/log.h"
 #include "drivers/vga.h"
+#include "core/lock.h"
 #include <stddef.h>
 #include <string.h>
 #include <stdint.h>
@@ -12,22 +14,30 @@
 struct block blocks[MAX_BLOCKS];
 static uint8_t ramdisk[MAX_BLOCKS * RAMDISK_BLOCK_SIZE];
 
+// Initrd (initial RAM disk) support
+static const uint8_t *initrd_base = NULL;
+static size_t initrd_size = 0;
+
+// Guards blocks[], the ramdisk contents and the initrd pointer. Block reads
+// far outnumber writes, and readers copy out in parallel.
+static rwlock_t fs_lock = RWLOCK_INIT("fs");
+
 void init_blocks() {
+    write_lock(&fs_lock);
     for (size_t i = 0; i < MAX_BLOCKS; i++) {
         blocks[i].size = 0;
         blocks[i].address = NULL;
         blocks[i].process_id = -1; // -1 indicates the block is free
     }
+    write_unlock(&fs_lock);
 }
 
-// Initrd (initial RAM disk) support
-static const uint8_t *initrd_base = NULL;
-static size_t initrd_size = 0;
-
 // Call this at boot with the initrd address and size
 void init_ramdisk(const void *base, size_t size) {
+    write_lock(&fs_lock);
     initrd_base = (const uint8_t *)base;
     initrd_size = size;
+    write_unlock(&fs_lock);
 }
 
 // Tiny block device API
@@ -39,26 +49,32 @@ int read_blocks(int dev, size_t lba, size_t count, void *buf) {
     (void)dev; // Only one device for now
     size_t offset = lba * RAMDISK_BLOCK_SIZE;
     size_t bytes = count * RAMDISK_BLOCK_SIZE;
+    int ret = 0;
+    read_lock(&fs_lock);
     if (initrd_base) {
-        if (offset + bytes > initrd_size) return -1;
-        memcpy(buf, initrd_base + offset, bytes);
-        return 0;
+        if (offset + bytes > initrd_size) ret = -1;
+        else memcpy(buf, initrd_base + offset, bytes);
+    } else if (offset + bytes > sizeof(ramdisk)) {
+        ret = -1;
+    } else {
+        // Fall back to in-memory ramdisk
+        memcpy(buf, &ramdisk[offset], bytes);
     }
-    // Fall back to in-memory ramdisk
-    if (offset + bytes > sizeof(ramdisk)) return -1;
-    memcpy(buf, &ramdisk[offset], bytes);
-    return 0;
+    read_unlock(&fs_lock);
+    return ret;
 }
 
 int write_blocks(int dev, size_t lba, size_t count, const void *buf) {
     (void)dev; // Read-only
     size_t offset = lba * RAMDISK_BLOCK_SIZE;
     size_t bytes = count * RAMDISK_BLOCK_SIZE;
-    // If initrd is present, treat it as read-only
-    if (initrd_base) return -1;
     if (offset + bytes > sizeof(ramdisk)) return -1;
-    memcpy(&ramdisk[offset], buf, bytes);
-    return 0;
+    write_lock(&fs_lock);
+    // If initrd is present, treat it as read-only
+    int ret = initrd_base ? -1 : 0;
+    if (!ret) memcpy(&ramdisk[offset], buf, bytes);
+    write_unlock(&fs_lock);
+    return ret;
 }
 
 // Simple test for RAM-disk block API
@@ -105,9 +121,11 @@ int fs_init(void) {
          being visible to subsequent reads. For the simple demo (hello world)
          we use the in-memory `ramdisk` buffer as the device backing. */
      init_blocks();
+     write_lock(&fs_lock);
      memset(ramdisk, 0, sizeof(ramdisk));
+     write_unlock(&fs_lock);
 
-     serial_write("[fs] initialized in-memory ramdisk\n");
+     LOG_INFO("fs: initialized in-memory ramdisk");
      vga_puts_local("[fs] initialized in-memory ramdisk\n");
      vga_write_direct("[fs] initialized in-memory ramdisk\n");
 
@@ -7,36 +7,75 @@
 #include "core/io.h"
 #include "core/process.h"
 #include "core/pmm.h"
+#include "core/slab.h"
+#include "core/sched.h"
+#include "core/lock.h"
+#include "core/rcu.h"
+#include "core/timer.h"
+#include "core/trace.h"
+#include "arch/x86_64/cpu.h"
+#include "arch/x86_64/mm/vmm.h"
+#include "arch/x86_64/interrupts/idt.h"
+#include "arch/x86_64/smp/smp.h"
+#include "arch/x86_64/sched/fpu.h"
 #include "boot/multiboot2.h"
 #include "fs/fs.h"
 #include "lib/printf.h"
+#include "lib/mem.h"
 
 extern char __git_shortsha[];
+extern char _kernel_start[], _kernel_end[];
 
 void parent_process_entry(void) {
     printf("Welcome to Orion OS\n");
-    for (;;) __asm__ volatile ("hlt");
+    uint64_t start = timer_now_ns();
+    sched_sleep_ns(10000000);
+    LOG_INFO("kmain: slept 10 ms in %lu us", (unsigned long)((timer_now_ns() - start) / 1000));
+    sched_print_stats();
+    timer_print_stats();
+    lock_print_stats();
+    rcu_print_stats();
 }
 
 void kmain(void *mb_info) {
+    arch_x86_percpu_init_bsp();
     serial_init();
+    mem_init();
     vga_init();
     printf("==== Orion OS Kernel Boot ====" "\n");
+    arch_x86_idt_init();
 
     phys_mem_region_t map[32];
     size_t map_entries = parse_multiboot2(mb_info, map, 32);
+    log_parse_cmdline(multiboot2_cmdline());
 
-    #define ORION_PMM_POLICY PMM_BITMAP_FINE
+    #ifndef ORION_PMM_POLICY
+    #define ORION_PMM_POLICY PMM_BITMAP_FINE // or PMM_BITMAP_COARSE, PMM_BUDDY
+    #endif
 
+    pmm_set_kernel_range((uint64_t)_kernel_start, (uint64_t)_kernel_end);
     if (map_entries == 0) {
         pmm_init(ORION_PMM_POLICY);
     } else {
         pmm_init_from_map(map, map_entries, ORION_PMM_POLICY);
     }
 
-    Process parent = {
-        .entry_point = parent_process_entry
-    };
+    pmm_print_memory_map();
+
+    /* Switches to the kernel's own page tables and moves phys_to_virt() to
+     * the HHDM, so it has to run before anything caches a virtual address. */
+    if (vmm_init(map, map_entries) != 0) {
+        PANIC("vmm_init failed");
+    }
+
+    pmm_self_test();
+    print_pmm_metrics();
+
+    if (slab_init() != 0) {
+        PANIC("slab_init failed");
+    }
+    vmm_self_test();
+    vmm_print_stats();
 
     int fs_status = fs_init();
     if (fs_status == 0) {
@@ -63,5 +102,33 @@ void kmain(void *mb_info) {
         serial_write("[kernel] failed to read from disk\n");
     }
 
-    parent.entry_point();
+    /* From here on the boot thread is CPU 0's idle task. */
+    sched_init();
+    mem_set_fpu(sched_fpu_begin, sched_fpu_end, arch_x86_fpu_avx());
+    LOG_INFO("mem: copy/set %s, %s non-temporal from %u KiB, compare words, sse2 from %u bytes", mem_copy_impl,
+             mem_nt_impl, MEM_NT_THRESHOLD / 1024, MEM_SIMD_CMP_MIN);
+    serial_irq_init();
+    arch_x86_smp_init(multiboot2_acpi_rsdp(), sched_ap_main);
+    Process *parent = kmalloc(sizeof(*parent));
+    if (!parent) PANIC("out of memory for the first process");
+    *parent = (Process){
+        .name = "parent",
+        .pid = 1,
+        .entry_point = parent_process_entry
+    };
+    process_publish(parent);
+    if (sched_spawn(parent) != 0) PANIC("sched_spawn failed");
+#if LOG_BINARY
+    Process *traced = kmalloc(sizeof(*traced));
+    if (!traced) PANIC("out of memory for the trace drain");
+    *traced = (Process){ .name = "traced", .entry_point = trace_drain_main };
+    if (sched_spawn(traced) != 0) PANIC("sched_spawn failed");
+#endif
+    arch_x86_irq_enable();
+
+    for (;;) {
+        /* Idle: finish PMM init and refill the zeroed-frame pool before sleeping */
+        if (pmm_deferred_init_step(PMM_DEFER_CHUNK_PAGES) == 0 && pmm_zero_idle_work(PMM_ZERO_BATCH) == 0)
+            sched_idle();
+    }
 }
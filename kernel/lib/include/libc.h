@@ -9,10 +9,14 @@ extern "C" {
 
 void *memset(void *s, int c, size_t n);
 void *memcpy(void *dest, const void *src, size_t n);
+void *memmove(void *dest, const void *src, size_t n);
 int memcmp(const void *a, const void *b, size_t n);
+void *memchr(const void *s, int c, size_t n);
 int strcmp(const char *a, const char *b);
 size_t strlen(const char *s);
 size_t strnlen(const char *s, size_t maxlen);
+char *strchr(const char *s, int c);
+char *strncpy(char *dest, const char *src, size_t n);
 int printf(const char *fmt, ...);
 
 #ifdef __cplusplus
@@ -1,29 +1,159 @@
 #include "libc.h"
+#include "lib/mem.h"
+#include <stdint.h>
+#include <cpuid.h>
 
-void *memset(void *s, int c, size_t n) {
-    unsigned char *p = (unsigned char *)s;
-    while (n--) {
-        *p++ = (unsigned char)c;
+/* Unaligned, alias-anything 64-bit access for the word loops. */
+typedef uint64_t __attribute__((may_alias, aligned(1))) u64u;
+
+#define CPUID_7_EBX_AVX2 (1u << 5)
+#define CPUID_7_EBX_ERMS (1u << 9)
+#define CPUID_7_EDX_FSRM (1u << 4)
+
+/* --- Word loops: the baseline, and the fallback for every other path --- */
+
+void *memcpy_words(void *dest, const void *src, size_t n) {
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+    for (; n >= 32; n -= 32, d += 32, s += 32) {
+        uint64_t a = ((const u64u *)s)[0], b = ((const u64u *)s)[1];
+        uint64_t c = ((const u64u *)s)[2], e = ((const u64u *)s)[3];
+        ((u64u *)d)[0] = a;
+        ((u64u *)d)[1] = b;
+        ((u64u *)d)[2] = c;
+        ((u64u *)d)[3] = e;
+    }
+    for (; n >= 8; n -= 8, d += 8, s += 8) *(u64u *)d = *(const u64u *)s;
+    while (n--) *d++ = *s++;
+    return dest;
+}
+
+void *memset_words(void *s, int c, size_t n) {
+    uint8_t *d = s;
+    uint64_t v = 0x0101010101010101ULL * (uint8_t)c;
+    for (; n && ((uintptr_t)d & 7); n--) *d++ = (uint8_t)c;
+    for (; n >= 32; n -= 32, d += 32) {
+        ((uint64_t *)d)[0] = v;
+        ((uint64_t *)d)[1] = v;
+        ((uint64_t *)d)[2] = v;
+        ((uint64_t *)d)[3] = v;
     }
+    for (; n >= 8; n -= 8, d += 8) *(uint64_t *)d = v;
+    while (n--) *d++ = (uint8_t)c;
     return s;
 }
 
-void *memcpy(void *dest, const void *src, size_t n) {
-    unsigned char *d = (unsigned char *)dest;
-    const unsigned char *s = (const unsigned char *)src;
-    while (n--) {
-        *d++ = *s++;
+/* The first differing word decides; byte-swapped, it compares like the
+ * bytes in memory order. */
+int memcmp_words(const void *a, const void *b, size_t n) {
+    const uint8_t *pa = a, *pb = b;
+    for (; n >= 8; n -= 8, pa += 8, pb += 8) {
+        uint64_t x = *(const u64u *)pa, y = *(const u64u *)pb;
+        if (x != y) return __builtin_bswap64(x) < __builtin_bswap64(y) ? -1 : 1;
+    }
+    for (; n; n--, pa++, pb++)
+        if (*pa != *pb) return (int)*pa - (int)*pb;
+    return 0;
+}
+
+/* Overlap-safe. A forward copy is safe when dest is below src: each word
+ * is read before anything at or above it is written. Above src, copy
+ * backwards. */
+void *memmove_words(void *dest, const void *src, size_t n) {
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+    if (d <= s) return memcpy_words(dest, src, n);
+    d += n;
+    s += n;
+    for (; n >= 8; n -= 8) {
+        d -= 8;
+        s -= 8;
+        *(u64u *)d = *(const u64u *)s;
     }
+    while (n--) *--d = *--s;
+    return dest;
+}
+
+/* --- Fast strings --- */
+
+void *memcpy_rep_movsb(void *dest, const void *src, size_t n) {
+    void *d = dest;
+    __asm__ volatile ("rep movsb" : "+D"(d), "+S"(src), "+c"(n) :: "memory");
     return dest;
 }
 
+void *memset_rep_stosb(void *s, int c, size_t n) {
+    void *d = s;
+    __asm__ volatile ("rep stosb" : "+D"(d), "+c"(n) : "a"(c) : "memory");
+    return s;
+}
+
+/* --- Dispatch --- */
+
+static void *(*copy_fn)(void *, const void *, size_t) = memcpy_words;
+static void *(*set_fn)(void *, int, size_t) = memset_words;
+static void *(*copy_nt_fn)(void *, const void *, size_t);
+static void *(*set_nt_fn)(void *, int, size_t);
+static size_t erms_min = SIZE_MAX;
+static int (*fpu_begin)(void);
+static void (*fpu_end)(void);
+static int has_avx2;
+
+const char *mem_copy_impl = "words";
+const char *mem_nt_impl = "none";
+
+void mem_init(void) {
+    unsigned a, c, ebx7 = 0, edx7 = 0;
+    __get_cpuid_count(7, 0, &a, &ebx7, &c, &edx7);      // leaves them alone without leaf 7
+    if (ebx7 & CPUID_7_EBX_ERMS) {
+        erms_min = (edx7 & CPUID_7_EDX_FSRM) ? 0 : MEM_ERMS_MIN;
+        copy_fn = memcpy_rep_movsb;
+        set_fn = memset_rep_stosb;
+        mem_copy_impl = erms_min ? "rep (erms)" : "rep (fsrm)";
+    }
+    has_avx2 = (ebx7 & CPUID_7_EBX_AVX2) != 0;
+}
+
+void mem_set_fpu(int (*begin)(void), void (*end)(void), int avx) {
+    int avx2 = has_avx2 && avx;
+    copy_nt_fn = avx2 ? memcpy_avx2_nt : memcpy_sse2_nt;
+    set_nt_fn = avx2 ? memset_avx2_nt : memset_sse2_nt;
+    mem_nt_impl = avx2 ? "avx2" : "sse2";
+    fpu_begin = begin;
+    fpu_end = end;
+}
+
+#ifndef ORION_HOSTED
+void *memcpy(void *dest, const void *src, size_t n) {
+    if (n >= MEM_NT_THRESHOLD && fpu_begin && fpu_begin()) {
+        copy_nt_fn(dest, src, n);
+        fpu_end();
+        return dest;
+    }
+    return n >= erms_min ? copy_fn(dest, src, n) : memcpy_words(dest, src, n);
+}
+
+void *memset(void *s, int c, size_t n) {
+    if (n >= MEM_NT_THRESHOLD && fpu_begin && fpu_begin()) {
+        set_nt_fn(s, c, n);
+        fpu_end();
+        return s;
+    }
+    return n >= erms_min ? set_fn(s, c, n) : memset_words(s, c, n);
+}
+
+void *memmove(void *dest, const void *src, size_t n) {
+    uintptr_t d = (uintptr_t)dest, s = (uintptr_t)src;
+    if (d - s >= n && s - d >= n) return memcpy(dest, src, n);
+    return memmove_words(dest, src, n);
+}
+
 int memcmp(const void *a, const void *b, size_t n) {
-    const unsigned char *pa = (const unsigned char *)a;
-    const unsigned char *pb = (const unsigned char *)b;
-    for (size_t i = 0; i < n; ++i) {
-        if (pa[i] != pb[i]) {
-            return (int)pa[i] - (int)pb[i];
-        }
+    if (n >= MEM_SIMD_CMP_MIN && fpu_begin && fpu_begin()) {
+        int r = memcmp_sse2(a, b, n);
+        fpu_end();
+        return r;
     }
-    return 0;
+    return memcmp_words(a, b, n);
 }
+#endif
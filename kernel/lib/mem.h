@@ -0,0 +1,50 @@
+#ifndef ORION_LIB_MEM_H
+#define ORION_LIB_MEM_H
+
+#include <stddef.h>
+
+/* memcpy/memset/memcmp (lib/include/libc.h) go through implementations
+ * picked once by mem_init() from CPUID and mem_set_fpu():
+ *
+ * - copy and set: `rep movsb`/`rep stosb` with ERMS (for short sizes too
+ *   with FSRM), else 64-bit word loops;
+ * - copy and set of MEM_NT_THRESHOLD bytes or more: AVX2 or SSE2
+ *   non-temporal stores, which do not evict the cache, inside the FPU
+ *   section given to mem_set_fpu(); the cached path when the FPU is not
+ *   available (early boot, nested in an interrupt);
+ * - compare: 64-bit words, SSE2 from MEM_SIMD_CMP_MIN bytes;
+ * - memmove: memcpy() when the buffers do not overlap, else word loops.
+ *
+ * Until mem_init() runs the word loops are used. lib/ knows nothing of the
+ * scheduler: the kernel hands in its FPU section once lazy FPU is up. The
+ * variants are exported for tests/bench_mem.c. */
+#define MEM_NT_THRESHOLD  (4 * 1024 * 1024) // about an LLC; below it, stay cached
+#define MEM_SIMD_CMP_MIN  4096
+#define MEM_ERMS_MIN      128               // shorter copies use words without FSRM
+
+/* Pick the copy/set implementations from CPUID. */
+void mem_init(void);
+
+/* Enable the vector paths. begin() returns nonzero when vector registers
+ * may be used until end(); avx is whether the OS saves the YMM state. */
+void mem_set_fpu(int (*begin)(void), void (*end)(void), int avx);
+
+/* What was picked, for the boot log. */
+extern const char *mem_copy_impl;   // "words", "rep (erms)" or "rep (fsrm)"
+extern const char *mem_nt_impl;     // "avx2" or "sse2"; "none" before mem_set_fpu()
+
+void *memcpy_words(void *dest, const void *src, size_t n);
+void *memcpy_rep_movsb(void *dest, const void *src, size_t n);
+void *memcpy_sse2_nt(void *dest, const void *src, size_t n);
+void *memcpy_avx2_nt(void *dest, const void *src, size_t n);
+void *memmove_words(void *dest, const void *src, size_t n);
+
+void *memset_words(void *s, int c, size_t n);
+void *memset_rep_stosb(void *s, int c, size_t n);
+void *memset_sse2_nt(void *s, int c, size_t n);
+void *memset_avx2_nt(void *s, int c, size_t n);
+
+int memcmp_words(const void *a, const void *b, size_t n);
+int memcmp_sse2(const void *a, const void *b, size_t n);
+
+#endif /* ORION_LIB_MEM_H */
@@ -0,0 +1,104 @@
+#include "lib/mem.h"
+#include <stdint.h>
+#include <immintrin.h>
+
+/* The vector variants of lib/mem.c, built with SSE enabled unlike the rest
+ * of the kernel. The caller owns the FPU (sched_fpu_begin()). Heads and
+ * tails go through the word loops. */
+
+void *memcpy_sse2_nt(void *dest, const void *src, size_t n) {
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    if (head > n) head = n;
+    memcpy_words(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    for (; n >= 64; n -= 64, d += 64, s += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)s), b = _mm_loadu_si128((const __m128i *)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + 32)), e = _mm_loadu_si128((const __m128i *)(s + 48));
+        _mm_stream_si128((__m128i *)d, a);
+        _mm_stream_si128((__m128i *)(d + 16), b);
+        _mm_stream_si128((__m128i *)(d + 32), c);
+        _mm_stream_si128((__m128i *)(d + 48), e);
+    }
+    _mm_sfence();
+    memcpy_words(d, s, n);
+    return dest;
+}
+
+__attribute__((target("avx2")))
+void *memcpy_avx2_nt(void *dest, const void *src, size_t n) {
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+    size_t head = (32 - ((uintptr_t)d & 31)) & 31;
+    if (head > n) head = n;
+    memcpy_words(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    for (; n >= 128; n -= 128, d += 128, s += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)s), b = _mm256_loadu_si256((const __m256i *)(s + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(s + 64)), e = _mm256_loadu_si256((const __m256i *)(s + 96));
+        _mm256_stream_si256((__m256i *)d, a);
+        _mm256_stream_si256((__m256i *)(d + 32), b);
+        _mm256_stream_si256((__m256i *)(d + 64), c);
+        _mm256_stream_si256((__m256i *)(d + 96), e);
+    }
+    _mm_sfence();
+    memcpy_words(d, s, n);
+    return dest;
+}
+
+void *memset_sse2_nt(void *s, int c, size_t n) {
+    uint8_t *d = s;
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    if (head > n) head = n;
+    memset_words(d, c, head);
+    d += head;
+    n -= head;
+    __m128i v = _mm_set1_epi8((char)c);
+    for (; n >= 64; n -= 64, d += 64) {
+        _mm_stream_si128((__m128i *)d, v);
+        _mm_stream_si128((__m128i *)(d + 16), v);
+        _mm_stream_si128((__m128i *)(d + 32), v);
+        _mm_stream_si128((__m128i *)(d + 48), v);
+    }
+    _mm_sfence();
+    memset_words(d, c, n);
+    return s;
+}
+
+__attribute__((target("avx2")))
+void *memset_avx2_nt(void *s, int c, size_t n) {
+    uint8_t *d = s;
+    size_t head = (32 - ((uintptr_t)d & 31)) & 31;
+    if (head > n) head = n;
+    memset_words(d, c, head);
+    d += head;
+    n -= head;
+    __m256i v = _mm256_set1_epi8((char)c);
+    for (; n >= 128; n -= 128, d += 128) {
+        _mm256_stream_si256((__m256i *)d, v);
+        _mm256_stream_si256((__m256i *)(d + 32), v);
+        _mm256_stream_si256((__m256i *)(d + 64), v);
+        _mm256_stream_si256((__m256i *)(d + 96), v);
+    }
+    _mm_sfence();
+    memset_words(d, c, n);
+    return s;
+}
+
+int memcmp_sse2(const void *a, const void *b, size_t n) {
+    const uint8_t *pa = a, *pb = b;
+    for (; n >= 16; n -= 16, pa += 16, pb += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)pa), y = _mm_loadu_si128((const __m128i *)pb);
+        unsigned diff = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFF;
+        if (diff) {
+            unsigned i = __builtin_ctz(diff);
+            return (int)pa[i] - (int)pb[i];
+        }
+    }
+    return memcmp_words(pa, pb, n);
+}
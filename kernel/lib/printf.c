@@ -5,12 +5,16 @@
 #include "../drivers/serial.h"
 #include "../drivers/vga.h"
 
-static void reverse(char *start, char *end);
-static char *utoa(unsigned long val, char *buf, int base, int lowercase);
+#ifdef ORION_HOSTED
+/* tests/bench_printf.c links the formatter next to the host libc. */
+#define vsnprintf orion_vsnprintf
+#define snprintf orion_snprintf
+#endif
 
 int vsnprintf(char *out, size_t size, const char *fmt, va_list ap);
 int snprintf(char *out, size_t size, const char *fmt, ...);
 
+#ifndef ORION_HOSTED
 int printf(const char *fmt, ...) {
     char buf[1024];
     va_list ap;
@@ -28,9 +32,9 @@ void kprintf(const char *fmt, ...) {
     va_start(ap, fmt);
     vsnprintf(buf, sizeof(buf), fmt, ap);
     va_end(ap);
-    serial_init();
     serial_write(buf);
 }
+#endif
 
 int snprintf(char *out, size_t size, const char *fmt, ...) {
     va_list ap;
@@ -40,99 +44,248 @@ int snprintf(char *out, size_t size, const char *fmt, ...) {
     return r;
 }
 
-static void reverse(char *start, char *end) {
-    while (start < end) {
-        char tmp = *start;
-        *start++ = *end;
-        *end-- = tmp;
+/* Output cursor. Text goes straight into buf while it fits; len counts
+ * everything, so vsnprintf() can return the untruncated length. */
+typedef struct {
+    char *buf;
+    size_t cap;                     // bytes of buf for text, not the NUL
+    size_t len;
+} out_t;
+
+static inline void put(out_t *o, char c) {
+    if (o->len < o->cap) o->buf[o->len] = c;
+    o->len++;
+}
+
+static void put_n(out_t *o, const char *s, size_t n) {
+    if (o->len < o->cap) {
+        size_t room = o->cap - o->len;
+        memcpy(o->buf + o->len, s, n < room ? n : room);
+    }
+    o->len += n;
+}
+
+static void pad(out_t *o, char c, size_t n) {
+    if (o->len < o->cap) {
+        size_t room = o->cap - o->len;
+        memset(o->buf + o->len, c, n < room ? n : room);
+    }
+    o->len += n;
+}
+
+#define F_LEFT  1u                  // '-'
+#define F_ZERO  2u                  // '0'
+#define F_PLUS  4u                  // '+'
+#define F_SPACE 8u                  // ' '
+#define F_ALT   16u                 // '#'
+
+typedef struct {
+    unsigned flags;
+    size_t width;
+    int prec;                       // -1 when not given
+} spec_t;
+
+static const char dec_pairs[200] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* Digits of v, written backwards so they end just before `end`; returns
+ * where they start. Decimal goes two digits per division. */
+static char *utoa_rev(char *end, uint64_t v, unsigned base, int upper) {
+    char *p = end;
+    if (base == 10) {
+        while (v >= 100) {
+            unsigned r = (unsigned)(v % 100);
+            v /= 100;
+            p -= 2;
+            p[0] = dec_pairs[2 * r];
+            p[1] = dec_pairs[2 * r + 1];
+        }
+        if (v >= 10) {
+            p -= 2;
+            p[0] = dec_pairs[2 * v];
+            p[1] = dec_pairs[2 * v + 1];
+        } else {
+            *--p = (char)('0' + v);
+        }
+        return p;
     }
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    unsigned shift = base == 16 ? 4 : 3;
+    do {
+        *--p = digits[v & (base - 1)];
+        v >>= shift;
+    } while (v);
+    return p;
 }
 
-static char *utoa(unsigned long val, char *buf, int base, int lowercase) {
-    char *p = buf;
-    const char *digits = lowercase ? "0123456789abcdef" : "0123456789ABCDEF";
-    if (val == 0) {
-        *p++ = '0';
-        *p = '\0';
-        return buf;
+static size_t count_digits(uint64_t v, unsigned base) {
+    if (base != 10) {
+        unsigned bits = 64 - (unsigned)__builtin_clzll(v | 1);
+        return base == 16 ? (bits + 3) / 4 : (bits + 2) / 3;
     }
-    while (val) {
-        *p++ = digits[val % base];
-        val /= base;
+    size_t n = 1;
+    for (; v >= 10000; v /= 10000) n += 4;
+    return n + (v >= 10) + (v >= 100) + (v >= 1000);
+}
+
+/* One integer: [sign or 0x prefix][zeros][digits], padded to the width.
+ * Without flags, width or precision, the digits are written straight into
+ * the output. */
+static void put_num(out_t *o, const spec_t *sp, uint64_t v, int neg, unsigned base, int upper, int ptr) {
+    if (!sp->flags && !sp->width && sp->prec < 0 && !ptr) {
+        if (neg) put(o, '-');
+        size_t nd = count_digits(v, base);
+        if (o->len < o->cap && o->cap - o->len >= nd) {
+            utoa_rev(o->buf + o->len + nd, v, base, upper);
+            o->len += nd;
+        } else {
+            char tmp[24];
+            put_n(o, utoa_rev(tmp + sizeof(tmp), v, base, upper), nd);
+        }
+        return;
+    }
+
+    char tmp[24];
+    char *end = tmp + sizeof(tmp);
+    char *digits = sp->prec == 0 && v == 0 ? end : utoa_rev(end, v, base, upper);
+    size_t nd = (size_t)(end - digits);
+    size_t prec = sp->prec > 0 ? (size_t)sp->prec : 0;
+    char prefix[2];
+    size_t np = 0;
+
+    if (neg) prefix[np++] = '-';
+    else if (sp->flags & F_PLUS) prefix[np++] = '+';
+    else if (sp->flags & F_SPACE) prefix[np++] = ' ';
+    if (base == 16 && (ptr || ((sp->flags & F_ALT) && v))) {
+        prefix[np++] = '0';
+        prefix[np++] = upper ? 'X' : 'x';
+    }
+    if (base == 8 && (sp->flags & F_ALT) && prec <= nd && (nd == 0 || *digits != '0')) prec = nd + 1;
+
+    size_t zeros = prec > nd ? prec - nd : 0;
+    size_t body = np + zeros + nd;
+    if (sp->prec < 0 && (sp->flags & (F_ZERO | F_LEFT)) == F_ZERO && sp->width > body) {
+        zeros += sp->width - body;
+        body = sp->width;
     }
-    *p = '\0';
-    reverse(buf, p - 1);
-    return buf;
+    if (!(sp->flags & F_LEFT) && sp->width > body) pad(o, ' ', sp->width - body);
+    if (np) put_n(o, prefix, np);
+    if (zeros) pad(o, '0', zeros);
+    put_n(o, digits, nd);
+    if ((sp->flags & F_LEFT) && sp->width > body) pad(o, ' ', sp->width - body);
 }
 
+static void put_str(out_t *o, const spec_t *sp, const char *s, size_t n) {
+    if (!(sp->flags & F_LEFT) && sp->width > n) pad(o, ' ', sp->width - n);
+    put_n(o, s, n);
+    if ((sp->flags & F_LEFT) && sp->width > n) pad(o, ' ', sp->width - n);
+}
+
+/* C99 semantics: flags "-0+ #", width and precision (also '*'), lengths
+ * hh/h/l/ll/z/j/t and conversions d i u o x X c s p %. Returns the length
+ * the whole output would have; at most size - 1 bytes of it are stored,
+ * always NUL-terminated when size > 0. */
 int vsnprintf(char *out, size_t size, const char *fmt, va_list ap) {
-    char *start = out;
-    size_t left = size ? size - 1 : 0;
-
-    while (*fmt) {
-        if (*fmt != '%') {
-            if (left) { *out++ = *fmt; --left; }
-            ++fmt;
-            continue;
+    out_t o = { .buf = out, .cap = size ? size - 1 : 0, .len = 0 };
+
+    for (;;) {
+        const char *pct = fmt;
+        while (*pct && *pct != '%') pct++;
+        if (pct != fmt) put_n(&o, fmt, (size_t)(pct - fmt));
+        if (!*pct) break;
+        fmt = pct + 1;
+
+        spec_t sp = { .flags = 0, .width = 0, .prec = -1 };
+        for (;; fmt++) {
+            if (*fmt == '-') sp.flags |= F_LEFT;
+            else if (*fmt == '0') sp.flags |= F_ZERO;
+            else if (*fmt == '+') sp.flags |= F_PLUS;
+            else if (*fmt == ' ') sp.flags |= F_SPACE;
+            else if (*fmt == '#') sp.flags |= F_ALT;
+            else break;
         }
-        ++fmt;
-        int longflag = 0;
-        if (*fmt == 'l') { longflag = 1; ++fmt; }
-        char buf[32];
-        switch (*fmt++) {
-            case 'c': {
-                char c = (char)va_arg(ap, int);
-                if (left) { *out++ = c; --left; }
-                break;
+        if (*fmt == '*') {
+            int w = va_arg(ap, int);
+            if (w < 0) { sp.flags |= F_LEFT; w = -w; }
+            sp.width = (size_t)w;
+            fmt++;
+        } else {
+            while (*fmt >= '0' && *fmt <= '9') sp.width = sp.width * 10 + (size_t)(*fmt++ - '0');
+        }
+        if (*fmt == '.') {
+            fmt++;
+            sp.prec = 0;
+            if (*fmt == '*') {
+                int p = va_arg(ap, int);
+                sp.prec = p < 0 ? -1 : p;
+                fmt++;
+            } else {
+                while (*fmt >= '0' && *fmt <= '9') sp.prec = sp.prec * 10 + (*fmt++ - '0');
             }
-            case 's': {
-                const char *s = va_arg(ap, const char *);
-                while (*s) {
-                    if (left) { *out++ = *s; --left; }
-                    ++s;
-                }
+        }
+
+        /* 0: int, 1: long and wider (all 64-bit here); negative: char, short. */
+        int len = 0;
+        if (*fmt == 'h') {
+            len = -1;
+            if (*++fmt == 'h') { len = -2; fmt++; }
+        } else if (*fmt == 'l') {
+            len = 1;
+            if (*++fmt == 'l') fmt++;
+        } else if (*fmt == 'z' || *fmt == 'j' || *fmt == 't') {
+            len = 1;
+            fmt++;
+        }
+
+        char conv = *fmt;
+        if (!conv) break;
+        fmt++;
+        switch (conv) {
+            case 'd':
+            case 'i': {
+                int64_t v = len > 0 ? va_arg(ap, long) : va_arg(ap, int);
+                if (len == -1) v = (short)v;
+                else if (len == -2) v = (signed char)v;
+                put_num(&o, &sp, v < 0 ? 0 - (uint64_t)v : (uint64_t)v, v < 0, 10, 0, 0);
                 break;
             }
-            case 'd': {
-                long val = longflag ? va_arg(ap, long) : va_arg(ap, int);
-                if (val < 0) { if (left) { *out++ = '-'; --left; } val = -val; }
-                utoa((unsigned long)val, buf, 10, 0);
-                char *p = buf;
-                while (*p) { if (left) { *out++ = *p++; --left; } else { ++p; } }
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o': {
+                uint64_t v = len > 0 ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+                if (len == -1) v = (unsigned short)v;
+                else if (len == -2) v = (unsigned char)v;
+                sp.flags &= ~(F_PLUS | F_SPACE);
+                put_num(&o, &sp, v, 0, conv == 'u' ? 10 : conv == 'o' ? 8 : 16, conv == 'X', 0);
                 break;
             }
-            case 'u': {
-                unsigned long val = longflag ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
-                utoa(val, buf, 10, 0);
-                char *p = buf;
-                while (*p) { if (left) { *out++ = *p++; --left; } else { ++p; } }
+            case 'p': {
+                sp.flags &= ~(F_PLUS | F_SPACE | F_ALT);
+                put_num(&o, &sp, (uintptr_t)va_arg(ap, void *), 0, 16, 0, 1);
                 break;
             }
-            case 'x': {
-                unsigned long val = longflag ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
-                utoa(val, buf, 16, 1);
-                char *p = buf;
-                while (*p) { if (left) { *out++ = *p++; --left; } else { ++p; } }
+            case 'c': {
+                char c = (char)va_arg(ap, int);
+                put_str(&o, &sp, &c, 1);
                 break;
             }
-            case 'p': {
-                void *ptr = va_arg(ap, void *);
-                unsigned long val = (unsigned long)ptr;
-                utoa(val, buf, 16, 1);
-                char *p = buf;
-                if (left) { *out++ = '0'; --left; }
-                if (left) { *out++ = 'x'; --left; }
-                while (*p) { if (left) { *out++ = *p++; --left; } else { ++p; } }
+            case 's': {
+                const char *s = va_arg(ap, const char *);
+                if (!s) s = "(null)";
+                put_str(&o, &sp, s, sp.prec >= 0 ? strnlen(s, (size_t)sp.prec) : strlen(s));
                 break;
             }
-            case '%': {
-                if (left) { *out++ = '%'; --left; }
+            case '%':
+                put(&o, '%');
                 break;
-            }
             default:
                 break;
         }
     }
-    *out = '\0';
-    return out - start;
+
+    if (size) out[o.len < o.cap ? o.len : o.cap] = '\0';
+    return (int)o.len;
 }
@@ -1,9 +0,0 @@
-#include "libc.h"
-
-int strcmp(const char *a, const char *b) {
-    while (*a && (*a == *b)) {
-        ++a;
-        ++b;
-    }
-    return (unsigned char)*a - (unsigned char)*b;
-}
@@ -1,14 +1,112 @@
 #include "libc.h"
+#include "lib/strings.h"
+#include <stdint.h>
 
-size_t strlen(const char *s) {
-    const char *p = s;
-    while (*p) ++p;
-    return (size_t)(p - s);
+#define PAGE 4096
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+/* Aligned and unaligned word access that may alias char data. */
+typedef uint64_t __attribute__((may_alias)) u64a;
+typedef uint64_t __attribute__((may_alias, aligned(1))) u64u;
+
+/* Bit 7 set in the first zero byte of w (and maybe in bytes after it). */
+static inline uint64_t zero_bytes(uint64_t w) { return (w - ONES) & ~w & HIGHS; }
+
+/* Whether an n-byte load at p stays inside p's page. */
+static inline int fits_page(const void *p, size_t n) { return ((uintptr_t)p & (PAGE - 1)) <= PAGE - n; }
+
+/* --- Word scans --- */
+
+/* The aligned word covering s, and a mask of the bytes in it before s.
+ * Callers OR the mask into each tested word so those bytes never match. */
+static inline uint64_t first_word(const void *s, const u64a **wp, uint64_t *front) {
+    unsigned off = (uintptr_t)s & 7;
+    *wp = (const u64a *)((uintptr_t)s & ~(uintptr_t)7);
+    *front = off ? (1ULL << (8 * off)) - 1 : 0;
+    return **wp;
+}
+
+size_t strlen_words(const char *s) {
+    const u64a *p;
+    uint64_t front, z = zero_bytes(first_word(s, &p, &front) | front);
+    while (!z) z = zero_bytes(*++p);
+    return (size_t)((const char *)p - s) + (__builtin_ctzll(z) >> 3);
+}
+
+size_t strnlen_words(const char *s, size_t maxlen) {
+    if (!maxlen) return 0;
+    const u64a *p;
+    uint64_t front, z = zero_bytes(first_word(s, &p, &front) | front);
+    while (!z) {
+        if ((size_t)((const char *)++p - s) >= maxlen) return maxlen;
+        z = zero_bytes(*p);
+    }
+    size_t len = (size_t)((const char *)p - s) + (__builtin_ctzll(z) >> 3);
+    return len < maxlen ? len : maxlen;
+}
+
+/* The first byte that differs or ends a is where the comparison stops. */
+int strcmp_words(const char *a, const char *b) {
+    for (;;) {
+        if (!fits_page(a, 8) || !fits_page(b, 8)) {
+            unsigned char x = (unsigned char)*a++, y = (unsigned char)*b++;
+            if (x != y || !x) return x - y;
+            continue;
+        }
+        uint64_t x = *(const u64u *)a, y = *(const u64u *)b;
+        uint64_t stop = (x ^ y) | zero_bytes(x);
+        if (stop) {
+            unsigned i = __builtin_ctzll(stop) >> 3;
+            return (unsigned char)a[i] - (unsigned char)b[i];
+        }
+        a += 8;
+        b += 8;
+    }
+}
+
+/* Stops at a zero byte or a c byte, whichever comes first. */
+char *strchr_words(const char *s, int c) {
+    uint64_t pat = ONES * (uint8_t)c;
+    const u64a *p;
+    uint64_t front, w = first_word(s, &p, &front);
+    uint64_t hit = zero_bytes(w | front) | zero_bytes((w ^ pat) | front);
+    while (!hit) {
+        w = *++p;
+        hit = zero_bytes(w) | zero_bytes(w ^ pat);
+    }
+    const char *r = (const char *)p + (__builtin_ctzll(hit) >> 3);
+    return *r == (char)c ? (char *)r : NULL;
+}
+
+void *memchr_words(const void *s, int c, size_t n) {
+    if (!n) return NULL;
+    uint64_t pat = ONES * (uint8_t)c;
+    const u64a *p;
+    uint64_t front, hit = zero_bytes((first_word(s, &p, &front) ^ pat) | front);
+    while (!hit) {
+        if ((size_t)((const char *)++p - (const char *)s) >= n) return NULL;
+        hit = zero_bytes(*p ^ pat);
+    }
+    const char *r = (const char *)p + (__builtin_ctzll(hit) >> 3);
+    return (size_t)(r - (const char *)s) < n ? (void *)r : NULL;
 }
 
-size_t strnlen(const char *s, size_t maxlen) {
-    const char *p = s;
-    size_t i = 0;
-    while (i < maxlen && *p) { ++p; ++i; }
-    return i;
+#ifndef ORION_HOSTED
+size_t strlen(const char *s) { return strlen_words(s); }
+
+size_t strnlen(const char *s, size_t maxlen) { return strnlen_words(s, maxlen); }
+
+int strcmp(const char *a, const char *b) { return strcmp_words(a, b); }
+
+char *strchr(const char *s, int c) { return strchr_words(s, c); }
+
+void *memchr(const void *s, int c, size_t n) { return memchr_words(s, c, n); }
+
+char *strncpy(char *dest, const char *src, size_t n) {
+    size_t len = strnlen_words(src, n);
+    memcpy(dest, src, len);
+    memset(dest + len, 0, n - len);
+    return dest;
 }
+#endif
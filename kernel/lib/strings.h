@@ -0,0 +1,30 @@
+#ifndef ORION_LIB_STRINGS_H
+#define ORION_LIB_STRINGS_H
+
+#include <stddef.h>
+
+/* The string functions of lib/include/libc.h scan a 64-bit word at a time:
+ * a word holds a zero byte iff (w - 0x01..01) & ~w & 0x80..80 is nonzero,
+ * and the lowest marked byte is the first zero.
+ *
+ * Nothing may read past the terminator into an unmapped page. Scans load
+ * whole aligned words (16 bytes for SSE2), which never straddle a page, and
+ * ignore the bytes in front of the string. strcmp() reads two strings at
+ * different alignments with unaligned loads and steps bytewise whenever a
+ * load would cross into the next page.
+ *
+ * The kernel calls the word versions. The SSE2 ones are only for code that
+ * already holds the FPU (sched_fpu_begin()): saving the owner's state costs
+ * more than scanning a short string. The variants are exported for
+ * tests/bench_str.c. */
+
+size_t strlen_words(const char *s);
+size_t strlen_sse2(const char *s);
+size_t strnlen_words(const char *s, size_t maxlen);
+size_t strnlen_sse2(const char *s, size_t maxlen);
+int strcmp_words(const char *a, const char *b);
+int strcmp_sse2(const char *a, const char *b);
+char *strchr_words(const char *s, int c);
+void *memchr_words(const void *s, int c, size_t n);
+
+#endif /* ORION_LIB_STRINGS_H */
@@ -0,0 +1,58 @@
+#include "lib/strings.h"
+#include <stdint.h>
+#include <immintrin.h>
+
+/* The SSE2 variants of lib/strings.c, built with SSE enabled unlike the
+ * rest of the kernel. The caller owns the FPU. */
+
+#define PAGE 4096
+
+/* Whether an n-byte load at p stays inside p's page. */
+static inline int fits_page(const void *p, size_t n) { return ((uintptr_t)p & (PAGE - 1)) <= PAGE - n; }
+
+/* Mask of zero bytes in the aligned 16 bytes at p. */
+static inline unsigned zero_mask16(const char *p) {
+    __m128i v = _mm_load_si128((const __m128i *)p);
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+}
+
+size_t strlen_sse2(const char *s) {
+    const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)15);
+    unsigned m = zero_mask16(p) >> ((uintptr_t)s & 15);
+    if (m) return __builtin_ctz(m);
+    do p += 16; while (!(m = zero_mask16(p)));
+    return (size_t)(p - s) + __builtin_ctz(m);
+}
+
+size_t strnlen_sse2(const char *s, size_t maxlen) {
+    if (!maxlen) return 0;
+    const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)15);
+    unsigned m = zero_mask16(p) >> ((uintptr_t)s & 15);
+    if (m) return (size_t)__builtin_ctz(m) < maxlen ? (size_t)__builtin_ctz(m) : maxlen;
+    do {
+        p += 16;
+        if ((size_t)(p - s) >= maxlen) return maxlen;
+    } while (!(m = zero_mask16(p)));
+    size_t len = (size_t)(p - s) + __builtin_ctz(m);
+    return len < maxlen ? len : maxlen;
+}
+
+int strcmp_sse2(const char *a, const char *b) {
+    for (;;) {
+        if (!fits_page(a, 16) || !fits_page(b, 16)) {
+            unsigned char x = (unsigned char)*a++, y = (unsigned char)*b++;
+            if (x != y || !x) return x - y;
+            continue;
+        }
+        __m128i x = _mm_loadu_si128((const __m128i *)a), y = _mm_loadu_si128((const __m128i *)b);
+        unsigned same = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+        unsigned zero = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_setzero_si128()));
+        unsigned stop = (~same | zero) & 0xFFFF;
+        if (stop) {
+            unsigned i = __builtin_ctz(stop);
+            return (unsigned char)a[i] - (unsigned char)b[i];
+        }
+        a += 16;
+        b += 16;
+    }
+}
@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+"""Decode Orion OS binary trace rings (kernel/core/trace.h) from a dump.
+
+The dump is the raw contents of the kernel's `trace_rings` array, e.g.
+from GDB attached to QEMU:
+
+    (gdb) dump binary value trace.bin trace_rings
+
+Format strings and %s arguments are read from the kernel ELF, together with
+the ring layout (`trace_layout`). Every complete record still in the rings
+is printed, oldest first across CPUs.
+
+    scripts/trace_decode.py build/kernel.elf trace.bin [--tsc-khz N]
+"""
+import argparse
+import re
+import struct
+import sys
+
+TRACE_MAGIC = 0x45435254
+SHT_SYMTAB = 2
+SHT_NOBITS = 8
+SPEC = re.compile(r"%([-+ #0]*)(\d*)(?:\.(\d+))?(hh|h|ll|l|z|j|t)?([diouxXcsp%])")
+
+
+class Elf:
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF" or self.data[4] != 2:
+            sys.exit(f"{path}: not an ELF64 file")
+        shoff, = struct.unpack_from("<Q", self.data, 0x28)
+        shentsize, shnum = struct.unpack_from("<HH", self.data, 0x3A)
+        self.sections = []
+        for i in range(shnum):
+            (name, stype, flags, addr, off, size, link, info, align,
+             entsize) = struct.unpack_from("<IIQQQQIIQQ", self.data, shoff + i * shentsize)
+            self.sections.append((stype, addr, off, size, link, entsize))
+        self.symbols = {}
+        for stype, _, off, size, link, entsize in self.sections:
+            if stype != SHT_SYMTAB:
+                continue
+            stroff = self.sections[link][2]
+            for p in range(off, off + size, entsize):
+                name, _, _, _, value, ssize = struct.unpack_from("<IBBHQQ", self.data, p)
+                end = self.data.index(b"\0", stroff + name)
+                self.symbols[self.data[stroff + name:end].decode()] = (value, ssize)
+
+    def read(self, addr, size):
+        for stype, saddr, off, ssize, _, _ in self.sections:
+            if stype != SHT_NOBITS and saddr and saddr <= addr < saddr + ssize:
+                start = off + addr - saddr
+                return self.data[start:start + min(size, saddr + ssize - addr)]
+        return None
+
+    def string(self, addr):
+        raw = self.read(addr, 4096)
+        if raw is None:
+            return None
+        return raw.split(b"\0", 1)[0].decode(errors="replace")
+
+
+def fit(value, length, signed):
+    bits = {"hh": 8, "h": 16, None: 32}.get(length, 64)
+    value &= (1 << bits) - 1
+    if signed and value >> (bits - 1):
+        value -= 1 << bits
+    return value
+
+
+def render(elf, fmt, args):
+    args = iter(args)
+
+    def one(m):
+        flags, width, prec, length, conv = m.groups()
+        if conv == "%":
+            return "%"
+        v = next(args, 0)
+        spec = "%" + flags + width + ("." + prec if prec else "")
+        if conv == "s":
+            s = elf.string(v)
+            return (spec + "s") % (s if s is not None else f"<{v:#x}>")
+        if conv == "p":
+            return (spec + "s") % f"{v:#x}"
+        if conv == "c":
+            return (spec + "c") % chr(v & 0xFF)
+        signed = conv in "di"
+        return (spec + {"u": "d", "i": "d"}.get(conv, conv)) % fit(v, length, signed)
+
+    return SPEC.sub(one, fmt)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("elf", help="kernel ELF with symbols")
+    ap.add_argument("dump", help="raw dump of trace_rings")
+    ap.add_argument("--tsc-khz", type=int, help="print times in microseconds")
+    opt = ap.parse_args()
+
+    elf = Elf(opt.elf)
+    if "trace_layout" not in elf.symbols:
+        sys.exit("trace_layout not found; is this a kernel with core/trace.c?")
+    raw = elf.read(elf.symbols["trace_layout"][0], 28)
+    magic, cpus, ring_size, rec_size, max_args, recs_offset, ring_bytes = struct.unpack("<7I", raw)
+    if magic != TRACE_MAGIC:
+        sys.exit("trace_layout has a bad magic number")
+    with open(opt.dump, "rb") as f:
+        dump = f.read()
+
+    records = []
+    for cpu in range(min(cpus, len(dump) // ring_bytes)):
+        base = cpu * ring_bytes
+        head, = struct.unpack_from("<Q", dump, base)
+        for idx in range(max(0, head - ring_size), head):
+            p = base + recs_offset + (idx % ring_size) * rec_size
+            seq, tsc, fmt, rcpu, level, nargs = struct.unpack_from("<QQQHBB", dump, p)
+            if seq != idx + 1:
+                continue
+            args = struct.unpack_from(f"<{max_args}Q", dump, p + 32)[:nargs]
+            records.append((tsc, rcpu, level, fmt, args))
+
+    records.sort()
+    first = records[0][0] if records else 0
+    for tsc, cpu, level, fmt, args in records:
+        text = elf.string(fmt)
+        msg = render(elf, text, args) if text is not None else f"<format {fmt:#x}> {list(args)}"
+        when = f"{tsc * 1000 // opt.tsc_khz} us" if opt.tsc_khz else f"+{tsc - first} cycles"
+        print(f"[{level}] cpu{cpu} {when}: {msg}")
+
+
+if __name__ == "__main__":
+    main()
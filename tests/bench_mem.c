@@ -0,0 +1,201 @@
+/* Host-side benchmark of the memcpy/memset/memcmp variants.
+ *
+ * Links kernel/lib/mem.c and mem_simd.c directly (ORION_HOSTED leaves out
+ * the public memcpy/memset/memcmp, so the host libc keeps its own) and
+ * checks every variant against a byte loop at odd sizes and alignments
+ * before timing them from 8 bytes to 16 MiB. The byte loop is what lib/mem.c used to be.
+ * mem_init() runs first and the choice the kernel would make on this CPU
+ * is printed.
+ *
+ * Build and run:  make bench-mem
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "lib/mem.h"
+
+#define MiB (1ULL << 20)
+#define BUF_SIZE (16 * MiB + 64)
+#define CHECKS 20000
+#define BYTES_PER_RUN (64 * MiB)    // each timing moves about this much
+
+/* The FPU is always usable in a host process. */
+static int fpu_begin(void) { return 1; }
+static void fpu_end(void) {}
+
+/* --- Baseline: the old byte loops, kept out of the vectorizer --- */
+
+__attribute__((noinline, optimize("no-tree-vectorize")))
+static void *memcpy_bytes(void *dest, const void *src, size_t n) {
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+    while (n--) *d++ = *s++;
+    return dest;
+}
+
+__attribute__((noinline, optimize("no-tree-vectorize")))
+static void *memset_bytes(void *s, int c, size_t n) {
+    uint8_t *p = s;
+    while (n--) *p++ = (uint8_t)c;
+    return s;
+}
+
+__attribute__((noinline, optimize("no-tree-vectorize")))
+static int memcmp_bytes(const void *a, const void *b, size_t n) {
+    const uint8_t *pa = a, *pb = b;
+    for (; n; n--, pa++, pb++)
+        if (*pa != *pb) return (int)*pa - (int)*pb;
+    return 0;
+}
+
+typedef struct {
+    const char *name;
+    void *(*copy)(void *, const void *, size_t);
+    void *(*set)(void *, int, size_t);
+    int (*cmp)(const void *, const void *, size_t);
+    int avx2;
+} variant_t;
+
+static const variant_t variants[] = {
+    { "bytes", memcpy_bytes, memset_bytes, memcmp_bytes, 0 },
+    { "words", memcpy_words, memset_words, memcmp_words, 0 },
+    { "rep", memcpy_rep_movsb, memset_rep_stosb, NULL, 0 },
+    { "sse2", memcpy_sse2_nt, memset_sse2_nt, memcmp_sse2, 0 },
+    { "avx2", memcpy_avx2_nt, memset_avx2_nt, NULL, 1 },
+};
+#define NVARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+static uint8_t *src, *dst, *ref;
+
+static uint64_t rng = 0x2545F4914F6CDD1DULL;
+
+static uint64_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int sign(int x) { return (x > 0) - (x < 0); }
+
+static int usable(const variant_t *v) { return !v->avx2 || __builtin_cpu_supports("avx2"); }
+
+/* op is 'c'opy, 's'et or co'm'pare. */
+static int has(const variant_t *v, char op) {
+    return usable(v) && (op == 'c' ? v->copy != NULL : op == 's' ? v->set != NULL : v->cmp != NULL);
+}
+
+/* Random sizes (mostly short, a few up to 2 MiB) at random offsets; the
+ * bytes around the destination must be left alone. src is random data. */
+static int check(const variant_t *v) {
+    for (int i = 0; i < CHECKS; i++) {
+        uint64_t r = next_rand();
+        size_t n = (r & 63) == 0 ? (size_t)(r >> 8) % (2 * MiB) : (size_t)(r >> 8) % 600;
+        size_t so = (r >> 40) & 63, doff = (r >> 48) & 63;
+        for (size_t k = 0; k < n + 128; k++) dst[k] = ref[k] = (uint8_t)(k * 7);
+
+        if (v->copy) {
+            v->copy(dst + doff, src + so, n);
+            memcpy(ref + doff, src + so, n);
+            if (memcmp(dst, ref, n + 128)) return printf("%s: memcpy n=%zu src+%zu dst+%zu\n", v->name, n, so, doff), 0;
+        }
+        if (v->set) {
+            int c = (int)(r >> 56);
+            v->set(dst + doff, c, n);
+            memset(ref + doff, c, n);
+            if (memcmp(dst, ref, n + 128)) return printf("%s: memset n=%zu dst+%zu\n", v->name, n, doff), 0;
+        }
+        if (v->cmp) {
+            memcpy(dst + doff, src + so, n);
+            if (n && (r & 1)) dst[doff + (next_rand() % n)] ^= (uint8_t)(1 + (r >> 24) % 255);
+            int want = memcmp(dst + doff, src + so, n), got = v->cmp(dst + doff, src + so, n);
+            if (sign(want) != sign(got))
+                return printf("%s: memcmp n=%zu a+%zu b+%zu: %d, want %d\n", v->name, n, doff, so, got, want), 0;
+        }
+    }
+    return 1;
+}
+
+/* GB/s for `op` over n bytes at the given misalignment. */
+static double run(const variant_t *v, char op, size_t n, size_t misalign) {
+    size_t iters = BYTES_PER_RUN / n;
+    if (iters > 2000000) iters = 2000000;
+    if (iters < 4) iters = 4;
+    uint8_t *d = dst + misalign, *s = src + misalign / 2;
+    volatile int sink = 0;
+    memset(src, 0x5A, n + 64);
+    memset(dst, 0x5A, n + 64);
+    double t0 = now_sec();
+    for (size_t i = 0; i < iters; i++) {
+        if (op == 'c') v->copy(d, s, n);
+        else if (op == 's') v->set(d, (int)i, n);
+        else sink += v->cmp(d, s, n);
+        __asm__ volatile("" ::: "memory");
+    }
+    double dt = now_sec() - t0;
+    (void)sink;
+    return (double)n * iters / dt / 1e9;
+}
+
+static void table(const char *title, char op) {
+    static const size_t sizes[] = { 8, 64, 256, 1024, 4096, 65536, 1 * MiB, MEM_NT_THRESHOLD, 16 * MiB };
+    static const size_t aligns[] = { 0, 3 };
+
+    printf("\n%s (GB/s)\n%-9s %5s", title, "size", "off");
+    for (size_t k = 0; k < NVARIANTS; k++) {
+        const variant_t *v = &variants[k];
+        if (has(v, op)) printf(" %9s", v->name);
+    }
+    printf("\n");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        for (size_t a = 0; a < sizeof(aligns) / sizeof(aligns[0]); a++) {
+            size_t n = sizes[i];
+            if (n >= MiB) printf("%6zuMiB %5zu", (size_t)(n / MiB), aligns[a]);
+            else printf("%9zu %5zu", n, aligns[a]);
+            for (size_t k = 0; k < NVARIANTS; k++) {
+                const variant_t *v = &variants[k];
+                if (has(v, op)) printf(" %9.2f", run(v, op, n, aligns[a]));
+            }
+            printf("\n");
+        }
+    }
+}
+
+int main(void) {
+    src = aligned_alloc(64, BUF_SIZE);
+    dst = aligned_alloc(64, BUF_SIZE);
+    ref = aligned_alloc(64, BUF_SIZE);
+    if (!src || !dst || !ref) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    mem_init();
+    mem_set_fpu(fpu_begin, fpu_end, __builtin_cpu_supports("avx"));
+    printf("mem: copy/set %s, %s non-temporal from %u KiB\n", mem_copy_impl, mem_nt_impl, MEM_NT_THRESHOLD / 1024);
+    for (size_t k = 0; k < 2 * MiB + 64; k++) src[k] = (uint8_t)next_rand();
+
+    int ok = 1;
+    for (size_t k = 0; k < NVARIANTS; k++) {
+        if (!usable(&variants[k])) {
+            printf("%s: skipped, no AVX2\n", variants[k].name);
+            continue;
+        }
+        if (check(&variants[k])) printf("%s: ok\n", variants[k].name);
+        else ok = 0;
+    }
+    if (!ok) return 1;
+
+    table("memcpy", 'c');
+    table("memset", 's');
+    table("memcmp (equal buffers)", 'm');
+    return 0;
+}
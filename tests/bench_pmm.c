@@ -0,0 +1,184 @@
+/* Host-side PMM benchmark and stress harness.
+ *
+ * Links kernel/core/pmm.c directly and feeds it simulated E820-style maps
+ * (1 GiB to 64 GiB, with a PCI hole below 4 GiB and scattered reserved
+ * ranges). Only the PMM metadata is ever touched, so it is backed by a
+ * sparse host mapping reached through pmm_hhdm_offset.
+ *
+ * Build and run:  make bench-pmm
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "core/pmm.h"
+#include "core/percpu.h"
+#include "arch/x86_64/cpu.h"
+
+#define GiB (1ULL << 30)
+#define MiB (1ULL << 20)
+#define MAX_REGIONS 32
+#define META_WINDOW (512 * MiB)   // host window covering the metadata area
+#define LIVE_MAX (1u << 20)       // frames held live by the random workload
+#define OPS 2000000
+
+/* The PMM reports through the kernel's logging/panic entry points and
+ * finds its per-CPU state through the per-CPU block (ORION_HOSTED). */
+percpu_t percpu_host;
+
+void kprintf(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+}
+
+void panic(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    abort();
+}
+
+static uint64_t rng = 0x2545F4914F6CDD1DULL;
+
+static uint64_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static void add(phys_mem_region_t *map, size_t *n, uint64_t addr, uint64_t len, uint32_t type) {
+    if (*n < MAX_REGIONS && len) map[(*n)++] = (phys_mem_region_t){ .addr = addr, .len = len, .type = type };
+}
+
+/* Usable RAM from 1 MiB with a 3..4 GiB PCI hole and a few reserved
+ * (ACPI-like) holes punched into the usable ranges. */
+static size_t make_map(phys_mem_region_t *map, uint64_t ram) {
+    size_t n = 0;
+    uint64_t low_end = ram < 3 * GiB ? ram : 3 * GiB;
+    uint64_t cursor = 1 * MiB;
+    uint64_t step = low_end / 6;
+    for (int i = 1; i < 6; i++) {
+        uint64_t hole = (uint64_t)i * step & ~(MiB - 1);
+        uint64_t hole_len = (1 + next_rand() % 8) * 64 * 1024;
+        add(map, &n, cursor, hole - cursor, 1);
+        add(map, &n, hole, hole_len, 2);
+        cursor = hole + hole_len;
+    }
+    add(map, &n, cursor, low_end - cursor, 1);
+    if (ram > 3 * GiB) {
+        add(map, &n, 3 * GiB, 1 * GiB, 2);
+        add(map, &n, 4 * GiB, ram - 3 * GiB, 1);
+    }
+    return n;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *live[LIVE_MAX];
+
+/* Random single-page workload: ~55% allocs while the live set fills, then
+ * balanced churn. Returns ops/sec; cycles come from the PMM's own metrics. */
+static double run_workload(size_t *failed) {
+    size_t n = 0;
+    *failed = 0;
+    double t0 = now_sec();
+    for (int i = 0; i < OPS; i++) {
+        uint64_t r = next_rand();
+        int do_alloc = n == 0 || (n < LIVE_MAX && (r % 100) < (i < OPS / 2 ? 55 : 50));
+        if (do_alloc) {
+            void *p = pmm_alloc();
+            if (p) live[n++] = p; else (*failed)++;
+        } else {
+            size_t k = (r >> 16) % n;
+            pmm_free(live[k]);
+            live[k] = live[--n];
+        }
+    }
+    double dt = now_sec() - t0;
+    while (n) pmm_free(live[--n]);
+    return OPS / dt;
+}
+
+/* Contiguous allocations of random order; reports ops/sec. */
+static double run_order_workload(unsigned max_order) {
+    static void *blk[4096];
+    static unsigned ord[4096];
+    size_t n = 0;
+    double t0 = now_sec();
+    for (int i = 0; i < OPS / 10; i++) {
+        uint64_t r = next_rand();
+        if (n < 4096 && (n == 0 || r & 1)) {
+            unsigned o = (unsigned)((r >> 8) % (max_order + 1));
+            void *p = pmm_alloc_order(o);
+            if (p) { blk[n] = p; ord[n++] = o; }
+        } else {
+            size_t k = (r >> 16) % n;
+            pmm_free_order(blk[k], ord[k]);
+            blk[k] = blk[--n]; ord[k] = ord[n];
+        }
+    }
+    double dt = now_sec() - t0;
+    while (n) { n--; pmm_free_order(blk[n], ord[n]); }
+    return (OPS / 10) / dt;
+}
+
+int main(void) {
+    static const uint64_t sizes[] = { 1 * GiB, 4 * GiB, 16 * GiB, 64 * GiB };
+    static const pmm_type_t types[] = { PMM_BITMAP_FINE, PMM_BITMAP_COARSE, PMM_BUDDY };
+
+    uint8_t *window = mmap(NULL, META_WINDOW, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (window == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    pmm_hhdm_offset = (uint64_t)window;
+
+    printf("%-7s %-7s %10s %12s %9s %7s %7s %9s %12s\n", "ram", "policy", "init_us", "alloc_ops/s",
+           "cyc/op", "p50", "p99", "failed", "order_ops/s");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        phys_mem_region_t map[MAX_REGIONS];
+        size_t entries = make_map(map, sizes[s]);
+        for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+            double t0 = now_sec();
+            pmm_init_from_map(map, entries, types[t]);
+            double init_us = (now_sec() - t0) * 1e6;
+            size_t free_at_start = pmm_get_free_memory();
+
+            pmm_run_tests();
+            pmm_reset_metrics();
+
+            size_t failed;
+            uint64_t c0 = arch_x86_rdtsc();
+            double ops = run_workload(&failed);
+            uint64_t cycles = arch_x86_rdtsc() - c0;
+
+            pmm_latency_t la, lf;
+            pmm_get_latency(&la, &lf);
+            double order_ops = run_order_workload(types[t] == PMM_BITMAP_COARSE ? 5 : 6);
+
+            pmm_cache_drain();
+            if (pmm_get_free_memory() != free_at_start) {
+                fprintf(stderr, "%s: leaked %zu bytes\n", pmm_get_type_name(types[t]),
+                        free_at_start - pmm_get_free_memory());
+                return 1;
+            }
+            printf("%4lluGiB %-7s %10.0f %12.0f %9.1f %7llu %7llu %9zu %12.0f\n",
+                   (unsigned long long)(sizes[s] / GiB), pmm_get_type_name(types[t]), init_us, ops,
+                   (double)cycles / OPS, (unsigned long long)hist_percentile(&la, 50),
+                   (unsigned long long)hist_percentile(&la, 99), failed, order_ops);
+        }
+    }
+    return 0;
+}
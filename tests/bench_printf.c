@@ -0,0 +1,281 @@
+/* Host-side check and benchmark of the kernel's vsnprintf().
+ *
+ * Links kernel/lib/printf.c with ORION_HOSTED. That renames the formatter
+ * to orion_vsnprintf/orion_snprintf and leaves out printf/kprintf. The
+ * formatter is checked against the host libc on random conversions, with
+ * truncation. Then formatted lines per second are measured for three
+ * formatters on typical log lines: the kernel's, the host libc's, and the
+ * old one, which is kept here. The old one has no width and no ll, so it
+ * only runs the lines it can print.
+ *
+ * Build and run:  make bench-printf
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define CHECKS 300000
+#define LINES 1000000
+
+int orion_vsnprintf(char *out, size_t size, const char *fmt, va_list ap);
+int orion_snprintf(char *out, size_t size, const char *fmt, ...);
+
+/* printf.c pulls in the driver headers only for printf/kprintf. */
+void serial_write(const char *s) { (void)s; }
+void vga_write(const char *s) { (void)s; }
+
+/* --- Baseline: the old formatter, as it was --- */
+
+static void reverse(char *start, char *end) {
+    while (start < end) {
+        char tmp = *start;
+        *start++ = *end;
+        *end-- = tmp;
+    }
+}
+
+static char *utoa(unsigned long val, char *buf, int base, int lowercase) {
+    char *p = buf;
+    const char *digits = lowercase ? "0123456789abcdef" : "0123456789ABCDEF";
+    if (val == 0) {
+        *p++ = '0';
+        *p = '\0';
+        return buf;
+    }
+    while (val) {
+        *p++ = digits[val % base];
+        val /= base;
+    }
+    *p = '\0';
+    reverse(buf, p - 1);
+    return buf;
+}
+
+static int old_vsnprintf(char *out, size_t size, const char *fmt, va_list ap) {
+    char *start = out;
+    size_t left = size ? size - 1 : 0;
+
+    while (*fmt) {
+        if (*fmt != '%') {
+            if (left) { *out++ = *fmt; --left; }
+            ++fmt;
+            continue;
+        }
+        ++fmt;
+        int longflag = 0;
+        if (*fmt == 'l') { longflag = 1; ++fmt; }
+        char buf[32];
+        switch (*fmt++) {
+            case 'c': {
+                char c = (char)va_arg(ap, int);
+                if (left) { *out++ = c; --left; }
+                break;
+            }
+            case 's': {
+                const char *s = va_arg(ap, const char *);
+                while (*s) {
+                    if (left) { *out++ = *s; --left; }
+                    ++s;
+                }
+                break;
+            }
+            case 'd': {
+                long val = longflag ? va_arg(ap, long) : va_arg(ap, int);
+                if (val < 0) { if (left) { *out++ = '-'; --left; } val = -val; }
+                utoa((unsigned long)val, buf, 10, 0);
+                char *p = buf;
+                while (*p) { if (left) { *out++ = *p++; --left; } else { ++p; } }
+                break;
+            }
+            case 'u': {
+                unsigned long val = longflag ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+                utoa(val, buf, 10, 0);
+                char *p = buf;
+                while (*p) { if (left) { *out++ = *p++; --left; } else { ++p; } }
+                break;
+            }
+            case 'x': {
+                unsigned long val = longflag ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+                utoa(val, buf, 16, 1);
+                char *p = buf;
+                while (*p) { if (left) { *out++ = *p++; --left; } else { ++p; } }
+                break;
+            }
+            case 'p': {
+                void *ptr = va_arg(ap, void *);
+                unsigned long val = (unsigned long)ptr;
+                utoa(val, buf, 16, 1);
+                char *p = buf;
+                if (left) { *out++ = '0'; --left; }
+                if (left) { *out++ = 'x'; --left; }
+                while (*p) { if (left) { *out++ = *p++; --left; } else { ++p; } }
+                break;
+            }
+            case '%': {
+                if (left) { *out++ = '%'; --left; }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    *out = '\0';
+    return out - start;
+}
+
+static uint64_t rng = 0x2545F4914F6CDD1DULL;
+
+static uint64_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Values of every magnitude, with the edges well represented. */
+static uint64_t rand_value(void) {
+    uint64_t r = next_rand();
+    switch (r & 7) {
+        case 0: return 0;
+        case 1: return r >> 60;
+        case 2: return (uint64_t)INT64_MIN;
+        case 3: return UINT64_MAX;
+        default: return next_rand() >> (r >> 8) % 64;
+    }
+}
+
+static int failures;
+
+static void compare(size_t size, const char *fmt, ...) {
+    char want[256], got[256];
+    va_list ap, aq;
+    va_start(ap, fmt);
+    va_copy(aq, ap);
+    memset(want, 0x7F, sizeof(want));
+    memset(got, 0x7F, sizeof(got));
+    int w = vsnprintf(want, size, fmt, ap);
+    int g = orion_vsnprintf(got, size, fmt, aq);
+    va_end(aq);
+    va_end(ap);
+    if ((w != g || memcmp(want, got, sizeof(want))) && failures++ < 10)
+        printf("\"%s\" size %zu: \"%s\" (%d), want \"%s\" (%d)\n", fmt, size, got, g, want, w);
+}
+
+/* A random conversion spec, valid per C99 for its conversion. */
+static void check_random(void) {
+    static const char *lens[] = { "", "hh", "h", "l", "ll", "z", "j", "t" };
+    static const char convs[] = "diuoxXcs%";
+    for (int i = 0; i < CHECKS; i++) {
+        uint64_t r = next_rand();
+        char conv = convs[r % (sizeof(convs) - 1)];
+        int integer = strchr("diuoxX", conv) != NULL, is_signed = conv == 'd' || conv == 'i';
+        char fmt[64] = "[%";
+        size_t n = 2;
+        if (r >> 8 & 1) fmt[n++] = '-';
+        if (r >> 9 & 1 && integer) fmt[n++] = '0';
+        if (r >> 10 & 1 && is_signed) fmt[n++] = '+';
+        if (r >> 11 & 1 && is_signed) fmt[n++] = ' ';
+        if (r >> 12 & 1 && (conv == 'o' || conv == 'x' || conv == 'X')) fmt[n++] = '#';
+        if (r >> 13 & 1) n += (size_t)snprintf(fmt + n, sizeof(fmt) - n, "%u", (unsigned)(r >> 16) % 25);
+        if (r >> 14 & 1 && conv != 'c') n += (size_t)snprintf(fmt + n, sizeof(fmt) - n, ".%u", (unsigned)(r >> 24) % 22);
+        const char *len = integer ? lens[(r >> 32) % 8] : "";
+        n += (size_t)snprintf(fmt + n, sizeof(fmt) - n, "%s%c]", len, conv);
+        size_t size = (r >> 40) & 3 ? 256 : (r >> 42) % 24;
+        uint64_t v = rand_value();
+
+        if (conv == 's') compare(size, fmt, "orion kernel" + (r >> 48) % 12);
+        else if (conv == 'c') compare(size, fmt, 'a' + (int)(v % 26));
+        else if (conv == '%') compare(size, fmt);
+        else if (len[0] == 'l' || len[0] == 'z' || len[0] == 'j' || len[0] == 't') compare(size, fmt, (long)v);
+        else compare(size, fmt, (int)v);
+    }
+    compare(256, "%p %p %s", (void *)0xffffffff80001000ULL, (void *)0x10, (char *)NULL);
+    compare(256, "%*d|%-*d|%.*s|%*s", 6, 42, -6, 42, 3, "abcdef", -4, "ab");
+    compare(256, "%#.0o %.0d %#x %05d %-05d %+.3d", 0, 0, 0, -42, -42, 7);
+
+    /* Undefined in C99 (the host returns -1); the kernel drops the '%'. */
+    char buf[16];
+    if (orion_snprintf(buf, sizeof(buf), "trailing %") != 9 || strcmp(buf, "trailing ")) {
+        printf("\"trailing %%\": \"%s\"\n", buf);
+        failures++;
+    }
+}
+
+typedef int (*vfmt_t)(char *, size_t, const char *, va_list);
+
+static int call(vfmt_t f, char *out, size_t size, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int r = f(out, size, fmt, ap);
+    va_end(ap);
+    return r;
+}
+
+/* Lines per second for one line shape. */
+static double run_once(vfmt_t f, int line) {
+    char buf[256];
+    volatile int sink = 0;
+    double t0 = now_sec();
+    for (int i = 0; i < LINES; i++) {
+        uint64_t v = (uint64_t)i * 0x9E3779B97F4A7C15ULL;
+        switch (line) {
+            case 0:
+                sink += call(f, buf, sizeof(buf), "[%d] sched: cpu%u switched to %s (%lu switches)\n", 2, (unsigned)(i & 7),
+                             "worker", (unsigned long)v >> 20);
+                break;
+            case 1:
+                sink += call(f, buf, sizeof(buf), "[%d] vmm: fault at %p, pte %lx\n", 3, (void *)(uintptr_t)v,
+                             (unsigned long)v >> 12);
+                break;
+            case 2:
+                sink += call(f, buf, sizeof(buf), "[%d] pmm: region %llx-%llx: %llu frames, %llu KiB free\n", 2,
+                             (unsigned long long)v >> 16, (unsigned long long)v >> 15, (unsigned long long)v >> 40,
+                             (unsigned long long)v >> 30);
+                break;
+            default:
+                sink += call(f, buf, sizeof(buf), "  %-8s %5zu %08lx %3d%%\n", "slab-64", (size_t)(v >> 52),
+                             (unsigned long)v >> 32, (int)(v >> 57));
+                break;
+        }
+    }
+    (void)sink;
+    return LINES / (now_sec() - t0);
+}
+
+/* Best of three, to ride out other load on the host. */
+static double run(vfmt_t f, int line) {
+    double best = 0;
+    for (int k = 0; k < 3; k++) {
+        double r = run_once(f, line);
+        if (r > best) best = r;
+    }
+    return best;
+}
+
+int main(void) {
+    check_random();
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("vsnprintf: ok against host libc\n\n");
+
+    static const char *names[] = { "%d %u %s %lu", "%p %lx", "%llx %llu", "%-8s %5zu %08lx %3d%%" };
+    printf("%-22s %12s %12s %12s\n", "line (lines/s)", "old", "new", "host libc");
+    for (int line = 0; line < 4; line++) {
+        printf("%-22s", names[line]);
+        if (line < 2) printf(" %12.0f", run(old_vsnprintf, line));
+        else printf(" %12s", "-");
+        printf(" %12.0f %12.0f\n", run(orion_vsnprintf, line), run(vsnprintf, line));
+    }
+    return 0;
+}
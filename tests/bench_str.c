@@ -0,0 +1,203 @@
+/* Host-side benchmark of the string function variants.
+ *
+ * Links kernel/lib/strings*.c and kernel/lib/mem*.c directly (ORION_HOSTED
+ * leaves out the public names, so the host libc keeps its own). It checks
+ * the variants in two ways. First, against the host libc on random strings
+ * at random alignments. Second, with strings that end on the last byte
+ * before a PROT_NONE page, so any overread faults. Then it times
+ * strlen/strnlen/strcmp against the byte loops that lib/strings.c and
+ * lib/strcmp.c used to be.
+ *
+ * Build and run:  make bench-str
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "lib/strings.h"
+#include "lib/mem.h"
+
+#define PAGE 4096
+#define CHECKS 200000
+#define BYTES_PER_RUN (64 << 20)    // each timing scans about this much
+
+/* --- Baseline: the old byte loops, kept out of the vectorizer --- */
+
+__attribute__((noinline, optimize("no-tree-vectorize")))
+static size_t strlen_bytes(const char *s) {
+    const char *p = s;
+    while (*p) ++p;
+    return (size_t)(p - s);
+}
+
+__attribute__((noinline, optimize("no-tree-vectorize")))
+static size_t strnlen_bytes(const char *s, size_t maxlen) {
+    size_t i = 0;
+    while (i < maxlen && s[i]) ++i;
+    return i;
+}
+
+__attribute__((noinline, optimize("no-tree-vectorize")))
+static int strcmp_bytes(const char *a, const char *b) {
+    while (*a && (*a == *b)) {
+        ++a;
+        ++b;
+    }
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+static uint64_t rng = 0x2545F4914F6CDD1DULL;
+
+static uint64_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int sign(int x) { return (x > 0) - (x < 0); }
+
+static int failures;
+
+#define EXPECT(cond, ...) \
+    do { if (!(cond) && failures++ < 10) printf(__VA_ARGS__); } while (0)
+
+/* Random nonzero bytes, a few of them 0x80 and above. */
+static void fill(char *s, size_t len) {
+    for (size_t k = 0; k < len; k++) {
+        uint64_t r = next_rand();
+        s[k] = (char)((r & 15) == 0 ? 0x80 | (r >> 8) : 'a' + (r >> 8) % 26);
+    }
+    s[len] = '\0';
+}
+
+static void check_string(const char *s, size_t len, const char *other) {
+    EXPECT(strlen_words(s) == len, "strlen_words len=%zu: %zu\n", len, strlen_words(s));
+    EXPECT(strlen_sse2(s) == len, "strlen_sse2 len=%zu: %zu\n", len, strlen_sse2(s));
+    size_t maxes[] = { 0, len / 2, len, len + 1, (size_t)-1 };
+    for (size_t m = 0; m < 5; m++) {
+        size_t want = strnlen(s, maxes[m]);
+        EXPECT(strnlen_words(s, maxes[m]) == want, "strnlen_words len=%zu max=%zu\n", len, maxes[m]);
+        EXPECT(strnlen_sse2(s, maxes[m]) == want, "strnlen_sse2 len=%zu max=%zu\n", len, maxes[m]);
+    }
+    int want = sign(strcmp(s, other));
+    EXPECT(sign(strcmp_words(s, other)) == want, "strcmp_words len=%zu\n", len);
+    EXPECT(sign(strcmp_sse2(s, other)) == want, "strcmp_sse2 len=%zu\n", len);
+    EXPECT(sign(strcmp_words(other, s)) == -want, "strcmp_words rev len=%zu\n", len);
+    EXPECT(sign(strcmp_sse2(other, s)) == -want, "strcmp_sse2 rev len=%zu\n", len);
+    int c = len ? (unsigned char)s[next_rand() % len] : 'x';
+    EXPECT(strchr_words(s, c) == strchr(s, c), "strchr_words len=%zu c=%d\n", len, c);
+    EXPECT(strchr_words(s, '#') == NULL, "strchr_words len=%zu absent\n", len);
+    EXPECT(strchr_words(s, 0) == s + len, "strchr_words len=%zu nul\n", len);
+    EXPECT(memchr_words(s, c, len) == memchr(s, c, len), "memchr_words len=%zu c=%d\n", len, c);
+    EXPECT(memchr_words(s, 0, len + 1) == s + len, "memchr_words len=%zu nul\n", len);
+    EXPECT(memchr_words(s, '#', len) == NULL, "memchr_words len=%zu absent\n", len);
+}
+
+/* Strings of every length up to 300 ending right before a guard page, and
+ * compared against a copy that also ends there or that differs only in its
+ * last byte. */
+static void check_guard(void) {
+    char *map = mmap(NULL, 3 * PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    mprotect(map + PAGE, PAGE, PROT_NONE);
+    char *a_end = map + PAGE, *b_end = map + 3 * PAGE;
+    for (size_t len = 0; len <= 300; len++) {
+        char *a = a_end - len - 1;
+        fill(a, len);
+        for (size_t shift = 0; shift < 16; shift++) {
+            char *b = (shift ? map + 2 * PAGE + 64 + shift : b_end - len - 1);
+            memcpy(b, a, len + 1);
+            check_string(a, len, b);
+            if (len) {
+                b[len - 1] ^= 1;
+                check_string(a, len, b);
+            }
+        }
+        /* A buffer with no terminator up to the guard: memchr must stop. */
+        EXPECT(memchr_words(a_end - len, '#', len) == NULL, "memchr_words guard len=%zu\n", len);
+        EXPECT(strnlen_words(a, len) == len, "strnlen_words guard len=%zu\n", len);
+        EXPECT(strnlen_sse2(a, len) == len, "strnlen_sse2 guard len=%zu\n", len);
+    }
+    munmap(map, 3 * PAGE);
+}
+
+static void check_random(void) {
+    static char buf[2][8192];
+    for (int i = 0; i < CHECKS; i++) {
+        uint64_t r = next_rand();
+        size_t len = (r & 3) ? (r >> 8) % 64 : (r >> 8) % 3000;
+        char *a = buf[0] + ((r >> 40) & 63), *b = buf[1] + ((r >> 48) & 63);
+        fill(a, len);
+        memcpy(b, a, len + 1);
+        if (len && (r >> 56) & 1) b[(r >> 20) % len] = (char)(next_rand() | 1);
+        check_string(a, len, b);
+    }
+
+    static uint8_t m1[4096], m2[4096];
+    for (int i = 0; i < CHECKS / 10; i++) {
+        uint64_t r = next_rand();
+        size_t n = (r >> 8) % 1024, so = (r >> 24) % 1024, doff = (r >> 40) % 1024;
+        for (size_t k = 0; k < sizeof(m1); k++) m1[k] = m2[k] = (uint8_t)next_rand();
+        memmove_words(m1 + doff, m1 + so, n);
+        memmove(m2 + doff, m2 + so, n);
+        EXPECT(!memcmp(m1, m2, sizeof(m1)), "memmove_words n=%zu src=%zu dst=%zu\n", n, so, doff);
+    }
+}
+
+/* ns per call. */
+static double run(char op, int variant, const char *s, const char *t, size_t len) {
+    size_t iters = BYTES_PER_RUN / (len + 16);
+    volatile size_t sink = 0;
+    double t0 = now_sec();
+    for (size_t i = 0; i < iters; i++) {
+        __asm__ volatile("" : "+r"(s));
+        if (op == 'l') sink += variant == 0 ? strlen_bytes(s) : variant == 1 ? strlen_words(s) : strlen_sse2(s);
+        else if (op == 'n')
+            sink += variant == 0 ? strnlen_bytes(s, 512) : variant == 1 ? strnlen_words(s, 512) : strnlen_sse2(s, 512);
+        else sink += (size_t)(variant == 0 ? strcmp_bytes(s, t) : variant == 1 ? strcmp_words(s, t) : strcmp_sse2(s, t));
+    }
+    (void)sink;
+    return (now_sec() - t0) * 1e9 / iters;
+}
+
+static void table(const char *title, char op) {
+    static const size_t lens[] = { 1, 7, 16, 31, 64, 200, 511, 1024, 4096 };
+    static char a[8192], b[8192];
+
+    printf("\n%s (ns/call)\n%6s %9s %9s %9s\n", title, "len", "bytes", "words", "sse2");
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        size_t len = lens[i];
+        fill(a + 3, len);
+        memcpy(b + 5, a + 3, len + 1);
+        printf("%6zu", len);
+        for (int v = 0; v < 3; v++) printf(" %9.2f", run(op, v, a + 3, b + 5, len));
+        printf("\n");
+    }
+}
+
+int main(void) {
+    check_guard();
+    check_random();
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("strlen/strnlen/strcmp/strchr/memchr/memmove: ok\n");
+
+    table("strlen", 'l');
+    table("strnlen, max 512", 'n');
+    table("strcmp (equal strings, src+3 vs src+5)", 'c');
+    return 0;
+}